@@ -0,0 +1,159 @@
+// compares the newline scanning kernels against plain loops over a
+// few hundred megabytes of source-like text
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/dyn_strings/line_scan.h"
+#include "../src/dyn_strings/utf32_string.h"
+
+#define BENCH_UTF8_SIZE ((size_t)512 * 1024 * 1024)
+#define BENCH_UTF32_LEN ((size_t)96 * 1024 * 1024)
+#define BENCH_RUNS 3
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// fills `dest` with lines of a few dozen bytes, roughly one codepoint
+// in 64 is outside ASCII
+static size_t fill_text(char* dest, size_t size) {
+    static const char* multibyte[] = {"\xc3\xa9", "\xe2\x82\xac",
+                                      "\xf0\x9f\x98\x80"};
+    static const char ascii[] = "static int x = 0; // comment\n";
+    size_t len = 0;
+    unsigned seed = 1;
+    while (len + 4 < size) {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 64 == 0) {
+            const char* seq = multibyte[(seed >> 8) % 3];
+            memcpy(&dest[len], seq, strlen(seq));
+            len += strlen(seq);
+        } else {
+            dest[len++] = ascii[(seed >> 16) % (sizeof(ascii) - 1)];
+        }
+    }
+    return len;
+}
+
+static void report(const char* name, size_t bytes, double seconds,
+                   size_t check) {
+    printf("  %-24s %8.2f GB/s  (%zu)\n", name, bytes / seconds / 1e9,
+           check);
+}
+
+// the line index the way it was built before, a codepoint count and
+// a line per '\n'
+static size_t plain_lines_utf8(const char* str, size_t len) {
+    size_t lines = 0;
+    size_t span = 0;
+    for (size_t i = 0; i < len; i += 1) {
+        span += ((unsigned char)str[i] & 0xc0) != 0x80;
+        if (str[i] != '\n') continue;
+        lines += span != 0;
+        span = 0;
+    }
+    return lines;
+}
+
+static size_t scan_lines_utf8(const char* str, size_t len) {
+    size_t ends[LINE_SCAN_BATCH];
+    size_t codepoint_ends[LINE_SCAN_BATCH];
+    size_t ends_length = 0;
+    size_t lines = 0;
+    size_t line_begin = 0;
+    do {
+        ends_length = line_scan_utf8(str, len, line_begin, ends,
+                                     codepoint_ends, LINE_SCAN_BATCH);
+        size_t codepoint_begin = 0;
+        for (size_t i = 0; i < ends_length; i += 1) {
+            lines += codepoint_ends[i] != codepoint_begin;
+            codepoint_begin = codepoint_ends[i];
+        }
+        if (ends_length) line_begin = ends[ends_length - 1];
+    } while (ends_length == LINE_SCAN_BATCH);
+    return lines;
+}
+
+static size_t plain_lines_utf32(const c32_t* str, size_t len) {
+    size_t lines = 0;
+    size_t byte_span = 0;
+    for (size_t i = 0; i < len; i += 1) {
+        byte_span += utf32_char_utf8_len(str[i]);
+        if (str[i] != '\n') continue;
+        lines += byte_span != 0;
+        byte_span = 0;
+    }
+    return lines;
+}
+
+static size_t scan_lines_utf32(const c32_t* str, size_t len) {
+    line_scan_iter_t it = line_scan_iter_create(str, len);
+    size_t lines = 0;
+    size_t span = 0;
+    size_t byte_span = 0;
+    bool is_line_end = false;
+    while (line_scan_iter_next(&it, &span, &byte_span, &is_line_end))
+        lines += is_line_end && byte_span != 0;
+    return lines;
+}
+
+static size_t plain_count_utf32(const c32_t* str, size_t len) {
+    size_t result = 0;
+    for (size_t i = 0; i < len; i += 1) result += str[i] == '\n';
+    return result;
+}
+
+#define BENCH(name, bytes, expr)                          \
+    do {                                                  \
+        double best = 1e9;                                \
+        size_t check = 0;                                 \
+        for (int run = 0; run < BENCH_RUNS; run += 1) {   \
+            double begin = now();                         \
+            check = (expr);                               \
+            double seconds = now() - begin;               \
+            if (seconds < best) best = seconds;           \
+        }                                                 \
+        report(name, bytes, best, check);                 \
+    } while (0)
+
+int main(void) {
+    char* utf8 = malloc(BENCH_UTF8_SIZE);
+    c32_t* utf32 = malloc(BENCH_UTF32_LEN * sizeof(c32_t));
+    if (!utf8 || !utf32) return 1;
+
+    size_t utf8_len = fill_text(utf8, BENCH_UTF8_SIZE);
+    size_t utf32_len = 0;
+    for (size_t i = 0; utf32_len < BENCH_UTF32_LEN; i += 1) {
+        unsigned char c = utf8[i];
+        if ((c & 0xc0) == 0x80) continue;
+        utf32[utf32_len++] = c < 0x80 ? c : 0xe9 + (i & 0x3ff);
+    }
+
+    printf("UTF-8, %zu MiB\n", utf8_len >> 20);
+    BENCH("plain line index", utf8_len,
+          plain_lines_utf8(utf8, utf8_len));
+    BENCH("scanned line index", utf8_len,
+          scan_lines_utf8(utf8, utf8_len));
+    BENCH("scanned codepoints", utf8_len,
+          line_scan_utf8_codepoints(utf8, utf8_len));
+
+    size_t utf32_size = utf32_len * sizeof(c32_t);
+    printf("UTF-32, %zu MiB\n", utf32_size >> 20);
+    BENCH("plain line index", utf32_size,
+          plain_lines_utf32(utf32, utf32_len));
+    BENCH("scanned line index", utf32_size,
+          scan_lines_utf32(utf32, utf32_len));
+    BENCH("plain newline count", utf32_size,
+          plain_count_utf32(utf32, utf32_len));
+    BENCH("scanned newline count", utf32_size,
+          line_scan_count_utf32(utf32, utf32_len));
+
+    free(utf8);
+    free(utf32);
+    return 0;
+}
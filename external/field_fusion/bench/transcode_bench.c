@@ -0,0 +1,124 @@
+// compares the UTF-8 <-> UTF-32 converters against iconv on mostly
+// ASCII source text and on text heavy with multibyte sequences
+
+#include <fieldfusion.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_TEXT_SIZE (64 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// fills `dest` with `size` bytes of text where roughly one codepoint
+// in `multibyte_every` is outside ASCII
+static size_t fill_text(char *dest, size_t size,
+                        unsigned multibyte_every) {
+    static const char *multibyte[] = {"\xc3\xa9", "\xe2\x82\xac",
+                                      "\xf0\x9f\x98\x80"};
+    static const char ascii[] = "static int x = 0; // comment\n";
+    size_t len = 0;
+    unsigned seed = 1;
+    while (len + 4 < size) {
+        seed = seed * 1103515245 + 12345;
+        if (multibyte_every && (seed >> 16) % multibyte_every == 0) {
+            const char *seq = multibyte[(seed >> 8) % 3];
+            memcpy(&dest[len], seq, strlen(seq));
+            len += strlen(seq);
+        } else {
+            dest[len++] = ascii[(seed >> 16) % (sizeof(ascii) - 1)];
+        }
+    }
+    return len;
+}
+
+static size_t iconv_convert(iconv_t cd, const void *src,
+                            size_t src_len, void *dest,
+                            size_t dest_len) {
+    char *in = (char *)src;
+    char *out = dest;
+    size_t out_left = dest_len;
+    iconv(cd, 0, 0, 0, 0);
+    if (iconv(cd, &in, &src_len, &out, &out_left) == (size_t)-1)
+        return (size_t)-1;
+    return dest_len - out_left;
+}
+
+static void report(const char *name, size_t bytes, double seconds) {
+    printf("  %-22s %8.2f GB/s\n", name, bytes / seconds / 1e9);
+}
+
+static void bench(const char *title, unsigned multibyte_every) {
+    char *utf8 = malloc(BENCH_TEXT_SIZE);
+    c32_t *utf32 = malloc(BENCH_TEXT_SIZE * sizeof(c32_t));
+    char *back = malloc(BENCH_TEXT_SIZE);
+    size_t len = fill_text(utf8, BENCH_TEXT_SIZE, multibyte_every);
+    iconv_t to_utf32 = iconv_open("UTF-32LE", "UTF-8");
+    iconv_t to_utf8 = iconv_open("UTF-8", "UTF-32LE");
+
+    printf("%s, %zu MB\n", title, len >> 20);
+
+    double best = 1e9;
+    size_t utf32_len = 0;
+    for (int i = 0; i < BENCH_RUNS; i += 1) {
+        double start = now();
+        utf32_len = ff_utf8_to_utf32(utf32, utf8, len);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    report("ff_utf8_to_utf32", len, best);
+
+    best = 1e9;
+    for (int i = 0; i < BENCH_RUNS; i += 1) {
+        double start = now();
+        iconv_convert(to_utf32, utf8, len, utf32,
+                      BENCH_TEXT_SIZE * sizeof(c32_t));
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    report("iconv UTF-8 to UTF-32", len, best);
+
+    best = 1e9;
+    size_t back_len = 0;
+    for (int i = 0; i < BENCH_RUNS; i += 1) {
+        double start = now();
+        back_len = ff_utf32_to_utf8_bounded(back, BENCH_TEXT_SIZE,
+                                            utf32, utf32_len);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    report("ff_utf32_to_utf8", len, best);
+
+    best = 1e9;
+    for (int i = 0; i < BENCH_RUNS; i += 1) {
+        double start = now();
+        iconv_convert(to_utf8, utf32, utf32_len * sizeof(c32_t), back,
+                      BENCH_TEXT_SIZE);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    report("iconv UTF-32 to UTF-8", len, best);
+
+    if (back_len != len || memcmp(back, utf8, len))
+        printf("  round trip mismatch\n");
+
+    iconv_close(to_utf32);
+    iconv_close(to_utf8);
+    free(utf8);
+    free(utf32);
+    free(back);
+}
+
+int main(void) {
+    bench("ASCII source", 0);
+    bench("one multibyte codepoint in 64", 64);
+    bench("one multibyte codepoint in 4", 4);
+    return 0;
+}
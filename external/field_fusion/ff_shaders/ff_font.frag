@@ -1,7 +1,9 @@
 precision highp float;
+layout(origin_upper_left) in vec4 gl_FragCoord;
 in vec2 text_pos;
 in vec4 text_color;
 in float strength;
+flat in vec4 clip;
 out vec4 color;
 
 uniform sampler2D font_atlas;
@@ -19,6 +21,11 @@ float srgb_from_linear(float value) {
 }
 float Luma(vec3 color) { return dot(color, vec3(0.2126, 0.7152, 0.0722)); }
 void main() {
+    /* Runs drawn together are clipped here instead of by the scissor */
+    if (any(lessThan(gl_FragCoord.xy, clip.xy)) ||
+        any(greaterThanEqual(gl_FragCoord.xy, clip.xy + clip.zw)))
+        discard;
+
     vec2 coords = (font_projection * vec4(text_pos, 0.0, 1.0)).xy;
 
     /* Invert the strength so that 1.0 becomes bold and 0.0 becomes thin */
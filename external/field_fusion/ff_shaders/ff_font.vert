@@ -6,7 +6,9 @@ layout (location = 4) in float y_offset;
 layout (location = 5) in float skewness;
 layout (location = 6) in float strength;
 
-uniform mat4 projection;
+/* Index one past the last glyph of each run drawn */
+uniform int runs_end[FF_BATCH_RUNS];
+uniform int runs_length;
 
 out VS_OUT {
     int glyph;
@@ -15,7 +17,7 @@ out VS_OUT {
     float y_offset;
     float skewness;
     float strength;
-
+    int run;
 } vs_out;
 
 void main() {
@@ -28,4 +30,9 @@ void main() {
     vs_out.y_offset = y_offset;
     vs_out.skewness = skewness;
     vs_out.strength = strength;
+
+    int run = 0;
+    while (run < runs_length - 1 && gl_VertexID >= runs_end[run])
+        run += 1;
+    vs_out.run = run;
 }
@@ -140,9 +140,31 @@ typedef struct {
     ff_attrs_t attrs;
 } ff_glyph_t;
 
+typedef struct {
+    /**
+     * Vertex array reading glyphs out of `buffer`, its attributes are
+     * set up once.
+     */
+    unsigned vao;
+
+    /**
+     * Ring the glyphs of each draw are written to, past those of the
+     * draw before. Once it wraps around the buffer is orphaned, so
+     * draws still reading the old storage are left alone.
+     */
+    unsigned buffer;
+
+    /**
+     * Size of the buffer and where the next draw writes, in bytes.
+     */
+    size_t capacity;
+    size_t offset;
+} ff_glyph_stream_t;
+
 typedef struct {
     ff_font_t font;
     ff_atlas_t atlas;
+    ff_glyph_stream_t stream;
 } ff_font_texture_pack_t;
 
 typedef struct ht_fpack_entry {
@@ -180,6 +202,13 @@ typedef struct {
     int texture_padding;
 } ff_font_config_t;
 
+// UTF-8 decoding state across chunks, a sequence cut by the end of a
+// chunk waits in `pending` for the rest of its bytes
+typedef struct {
+    unsigned char pending[4];
+    unsigned pending_len;
+} ff_utf8_stream_t;
+
 typedef enum {
     ff_flag_default = 0x1,
     ff_flag_enable_kerning = 0x1,
@@ -198,11 +227,33 @@ ff_font_id_t ff_load_font(const char *path, ff_font_config_t config);
 void ff_unload_font(ff_font_id_t font);
 int ff_gen_glyphs(ff_font_id_t font, const c32_t *codepoints,
                   ulong codepoints_len);
+// draws right away within the scissor set, after whatever was queued
+// before
 void ff_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
              ulong glyphs_len, const float *projection);
+// queues glyphs to be drawn on the next flush. `clip` is the
+// rectangle {x, y, width, height} they are clipped to, in pixels from
+// the top left of the framebuffer, or null for none. the scissor is
+// left out
+void ff_batch_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
+                   ulong glyphs_len, const float *projection,
+                   const float *clip);
+// draws the glyphs queued in the order they were queued, with a draw
+// for each stretch of them in the same font unless they were queued
+// with many different projections or clips
+void ff_batch_flush(void);
 ff_attrs_t ff_get_default_attributes();
 size_t ff_utf8_to_utf32(c32_t *dest, const char *src, ulong src_len);
 size_t ff_utf32_to_utf8(char *dest, const c32_t *src, ulong src_len);
+// fails instead of writing past `dest_len` bytes
+size_t ff_utf32_to_utf8_bounded(char *dest, ulong dest_len,
+                                const c32_t *src, ulong src_len);
+ff_utf8_stream_t ff_utf8_stream_create(void);
+// `dest` holds `src_len` codepoints
+size_t ff_utf8_stream_decode(ff_utf8_stream_t *m, c32_t *dest,
+                             const char *src, ulong src_len);
+// false if the input ended inside a sequence
+bool ff_utf8_stream_finish(ff_utf8_stream_t *m);
 ff_dimensions_t ff_print_utf8(ff_glyph_t *glyphs, size_t *out_len,
                               const char *str, size_t str_len,
                               ff_typo_t typo, float x, float y,
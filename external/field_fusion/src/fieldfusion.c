@@ -1,5 +1,5 @@
 #include <fieldfusion.h>
-#include <iconv.h>
+#include <float.h>
 #include <math.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -23,6 +23,12 @@ __FF_EMBED_FILE(g_msdf_fragment, ff_shaders/ff_msdf.frag);
 __FF_EMBED_FILE(g_default_font, ff_fonts/SourceCodePro-Regular.ttf);
 // clang-format on
 
+/* Runs a single draw of the batch takes, the shaders hold the
+ * projection and the clip of each in arrays this long. */
+#define FF_BATCH_RUNS 32
+#define FF_STRINGIFY(x) #x
+#define FF_DEFINE(name) "#define " #name " " FF_STRINGIFY(name) "\n"
+
 enum endian { endian_le, endian_be };
 
 extern const char g_font_fragment[];
@@ -36,9 +42,6 @@ extern const int g_default_font_len;
 
 static enum endian g_system_endianess;
 
-static iconv_t g_utf8_to_utf32;
-static iconv_t g_utf32_to_utf8;
-
 typedef struct {
     float offset_x;
     float offset_y;
@@ -65,9 +68,10 @@ static bool compile_shader(const char *source, GLenum type,
         fprintf(stderr, "failed to create shader\n");
     }
 
-    const char *src[] = {"#version ", sl_version, "\n", source};
+    const char *src[] = {"#version ", sl_version, "\n",
+                         FF_DEFINE(FF_BATCH_RUNS), source};
 
-    glShaderSource(*shader, 4, src, NULL);
+    glShaderSource(*shader, 5, src, NULL);
     glCompileShader(*shader);
 
     GLint status;
@@ -90,7 +94,10 @@ static void gen_extended_ascii(const ff_font_id_t font_handle) {
 }
 
 typedef struct {
-    int window_projection;
+    int projections;
+    int clips;
+    int runs_end;
+    int runs_length;
     int font_atlas_projection;
     int index;
     int atlas;
@@ -121,6 +128,30 @@ static int g_max_texture_size;
 static size_t g_max_handle = 0;
 static ht_fpack_map_t g_fonts;
 
+typedef struct {
+    ff_font_id_t font;
+    /* The glyphs of the run among those of the batch. */
+    size_t first;
+    size_t length;
+    GLfloat projection[16];
+    /* Rectangle the run is clipped to, in pixels from the top left
+     * of the framebuffer. */
+    GLfloat clip[4];
+} ff_batch_run_t;
+
+/* Glyphs queued since the last flush. They are copied, so callers may
+ * reuse theirs right away. Capacities are in bytes. */
+typedef struct {
+    ff_glyph_t *glyphs;
+    size_t glyphs_length;
+    size_t glyphs_capacity;
+    ff_batch_run_t *runs;
+    size_t runs_length;
+    size_t runs_capacity;
+} ff_batch_t;
+
+static ff_batch_t g_batch;
+
 ff_glyph_vec_t ff_glyph_vec_create() {
     return (ff_glyph_vec_t){
         .data = malloc(256), .len = 0, .cap = 256};
@@ -294,17 +325,6 @@ void ff_initialize(const char *sl_version) {
     c = (char *)&eni;
     g_system_endianess = *c == 1 ? endian_le : endian_be;
 
-    if (g_system_endianess == endian_le) {
-        g_utf8_to_utf32 = iconv_open("UTF-32LE", "UTF-8");
-        g_utf32_to_utf8 = iconv_open("UTF-8", "UTF-32LE");
-    } else {
-        g_utf8_to_utf32 = iconv_open("UTF-32BE", "UTF-8BE");
-        g_utf32_to_utf8 = iconv_open("UTF-8BE", "UTF-32BE");
-    }
-
-    assert(g_utf8_to_utf32 != (iconv_t)-1);
-    assert(g_utf32_to_utf8 != (iconv_t)-1);
-
     const FT_Error error = FT_Init_FreeType(&g_ft_library);
     assert("Failed to initialize freetype2" && !error);
 
@@ -372,8 +392,13 @@ void ff_initialize(const char *sl_version) {
     glGetProgramiv(g_render_shader, GL_LINK_STATUS, &link_status);
     assert("Failed to link g_render_shader" && link_status);
 
-    g_uniforms.window_projection =
-        glGetUniformLocation(g_render_shader, "projection");
+    g_uniforms.projections =
+        glGetUniformLocation(g_render_shader, "projections");
+    g_uniforms.clips = glGetUniformLocation(g_render_shader, "clips");
+    g_uniforms.runs_end =
+        glGetUniformLocation(g_render_shader, "runs_end");
+    g_uniforms.runs_length =
+        glGetUniformLocation(g_render_shader, "runs_length");
     g_uniforms.font_atlas_projection =
         glGetUniformLocation(g_render_shader, "font_projection");
     g_uniforms.index =
@@ -386,7 +411,10 @@ void ff_initialize(const char *sl_version) {
     g_uniforms.units_per_em =
         glGetUniformLocation(g_render_shader, "units_per_em");
 
-    assert(g_uniforms.window_projection != -1);
+    assert(g_uniforms.projections != -1);
+    assert(g_uniforms.clips != -1);
+    assert(g_uniforms.runs_end != -1);
+    assert(g_uniforms.runs_length != -1);
     assert(g_uniforms.font_atlas_projection != -1);
     assert(g_uniforms.index != -1);
     assert(g_uniforms.atlas != -1);
@@ -416,10 +444,100 @@ void ff_initialize(const char *sl_version) {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     g_fonts = ht_fpack_map_create();
+    g_batch = (ff_batch_t){
+        .glyphs = malloc(0x1000 * sizeof(ff_glyph_t)),
+        .glyphs_capacity = 0x1000 * sizeof(ff_glyph_t),
+        .runs = malloc(FF_BATCH_RUNS * sizeof(ff_batch_run_t)),
+        .runs_capacity = FF_BATCH_RUNS * sizeof(ff_batch_run_t)};
+    assert(g_batch.glyphs);
+    assert(g_batch.runs);
     ff_new_load_font_from_memory(g_default_font, g_default_font_len,
                                  ff_default_font_config());
 }
 
+/* Glyphs the stream of a font holds before it first grows. */
+static const size_t g_glyph_stream_capacity = 0x2000;
+
+static void glyph_stream_create(ff_glyph_stream_t *m) {
+    m->capacity = g_glyph_stream_capacity * sizeof(ff_glyph_t);
+    m->offset = 0;
+    glGenVertexArrays(1, &m->vao);
+    glGenBuffers(1, &m->buffer);
+    glBindVertexArray(m->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m->buffer);
+    glBufferData(GL_ARRAY_BUFFER, m->capacity, 0, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+    glEnableVertexAttribArray(5);
+    glEnableVertexAttribArray(6);
+
+    void *position_offset = (void *)offsetof(ff_glyph_t, position.x);
+    void *color_offset = (void *)offsetof(ff_glyph_t, color);
+    void *codepoint_offset = (void *)offsetof(ff_glyph_t, codepoint);
+    void *size_offset = (void *)offsetof(ff_glyph_t, size);
+    void *offset_offset = (void *)offsetof(ff_glyph_t, attrs.offset);
+    void *skew_offset = (void *)offsetof(ff_glyph_t, attrs.skew);
+    void *strength_offset =
+        (void *)offsetof(ff_glyph_t, attrs.strength);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(ff_glyph_t), position_offset);
+    glVertexAttribIPointer(1, 4, GL_UNSIGNED_BYTE, sizeof(ff_glyph_t),
+                           color_offset);
+    glVertexAttribIPointer(2, 1, GL_INT, sizeof(ff_glyph_t),
+                           codepoint_offset);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(ff_glyph_t), size_offset);
+    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(ff_glyph_t), offset_offset);
+    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(ff_glyph_t), skew_offset);
+    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE,
+                          sizeof(ff_glyph_t), strength_offset);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void glyph_stream_destroy(ff_glyph_stream_t *m) {
+    glDeleteBuffers(1, &m->buffer);
+    glDeleteVertexArrays(1, &m->vao);
+}
+
+/* Maps room for the glyphs past those of the last draw, `first` is
+ * set to the index of the first one. The range is unsynchronized, no
+ * draw in flight reads it since the buffer is orphaned before the
+ * ring wraps over them. */
+static ff_glyph_t *glyph_stream_map(ff_glyph_stream_t *m,
+                                    ulong glyphs_len, GLint *first) {
+    size_t size = glyphs_len * sizeof(ff_glyph_t);
+    glBindBuffer(GL_ARRAY_BUFFER, m->buffer);
+    if (m->offset + size > m->capacity) {
+        while (size > m->capacity) m->capacity *= 2;
+        glBufferData(GL_ARRAY_BUFFER, m->capacity, 0, GL_STREAM_DRAW);
+        m->offset = 0;
+    }
+
+    ff_glyph_t *result = glMapBufferRange(
+        GL_ARRAY_BUFFER, m->offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+    assert(result);
+    *first = m->offset / sizeof(ff_glyph_t);
+    m->offset += size;
+    return result;
+}
+
+static void glyph_stream_unmap(ff_glyph_stream_t *m) {
+    glBindBuffer(GL_ARRAY_BUFFER, m->buffer);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 ff_font_config_t ff_default_font_config(void) {
     return (ff_font_config_t){
         .scale = 2.0f,
@@ -464,6 +582,7 @@ ff_font_id_t ff_new_load_font_from_memory(const unsigned char *bytes,
     glGenBuffers(1, &fpack->font.point_input_buffer);
     glGenTextures(1, &fpack->font.meta_input_texture);
     glGenTextures(1, &fpack->font.point_input_texture);
+    glyph_stream_create(&fpack->stream);
 
     gen_extended_ascii(handle);
     g_max_handle += 1;
@@ -502,6 +621,7 @@ ff_font_id_t ff_load_font(const char *path, ff_font_config_t cfg) {
     glGenBuffers(1, &fpack->font.point_input_buffer);
     glGenTextures(1, &fpack->font.meta_input_texture);
     glGenTextures(1, &fpack->font.point_input_texture);
+    glyph_stream_create(&fpack->stream);
 
     gen_extended_ascii(handle);
     g_max_handle += 1;
@@ -520,6 +640,7 @@ void ff_unload_font(const ff_font_id_t font) {
     glDeleteTextures(1, &fpack->atlas.index_texture);
     glDeleteTextures(1, &fpack->atlas.atlas_texture);
     glDeleteFramebuffers(1, &fpack->atlas.atlas_framebuffer);
+    glyph_stream_destroy(&fpack->stream);
     ff_map_destroy(&fpack->font.character_index);
 }
 
@@ -857,80 +978,154 @@ int ff_gen_glyphs(const ff_font_id_t font, const c32_t *codepoints,
     return retval;
 }
 
-void ff_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
-             ulong glyphs_len, const float *projection) {
-    ff_font_texture_pack_t *fpack = ht_fpack_map_get(&g_fonts, font);
-
-    GLuint glyph_buffer;
-    GLuint vao;
-    glGenBuffers(1, &glyph_buffer);
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, glyph_buffer);
-    glBufferData(GL_ARRAY_BUFFER, glyphs_len * sizeof(ff_glyph_t),
-                 &glyphs[0], GL_DYNAMIC_DRAW);
+void ff_batch_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
+                   ulong glyphs_len, const float *projection,
+                   const float *clip) {
+    if (!glyphs_len) return;
+
+    size_t required_capacity =
+        (g_batch.glyphs_length + glyphs_len) * sizeof(ff_glyph_t);
+    while (required_capacity > g_batch.glyphs_capacity) {
+        g_batch.glyphs_capacity *= 2;
+        g_batch.glyphs =
+            realloc(g_batch.glyphs, g_batch.glyphs_capacity);
+        assert(g_batch.glyphs);
+    }
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glEnableVertexAttribArray(5);
-    glEnableVertexAttribArray(6);
+    ff_batch_run_t run = {.font = font,
+                          .first = g_batch.glyphs_length,
+                          .length = glyphs_len};
+    memcpy(run.projection, projection, sizeof(run.projection));
+    if (clip) {
+        memcpy(run.clip, clip, sizeof(run.clip));
+    } else {
+        GLfloat everywhere[] = {-FLT_MAX / 4, -FLT_MAX / 4,
+                                FLT_MAX / 2, FLT_MAX / 2};
+        memcpy(run.clip, everywhere, sizeof(everywhere));
+    }
+    memcpy(&g_batch.glyphs[g_batch.glyphs_length], glyphs,
+           glyphs_len * sizeof(ff_glyph_t));
+    g_batch.glyphs_length += glyphs_len;
+
+    /* Runs drawn alike right after one another make a single run. */
+    ff_batch_run_t *last =
+        g_batch.runs_length ? &g_batch.runs[g_batch.runs_length - 1]
+                            : NULL;
+    if (last && last->font == font &&
+        !memcmp(last->projection, run.projection,
+                sizeof(run.projection)) &&
+        !memcmp(last->clip, run.clip, sizeof(run.clip))) {
+        last->length += glyphs_len;
+        return;
+    }
 
-    void *position_offset = (void *)offsetof(ff_glyph_t, position.x);
-    void *color_offset = (void *)offsetof(ff_glyph_t, color);
-    void *codepoint_offset = (void *)offsetof(ff_glyph_t, codepoint);
-    void *size_offset = (void *)offsetof(ff_glyph_t, size);
-    void *offset_offset = (void *)offsetof(ff_glyph_t, attrs.offset);
-    void *skew_offset = (void *)offsetof(ff_glyph_t, attrs.skew);
-    void *strength_offset =
-        (void *)offsetof(ff_glyph_t, attrs.strength);
+    required_capacity =
+        (g_batch.runs_length + 1) * sizeof(ff_batch_run_t);
+    while (required_capacity > g_batch.runs_capacity) {
+        g_batch.runs_capacity *= 2;
+        g_batch.runs = realloc(g_batch.runs, g_batch.runs_capacity);
+        assert(g_batch.runs);
+    }
+    g_batch.runs[g_batch.runs_length++] = run;
+}
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(ff_glyph_t), position_offset);
-    glVertexAttribIPointer(1, 4, GL_UNSIGNED_BYTE, sizeof(ff_glyph_t),
-                           color_offset);
-    glVertexAttribIPointer(2, 1, GL_INT, sizeof(ff_glyph_t),
-                           codepoint_offset);
-    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE,
-                          sizeof(ff_glyph_t), size_offset);
-    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE,
-                          sizeof(ff_glyph_t), offset_offset);
-    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE,
-                          sizeof(ff_glyph_t), skew_offset);
-    glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE,
-                          sizeof(ff_glyph_t), strength_offset);
+static void batch_draw_runs(GLint first, GLint *runs_end,
+                            GLfloat (*projections)[16],
+                            GLfloat (*clips)[4], int runs_length) {
+    glUniformMatrix4fv(g_uniforms.projections, runs_length, GL_FALSE,
+                       &projections[0][0]);
+    glUniform4fv(g_uniforms.clips, runs_length, &clips[0][0]);
+    glUniform1iv(g_uniforms.runs_end, runs_length, runs_end);
+    glUniform1i(g_uniforms.runs_length, runs_length);
+    glDrawArrays(GL_POINTS, first, runs_end[runs_length - 1] - first);
+}
 
-    /* Enable gamma correction if user didn't enabled it */
-    bool is_srgb_enabled = glIsEnabled(GL_FRAMEBUFFER_SRGB);
-    bool srgb_enabled_by_fn = !is_srgb_enabled;
-    if (!is_srgb_enabled) glEnable(GL_FRAMEBUFFER_SRGB);
+/* Draws the runs from `first_run` up to `end_run`, all of one font,
+ * up to FF_BATCH_RUNS of them at a time. */
+static void batch_draw_font(size_t first_run, size_t end_run) {
+    ff_batch_run_t *runs = g_batch.runs;
+    ff_font_texture_pack_t *fpack =
+        ht_fpack_map_get(&g_fonts, runs[first_run].font);
+
+    /* Runs queued one after another have their glyphs in a row. */
+    size_t glyphs_first = runs[first_run].first;
+    size_t glyphs_len = runs[end_run - 1].first +
+                        runs[end_run - 1].length - glyphs_first;
+    GLint first;
+    ff_glyph_t *dest =
+        glyph_stream_map(&fpack->stream, glyphs_len, &first);
+    memcpy(dest, &g_batch.glyphs[glyphs_first],
+           glyphs_len * sizeof(ff_glyph_t));
+    glyph_stream_unmap(&fpack->stream);
+    glBindVertexArray(fpack->stream.vao);
 
-    glUseProgram(g_render_shader);
     /* Bind atlas texture and index buffer. */
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, fpack->atlas.atlas_texture);
-    glUniform1i(g_uniforms.atlas, 0);
-
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_BUFFER, fpack->atlas.index_texture);
-    glUniform1i(g_uniforms.index, 1);
 
     glUniformMatrix4fv(g_uniforms.font_atlas_projection, 1, GL_FALSE,
                        (GLfloat *)fpack->atlas.projection);
-
-    glUniformMatrix4fv(g_uniforms.window_projection, 1, GL_FALSE,
-                       projection);
     glUniform1f(
         g_uniforms.padding,
         (GLfloat)(fpack->font.range / 2.0 * g_serializer_scale));
     glUniform1f(g_uniforms.units_per_em,
                 (GLfloat)fpack->font.face->units_per_EM);
+
+    GLint runs_end[FF_BATCH_RUNS];
+    GLfloat projections[FF_BATCH_RUNS][16];
+    GLfloat clips[FF_BATCH_RUNS][4];
+    int runs_length = 0;
+    GLint start = first;
+    GLint end = first;
+    for (size_t i = first_run; i < end_run; ++i) {
+        ff_batch_run_t *run = &runs[i];
+        end += run->length;
+        runs_end[runs_length] = end;
+        memcpy(projections[runs_length], run->projection,
+               sizeof(run->projection));
+        memcpy(clips[runs_length], run->clip, sizeof(run->clip));
+        runs_length += 1;
+
+        if (runs_length == FF_BATCH_RUNS) {
+            batch_draw_runs(start, runs_end, projections, clips,
+                            runs_length);
+            start = end;
+            runs_length = 0;
+        }
+    }
+    if (runs_length)
+        batch_draw_runs(start, runs_end, projections, clips,
+                        runs_length);
+}
+
+static void batch_flush(bool keeps_scissor) {
+    if (!g_batch.runs_length) return;
+
+    /* Enable gamma correction if user didn't enabled it */
+    bool is_srgb_enabled = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+    if (!is_srgb_enabled) glEnable(GL_FRAMEBUFFER_SRGB);
+    /* The shaders clip each run to the rectangle it was given */
+    bool is_scissor_enabled =
+        !keeps_scissor && glIsEnabled(GL_SCISSOR_TEST);
+    if (is_scissor_enabled) glDisable(GL_SCISSOR_TEST);
+
+    glUseProgram(g_render_shader);
+    glUniform1i(g_uniforms.atlas, 0);
+    glUniform1i(g_uniforms.index, 1);
     glUniform2fv(g_uniforms.dpi, 1, g_dpi);
 
-    /* Render the glyphs. */
-    glDrawArrays(GL_POINTS, 0, glyphs_len);
+    /* Runs are drawn in the order they were queued, with a draw for
+     * each stretch of them in the same font. */
+    for (size_t i = 0; i < g_batch.runs_length;) {
+        size_t end = i + 1;
+        while (end < g_batch.runs_length &&
+               g_batch.runs[end].font == g_batch.runs[i].font)
+            ++end;
+        batch_draw_font(i, end);
+        i = end;
+    }
 
     /* Clean up. */
     glActiveTexture(GL_TEXTURE1);
@@ -939,56 +1134,28 @@ void ff_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
     glUseProgram(0);
+    glBindVertexArray(0);
 
+    if (is_scissor_enabled) glEnable(GL_SCISSOR_TEST);
     /* if the user didn't enabled it, disable it */
-    if (srgb_enabled_by_fn) glDisable(GL_FRAMEBUFFER_SRGB);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
-    glDisableVertexAttribArray(3);
-    glDisableVertexAttribArray(4);
-    glDisableVertexAttribArray(5);
-    glDisableVertexAttribArray(6);
+    if (!is_srgb_enabled) glDisable(GL_FRAMEBUFFER_SRGB);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glDeleteBuffers(1, &glyph_buffer);
-    glDeleteVertexArrays(1, &vao);
+    g_batch.glyphs_length = 0;
+    g_batch.runs_length = 0;
 }
 
-ff_attrs_t ff_get_default_attributes() {
-    return (ff_attrs_t){.offset = 0.f, .skew = 0.f, .strength = .5f};
-}
+void ff_batch_flush(void) { batch_flush(false); }
 
-size_t ff_utf8_to_utf32(c32_t *dest, const char *src,
-                        const ulong src_len) {
-    // return size_t-1 if it fails, otherwise return the destination
-    // length
-    char *in = (char *)src;
-    size_t in_left = src_len;
-    char *out = (char *)dest;
-    size_t out_left = src_len * 4;
-    size_t res =
-        iconv(g_utf8_to_utf32, &in, &in_left, &out, &out_left);
-
-    if (res == (size_t)-1) return res;
-    return ((src_len) * 4 - out_left) / 4;
+void ff_draw(ff_font_id_t font, const ff_glyph_t *glyphs,
+             ulong glyphs_len, const float *projection) {
+    /* Clipped by whatever scissor is set, like any other draw. */
+    ff_batch_flush();
+    ff_batch_draw(font, glyphs, glyphs_len, projection, NULL);
+    batch_flush(true);
 }
 
-size_t ff_utf32_to_utf8(char *dest, const c32_t *src,
-                        const ulong src_len) {
-    // return size_t-1 if it fails, otherwise return the destination
-    // length
-    char *in = (char *)src;
-    size_t in_left = src_len * 4;
-    char *out = dest;
-    size_t out_left = src_len;
-    size_t res =
-        iconv(g_utf32_to_utf8, &in, &in_left, &out, &out_left);
-
-    if (res == (size_t)-1) return res;
-    return ((src_len) * 4 - out_left) / 4;
+ff_attrs_t ff_get_default_attributes() {
+    return (ff_attrs_t){.offset = 0.f, .skew = 0.f, .strength = .5f};
 }
 
 ff_dimensions_t ff_print_utf8(ff_glyph_t *glyphs, size_t *out_len,
@@ -997,9 +1164,10 @@ ff_dimensions_t ff_print_utf8(ff_glyph_t *glyphs, size_t *out_len,
                               ff_print_flag_e flags,
                               ff_attrs_t *optional_attrs) {
     c32_t str32[str_len];
-    ff_utf8_to_utf32(str32, str, str_len);
-    return ff_print_utf32(glyphs, out_len, str32, str_len, typo, x, y,
-                          flags, optional_attrs);
+    size_t str32_len = ff_utf8_to_utf32(str32, str, str_len);
+    if (str32_len == (size_t)-1) str32_len = 0;
+    return ff_print_utf32(glyphs, out_len, str32, str32_len, typo, x,
+                          y, flags, optional_attrs);
 }
 
 ff_dimensions_t ff_print_utf32(ff_glyph_t *glyphs, size_t *out_len,
@@ -1155,9 +1323,10 @@ ff_dimensions_t ff_measure_utf8(const char *str, size_t str_len,
                                 ff_font_id_t font, float size,
                                 bool with_kerning) {
     c32_t str32[str_len];
-    ff_utf8_to_utf32(str32, str, str_len);
+    size_t str32_len = ff_utf8_to_utf32(str32, str, str_len);
+    if (str32_len == (size_t)-1) str32_len = 0;
 
-    return ff_measure(font, str32, str_len, size, with_kerning);
+    return ff_measure(font, str32, str32_len, size, with_kerning);
 }
 
 ff_dimensions_t ff_measure_glyphs(const ff_glyph_t *glyphs,
@@ -1243,9 +1412,9 @@ void ff_set_glyphs_pos(ff_glyph_t *glyphs, size_t glyphs_len, float x,
 void ff_terminate() {
     for (ulong i = 0; i < g_max_handle; i += 1) ff_unload_font(i);
     ht_fpack_map_free(&g_fonts);
+    free(g_batch.glyphs);
+    free(g_batch.runs);
     FT_Done_FreeType(g_ft_library);
-    iconv_close(g_utf32_to_utf8);
-    iconv_close(g_utf8_to_utf32);
 }
 
 void ff_glyphs_vec_prealloc(ff_glyph_vec_t *v, size_t n_elements) {
@@ -0,0 +1,365 @@
+#include <fieldfusion.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FF_TRANSCODE_X86
+#endif
+
+// every converter validates its whole input and returns (size_t)-1
+// on the first invalid sequence or codepoint. the vector paths
+// convert the ASCII prefix of every block at once and hand the
+// sequence that ends it to the scalar code
+
+static size_t utf8_lead_len(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    return lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : 2;
+}
+
+// decodes the sequence at `src` into `out`, returns its length or 0
+// if it is malformed or cut short
+static size_t utf8_decode_one(const unsigned char *src, size_t len,
+                              c32_t *out) {
+    unsigned char lead = src[0];
+    if (lead < 0x80) {
+        *out = lead;
+        return 1;
+    }
+
+    size_t seq_len = utf8_lead_len(lead);
+    if (lead < 0xc2 || lead > 0xf4 || seq_len > len) return 0;
+
+    unsigned chr = lead & (0x7f >> seq_len);
+    for (size_t i = 1; i < seq_len; i += 1) {
+        if ((src[i] & 0xc0) != 0x80) return 0;
+        chr = chr << 6 | (src[i] & 0x3f);
+    }
+
+    // overlong, surrogate and out of range encodings
+    if (lead == 0xe0 && src[1] < 0xa0) return 0;
+    if (lead == 0xed && src[1] > 0x9f) return 0;
+    if (lead == 0xf0 && src[1] < 0x90) return 0;
+    if (lead == 0xf4 && src[1] > 0x8f) return 0;
+
+    *out = chr;
+    return seq_len;
+}
+
+// encodes `chr` into `out`, returns the length or 0 if it isn't a
+// scalar value
+static size_t utf32_encode_one(c32_t chr, char *out) {
+    unsigned c = chr;
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xc0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3f);
+        return 2;
+    }
+    if (c >= 0xd800 && c < 0xe000) return 0;
+    if (c < 0x10000) {
+        out[0] = 0xe0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3f);
+        out[2] = 0x80 | (c & 0x3f);
+        return 3;
+    }
+    if (c > 0x10ffff) return 0;
+    out[0] = 0xf0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3f);
+    out[2] = 0x80 | ((c >> 6) & 0x3f);
+    out[3] = 0x80 | (c & 0x3f);
+    return 4;
+}
+
+// decodes from `*i` until at least `until`, returns false on invalid
+// input
+static bool utf8_decode_until(c32_t *dest, size_t *out,
+                              const unsigned char *src, size_t len,
+                              size_t *i, size_t until) {
+    while (*i < until) {
+        size_t seq_len =
+            utf8_decode_one(&src[*i], len - *i, &dest[*out]);
+        if (!seq_len) return false;
+        *i += seq_len;
+        *out += 1;
+    }
+    return true;
+}
+
+static bool utf32_encode_until(char *dest, size_t dest_len,
+                               size_t *out, const c32_t *src,
+                               size_t *i, size_t until) {
+    char seq[4];
+    while (*i < until) {
+        // encodes in place while there is room for any sequence
+        bool has_room = dest_len - *out >= 4;
+        char *to = has_room ? &dest[*out] : seq;
+        size_t seq_len = utf32_encode_one(src[*i], to);
+        if (!seq_len || seq_len > dest_len - *out) return false;
+        if (!has_room) memcpy(&dest[*out], seq, seq_len);
+        *out += seq_len;
+        *i += 1;
+    }
+    return true;
+}
+
+static size_t utf8_to_utf32_scalar(c32_t *dest,
+                                   const unsigned char *src,
+                                   size_t len) {
+    size_t i = 0;
+    size_t out = 0;
+    if (!utf8_decode_until(dest, &out, src, len, &i, len))
+        return (size_t)-1;
+    return out;
+}
+
+static size_t utf32_to_utf8_scalar(char *dest, size_t dest_len,
+                                   const c32_t *src, size_t len) {
+    size_t i = 0;
+    size_t out = 0;
+    if (!utf32_encode_until(dest, dest_len, &out, src, &i, len))
+        return (size_t)-1;
+    return out;
+}
+
+#ifdef FF_TRANSCODE_X86
+__attribute__((target("sse2"))) static size_t utf8_to_utf32_sse2(
+    c32_t *dest, const unsigned char *src, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t out = 0;
+
+    // codepoints never outnumber bytes, so `dest` has room for a
+    // whole block even when only its prefix is kept
+    while (len - i >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)&src[i]);
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        __m128i *to = (__m128i *)&dest[out];
+        _mm_storeu_si128(&to[0], _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(&to[1], _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(&to[2], _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(&to[3], _mm_unpackhi_epi16(hi, zero));
+
+        unsigned non_ascii = _mm_movemask_epi8(bytes);
+        size_t ascii_len = non_ascii ? __builtin_ctz(non_ascii) : 16;
+        i += ascii_len;
+        out += ascii_len;
+        if (ascii_len == 16) continue;
+
+        if (!utf8_decode_until(dest, &out, src, len, &i, i + 1))
+            return (size_t)-1;
+    }
+
+    if (!utf8_decode_until(dest, &out, src, len, &i, len))
+        return (size_t)-1;
+    return out;
+}
+
+__attribute__((target("avx2"))) static size_t utf8_to_utf32_avx2(
+    c32_t *dest, const unsigned char *src, size_t len) {
+    size_t i = 0;
+    size_t out = 0;
+
+    while (len - i >= 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i *to = (__m256i *)&dest[out];
+        for (size_t ii = 0; ii < 4; ii += 1) {
+            __m128i eight =
+                _mm_loadl_epi64((const __m128i *)&src[i + ii * 8]);
+            _mm256_storeu_si256(&to[ii], _mm256_cvtepu8_epi32(eight));
+        }
+
+        unsigned non_ascii = _mm256_movemask_epi8(bytes);
+        size_t ascii_len = non_ascii ? __builtin_ctz(non_ascii) : 32;
+        i += ascii_len;
+        out += ascii_len;
+        if (ascii_len == 32) continue;
+
+        // the scalar code isn't compiled for avx, leaving the upper
+        // halves dirty makes every switch to it stall
+        _mm256_zeroupper();
+        if (!utf8_decode_until(dest, &out, src, len, &i, i + 1))
+            return (size_t)-1;
+    }
+
+    if (!utf8_decode_until(dest, &out, src, len, &i, len))
+        return (size_t)-1;
+    return out;
+}
+
+__attribute__((target("sse2"))) static size_t utf32_to_utf8_sse2(
+    char *dest, size_t dest_len, const c32_t *src, size_t len) {
+    const __m128i non_ascii = _mm_set1_epi32(~0x7f);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    size_t out = 0;
+
+    while (len - i >= 16 && dest_len - out >= 16) {
+        const __m128i *from = (const __m128i *)&src[i];
+        __m128i v[4];
+        unsigned ascii = 0;
+        for (size_t ii = 0; ii < 4; ii += 1) {
+            v[ii] = _mm_loadu_si128(&from[ii]);
+            __m128i high = _mm_and_si128(v[ii], non_ascii);
+            __m128i is_ascii = _mm_cmpeq_epi32(high, zero);
+            ascii |= _mm_movemask_ps(_mm_castsi128_ps(is_ascii))
+                     << (ii * 4);
+        }
+
+        // codepoints outside ASCII saturate, they are past the prefix
+        // that is kept
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+                                         _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128((__m128i *)&dest[out], bytes);
+
+        size_t ascii_len = __builtin_ctz(~ascii);
+        i += ascii_len;
+        out += ascii_len;
+        if (ascii_len == 16) continue;
+
+        if (!utf32_encode_until(dest, dest_len, &out, src, &i, i + 1))
+            return (size_t)-1;
+    }
+
+    if (!utf32_encode_until(dest, dest_len, &out, src, &i, len))
+        return (size_t)-1;
+    return out;
+}
+
+__attribute__((target("avx2"))) static size_t utf32_to_utf8_avx2(
+    char *dest, size_t dest_len, const c32_t *src, size_t len) {
+    const __m256i non_ascii = _mm256_set1_epi32(~0x7f);
+    const __m256i zero = _mm256_setzero_si256();
+    // packing works within 128 bit lanes, this puts the groups of
+    // four codepoints back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    size_t out = 0;
+
+    while (len - i >= 32 && dest_len - out >= 32) {
+        const __m256i *from = (const __m256i *)&src[i];
+        __m256i v[4];
+        unsigned ascii = 0;
+        for (size_t ii = 0; ii < 4; ii += 1) {
+            v[ii] = _mm256_loadu_si256(&from[ii]);
+            __m256i high = _mm256_and_si256(v[ii], non_ascii);
+            __m256 is_ascii =
+                _mm256_castsi256_ps(_mm256_cmpeq_epi32(high, zero));
+            ascii |= (unsigned)_mm256_movemask_ps(is_ascii)
+                     << (ii * 8);
+        }
+
+        __m256i bytes =
+            _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]),
+                                _mm256_packs_epi32(v[2], v[3]));
+        bytes = _mm256_permutevar8x32_epi32(bytes, order);
+        _mm256_storeu_si256((__m256i *)&dest[out], bytes);
+
+        size_t ascii_len = ~ascii ? __builtin_ctz(~ascii) : 32;
+        i += ascii_len;
+        out += ascii_len;
+        if (ascii_len == 32) continue;
+
+        _mm256_zeroupper();
+        if (!utf32_encode_until(dest, dest_len, &out, src, &i, i + 1))
+            return (size_t)-1;
+    }
+
+    if (!utf32_encode_until(dest, dest_len, &out, src, &i, len))
+        return (size_t)-1;
+    return out;
+}
+#endif
+
+static size_t (*g_utf8_to_utf32)(c32_t *, const unsigned char *,
+                                  size_t) = utf8_to_utf32_scalar;
+static size_t (*g_utf32_to_utf8)(char *, size_t, const c32_t *,
+                                 size_t) = utf32_to_utf8_scalar;
+
+// picks the widest implementation the cpu supports before main runs,
+// so the converters need no synchronization
+__attribute__((constructor)) static void transcode_select(void) {
+#ifdef FF_TRANSCODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_utf8_to_utf32 = utf8_to_utf32_avx2;
+        g_utf32_to_utf8 = utf32_to_utf8_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_utf8_to_utf32 = utf8_to_utf32_sse2;
+        g_utf32_to_utf8 = utf32_to_utf8_sse2;
+    }
+#endif
+}
+
+size_t ff_utf8_to_utf32(c32_t *dest, const char *src,
+                        const ulong src_len) {
+    // return size_t-1 if it fails, otherwise return the destination
+    // length
+    return g_utf8_to_utf32(dest, (const unsigned char *)src, src_len);
+}
+
+size_t ff_utf32_to_utf8(char *dest, const c32_t *src,
+                        const ulong src_len) {
+    // return size_t-1 if it fails, otherwise return the destination
+    // length. `dest` holds `src_len` bytes
+    return g_utf32_to_utf8(dest, src_len, src, src_len);
+}
+
+size_t ff_utf32_to_utf8_bounded(char *dest, ulong dest_len,
+                                const c32_t *src, ulong src_len) {
+    return g_utf32_to_utf8(dest, dest_len, src, src_len);
+}
+
+ff_utf8_stream_t ff_utf8_stream_create(void) {
+    return (ff_utf8_stream_t){.pending_len = 0};
+}
+
+size_t ff_utf8_stream_decode(ff_utf8_stream_t *m, c32_t *dest,
+                             const char *src, ulong src_len) {
+    const unsigned char *bytes = (const unsigned char *)src;
+    size_t out = 0;
+    size_t i = 0;
+
+    // completes the sequence the previous chunk ended in
+    if (m->pending_len) {
+        size_t seq_len = utf8_lead_len(m->pending[0]);
+        while (m->pending_len < seq_len && i < src_len)
+            m->pending[m->pending_len++] = bytes[i++];
+        if (m->pending_len < seq_len) return 0;
+
+        if (!utf8_decode_one(m->pending, seq_len, &dest[out]))
+            return (size_t)-1;
+        m->pending_len = 0;
+        out += 1;
+    }
+
+    // holds back a sequence cut by the end of this chunk
+    size_t end = src_len;
+    for (size_t back = 1; back <= 3 && back <= src_len - i;
+         back += 1) {
+        unsigned char lead = bytes[src_len - back];
+        if ((lead & 0xc0) == 0x80) continue;
+        if (lead >= 0xc2 && lead <= 0xf4 &&
+            utf8_lead_len(lead) > back) {
+            end = src_len - back;
+            memcpy(m->pending, &bytes[end], back);
+            m->pending_len = back;
+        }
+        break;
+    }
+
+    size_t decoded = g_utf8_to_utf32(&dest[out], &bytes[i], end - i);
+    if (decoded == (size_t)-1) return decoded;
+    return out + decoded;
+}
+
+bool ff_utf8_stream_finish(ff_utf8_stream_t *m) {
+    bool result = !m->pending_len;
+    m->pending_len = 0;
+    return result;
+}
@@ -1,162 +1,476 @@
 #include "buffer.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 
+#include "../config.h"
 #include "../dyn_strings/utf32_string.h"
 #include "../highlighter/highlighter.h"
 #include "buffer_history.h"
 #include "buffer_lines.h"
+#include "buffer_load.h"
 #include "buffer_syntax.h"
+#include "piece_table.h"
 
-#define BUFFER_ON_MODIFIED(buf)                           \
-    do {                                                  \
-        buffer_lines_update(&buf->lines, buf->str.data,   \
-                            buf->str.length);             \
-        buffer_syntax_update(&buf->syntax, buf->str.data, \
-                             buf->str.length);            \
+// versions are never handed out twice, so a buffer made where another
+// one was freed doesn't pass for it
+static size_t g_buffer_version = 0;
+
+static size_t buffer_next_version(void) { return ++g_buffer_version; }
+
+#define BUFFER_ON_MODIFIED(buf)                             \
+    do {                                                    \
+        if (buf->load) buf->is_edited_while_loading = true; \
+        buf->edit_count += 1;                               \
+        buf->version = buffer_next_version();               \
+        buffer_syntax_update(&buf->syntax, &buf->text);     \
+    } while (0)
+
+// the whole text was swapped, so the line index and the syntax tree
+// are rebuilt instead of being patched with the edit
+#define BUFFER_ON_REPLACED(buf)                       \
+    do {                                              \
+        buffer_lines_update(&buf->lines, &buf->text); \
+        buffer_syntax_reset(&buf->syntax);            \
+        BUFFER_ON_MODIFIED(buf);                      \
     } while (0)
 
+// `pos` as a row and codepoint column, and as the byte offset and
+// byte column tree-sitter works with
+static void buffer_locate(buffer_t* m, size_t pos, text_pos_t* at,
+                          uint32_t* byte, TSPoint* point) {
+    size_t row = buffer_lines_get_line_num_from_idx(&m->lines, pos);
+    line_t line = buffer_lines_get(&m->lines, row);
+    *at = (text_pos_t){.row = row, .column = pos - line.start};
+    size_t column = buffer_lines_column_to_byte(&m->lines, &m->text,
+                                                row, at->column);
+    *byte = buffer_lines_get_byte_start(&m->lines, row) + column;
+    *point = (TSPoint){.row = row, .column = column};
+}
+
+// called before `count` characters at `pos` are replaced, records
+// where the edit starts and what it overwrites
+static hlr_edit_t buffer_edit_begin(buffer_t* m, size_t pos,
+                                    size_t count) {
+    hlr_edit_t result = {0};
+    // without a tree the next update parses the whole text anyway
+    if (!buffer_syntax_is_parsed(&m->syntax)) return result;
+    buffer_locate(m, pos, &result.start, &result.input.start_byte,
+                  &result.input.start_point);
+    buffer_locate(m, pos + count, &result.old_end,
+                  &result.input.old_end_byte,
+                  &result.input.old_end_point);
+    return result;
+}
+
+// called once `len` characters were written at `pos`
+static void buffer_edit_end(buffer_t* m, hlr_edit_t* edit, size_t pos,
+                            size_t len) {
+    if (!buffer_syntax_is_parsed(&m->syntax)) return;
+    buffer_locate(m, pos + len, &edit->new_end,
+                  &edit->input.new_end_byte,
+                  &edit->input.new_end_point);
+    buffer_syntax_edit(&m->syntax, edit);
+}
+
+// records the replacement of the whole text so it can be undone
+static void buffer_replace_text(buffer_t* m, utf32_str_t str) {
+    buffer_history_push_edit(&m->history, &m->text, 0,
+                             m->text.length, str.data, str.length);
+    piece_table_reset(&m->text, str);
+}
+
+static void buffer_set_text(buffer_t* m, c32_t* data, size_t len) {
+    utf32_str_t str = utf32_str_create();
+    utf32_str_copy(&str, data, len);
+    buffer_replace_text(m, str);
+}
+
+// replaces `count` characters at `pos` with `str` without recording
+// it, used to move through the history
+static void buffer_apply(buffer_t* m, size_t pos, size_t count,
+                         utf32_str_t* str) {
+    hlr_edit_t edit = buffer_edit_begin(m, pos, count);
+    buffer_lines_delete(&m->lines, &m->text, pos, count);
+    piece_table_delete(&m->text, pos, count);
+    piece_table_insert(&m->text, pos, str->data, str->length);
+    buffer_lines_insert(&m->lines, &m->text, pos, str->length);
+    buffer_edit_end(m, &edit, pos, str->length);
+}
+
 void buffer_create(buffer_t* m, utf32_str_t data) {
-    m->str = data;
-    m->undo_history = buffer_history_create();
-    m->redo_history = buffer_history_create();
+    m->text = piece_table_create(data);
+    m->history = buffer_history_create(g_cfg.undo_budget);
     m->lines = buffer_lines_create();
     m->syntax = buffer_syntax_create();
-    buffer_lines_update(&m->lines, m->str.data, m->str.length);
+    m->load = 0;
+    m->is_edited_while_loading = false;
+    m->buffer_name = 0;
+    m->is_from_file = false;
+    m->is_unloaded = false;
+    m->edit_count = 0;
+    m->saved_edit_count = 0;
+    m->version = buffer_next_version();
+    m->last_used = 0;
+    buffer_lines_update(&m->lines, &m->text);
 }
 
 void buffer_set_name(buffer_t* m, const char* name) {
-    size_t buffer_name_len = strlen(name);
-
-    if (buffer_name_len > BUFFER_NAME_CAP) {
-        memcpy(m->buffer_name,
-               &name[buffer_name_len - BUFFER_NAME_CAP],
-               BUFFER_NAME_CAP);
-        m->buffer_name[BUFFER_NAME_CAP - 1] = 0;
-        return;
-    }
-
-    memcpy(m->buffer_name, name, buffer_name_len);
-    m->buffer_name[buffer_name_len] = 0;
+    free(m->buffer_name);
+    m->buffer_name = strdup(name);
+    assert(m->buffer_name);
 }
 
 void buffer_save_undo(buffer_t* m, text_pos_t cursor) {
-    buffer_history_copy_and_push(&m->undo_history, &m->str, cursor);
-}
-
-static void buffer_save_redo(buffer_t* m, text_pos_t cursor) {
-    buffer_history_copy_and_push(&m->redo_history, &m->str, cursor);
+    buffer_history_push(&m->history, cursor);
 }
 
 text_pos_t buffer_undo(buffer_t* m, text_pos_t cursor) {
-    assert(m->undo_history.length >= 1 &&
-           "the original buffer must always be stored");
-
-    bool is_original_buffer = m->undo_history.length == 1;
-    buffer_history_item_t* undo_item =
-        buffer_history_top(&m->undo_history);
-
-    if (is_original_buffer) {
-        utf32_str_copy(&m->str, undo_item->str.data,
-                       undo_item->str.length);
-        BUFFER_ON_MODIFIED(m);
-        return undo_item->cursor;
+    // cursor position row is set to (size_t)-1 if there is nothing
+    // left to undo
+    text_pos_t result = {
+        .row = (size_t)-1,
     };
 
-    buffer_save_redo(m, cursor);
+    size_t node = buffer_history_undo(&m->history, cursor);
+    if (node == BUFFER_HISTORY_NONE) return result;
 
-    utf32_str_copy(&m->str, undo_item->str.data,
-                   undo_item->str.length);
-    buffer_history_pop(&m->undo_history);
+    buffer_history_t* history = &m->history;
+    size_t edits_begin = history->nodes[node].edits_begin;
+    size_t edits_end = buffer_history_edits_end(history, node);
+    for (size_t i = edits_end; i > edits_begin; i -= 1) {
+        buffer_history_edit_t* edit = &history->edits[i - 1];
+        buffer_apply(m, edit->pos, edit->inserted.length,
+                     &edit->removed);
+    }
 
     BUFFER_ON_MODIFIED(m);
-    return undo_item->cursor;
+    return history->nodes[node].cursor;
 }
 
 text_pos_t buffer_redo(buffer_t* m, text_pos_t cursor) {
+    (void)cursor;
     // cursor position row is set to (size_t)-1 if there is nothing
     // in the redo buffer history
     text_pos_t result = {
         .row = (size_t)-1,
     };
 
-    if (!m->redo_history.length) return result;
-
-    buffer_history_item_t* redo_item =
-        buffer_history_top(&m->redo_history);
-    buffer_save_undo(m, cursor);
-    result = redo_item->cursor;
+    size_t node = buffer_history_redo(&m->history);
+    if (node == BUFFER_HISTORY_NONE) return result;
 
-    utf32_str_copy(&m->str, redo_item->str.data,
-                   redo_item->str.length);
-    buffer_history_pop(&m->redo_history);
+    buffer_history_t* history = &m->history;
+    size_t edits_begin = history->nodes[node].edits_begin;
+    size_t edits_end = buffer_history_edits_end(history, node);
+    for (size_t i = edits_begin; i < edits_end; i += 1) {
+        buffer_history_edit_t* edit = &history->edits[i];
+        buffer_apply(m, edit->pos, edit->removed.length,
+                     &edit->inserted);
+    }
 
     BUFFER_ON_MODIFIED(m);
-    return result;
+    return history->nodes[node].redo_cursor;
+}
+
+bool buffer_next_undo_branch(buffer_t* m) {
+    return buffer_history_next_branch(&m->history);
 }
 
 void buffer_destroy(buffer_t* m) {
-    utf32_str_destroy(&m->str);
-    buffer_history_destroy(&m->undo_history);
-    buffer_history_destroy(&m->redo_history);
+    if (m->load) buffer_load_destroy(m->load);
+    free(m->buffer_name);
+    piece_table_destroy(&m->text);
+    buffer_history_destroy(&m->history);
     buffer_lines_destroy(&m->lines);
     buffer_syntax_destroy(&m->syntax);
 }
 
 void buffer_clear(buffer_t* m) {
-    m->str.length = 0;
-    BUFFER_ON_MODIFIED(m);
+    buffer_replace_text(m, utf32_str_create());
+    BUFFER_ON_REPLACED(m);
 }
 
 void buffer_insert_char(buffer_t* m, const size_t pos,
                         const c32_t chr) {
-    utf32_str_insert_char(&m->str, pos, chr);
+    buffer_history_push_edit(&m->history, &m->text, pos, 0, &chr, 1);
+    hlr_edit_t edit = buffer_edit_begin(m, pos, 0);
+    piece_table_insert(&m->text, pos, &chr, 1);
+    buffer_lines_insert(&m->lines, &m->text, pos, 1);
+    buffer_edit_end(m, &edit, pos, 1);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
 }
 
 void buffer_insert_utf8_buf(buffer_t* m, size_t pos, char* str,
                             size_t len) {
-    utf32_str_insert_utf8_buf(&m->str, pos, str, len);
+    utf32_str_t str32 = utf32_str_create();
+    utf32_str_copy_utf8(&str32, str, len);
+    buffer_history_push_edit(&m->history, &m->text, pos, 0,
+                             str32.data, str32.length);
+    hlr_edit_t edit = buffer_edit_begin(m, pos, 0);
+    piece_table_insert(&m->text, pos, str32.data, str32.length);
+    buffer_lines_insert(&m->lines, &m->text, pos, str32.length);
+    buffer_edit_end(m, &edit, pos, str32.length);
+    utf32_str_destroy(&str32);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
 }
 
 void buffer_insert_buf(buffer_t* m, size_t pos, c32_t* str,
                        size_t len) {
-    utf32_str_insert_buf(&m->str, pos, str, len);
+    buffer_history_push_edit(&m->history, &m->text, pos, 0, str, len);
+    hlr_edit_t edit = buffer_edit_begin(m, pos, 0);
+    piece_table_insert(&m->text, pos, str, len);
+    buffer_lines_insert(&m->lines, &m->text, pos, len);
+    buffer_edit_end(m, &edit, pos, len);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
 }
 
 void buffer_delete(buffer_t* m, size_t pos, size_t count) {
-    utf32_str_delete(&m->str, pos, count);
+    buffer_history_push_edit(&m->history, &m->text, pos, count, 0, 0);
+    hlr_edit_t edit = buffer_edit_begin(m, pos, count);
+    buffer_lines_delete(&m->lines, &m->text, pos, count);
+    piece_table_delete(&m->text, pos, count);
+    buffer_edit_end(m, &edit, pos, 0);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
 }
 
 void buffer_copy(buffer_t* m, c32_t* buffer, size_t len) {
-    utf32_str_copy(&m->str, buffer, len);
-    BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
+    buffer_set_text(m, buffer, len);
+    BUFFER_ON_REPLACED(m);
+}
+
+// drops a load still running along with what it hasn't handed over
+static void buffer_stop_load(buffer_t* m) {
+    if (!m->load) return;
+    buffer_load_destroy(m->load);
+    m->load = 0;
+}
+
+// the history refers to the text that is about to be dropped
+static void buffer_reset_history(buffer_t* m) {
+    buffer_history_destroy(&m->history);
+    m->history = buffer_history_create(g_cfg.undo_budget);
 }
 
 void buffer_read_file(buffer_t* m, const char* path) {
-    utf32_str_read_file(&m->str, path);
+    buffer_stop_load(m);
+    buffer_load_text(&m->text, path, 0);
+    buffer_reset_history(m);
+    BUFFER_ON_REPLACED(m);
+    m->is_from_file = true;
+    m->is_unloaded = false;
+    m->saved_edit_count = m->edit_count;
+}
+
+void buffer_read_file_async(buffer_t* m, const char* path) {
+    buffer_stop_load(m);
+    m->load = buffer_load_start(path, m->syntax.highlighter.language);
+    if (!m->load) {
+        buffer_read_file(m, path);
+        return;
+    }
+
+    // nothing can be edited before the text is taken, so the history
+    // started here already belongs to it
+    m->is_edited_while_loading = false;
+    buffer_reset_history(m);
+    m->is_from_file = true;
+    m->is_unloaded = false;
+    m->saved_edit_count = m->edit_count;
+}
+
+// codepoints of the text compared with a file at a time
+#define BUFFER_PATCH_BLOCK_LEN 0x1000
+
+// how many of the first `max` codepoints, or with `is_backward` the
+// last, the text and `file` have in common. both are read a block at
+// a time instead of being copied whole
+static size_t buffer_patch_match(buffer_t* m, piece_table_t* file,
+                                 size_t max, bool is_backward) {
+    c32_t block[BUFFER_PATCH_BLOCK_LEN];
+    c32_t expected[BUFFER_PATCH_BLOCK_LEN];
+    size_t result = 0;
+    while (result < max) {
+        size_t len = max - result;
+        if (len > BUFFER_PATCH_BLOCK_LEN)
+            len = BUFFER_PATCH_BLOCK_LEN;
+
+        size_t pos = is_backward ? m->text.length - result - len
+                                 : result;
+        size_t file_pos =
+            is_backward ? file->length - result - len : result;
+        piece_table_read(&m->text, pos, len, block);
+        piece_table_read(file, file_pos, len, expected);
+
+        for (size_t i = 0; i < len; i += 1) {
+            size_t ii = is_backward ? len - i - 1 : i;
+            if (block[ii] != expected[ii]) return result + i;
+        }
+        result += len;
+    }
+    return result;
+}
+
+// replaces the range where the text stopped matching `file` as a
+// single undo point of its own, only that range is decoded whole
+static void buffer_patch(buffer_t* m, piece_table_t* file) {
+    size_t length = m->text.length;
+    size_t max_prefix =
+        length < file->length ? length : file->length;
+    size_t prefix = buffer_patch_match(m, file, max_prefix, false);
+    size_t suffix =
+        buffer_patch_match(m, file, max_prefix - prefix, true);
+
+    size_t count = length - prefix - suffix;
+    size_t inserted_length = file->length - prefix - suffix;
+    if (!count && !inserted_length) return;
+
+    utf32_str_t inserted = {
+        .data = malloc(inserted_length * sizeof(c32_t) + 1),
+        .length = inserted_length};
+    assert(inserted.data);
+    piece_table_read(file, prefix, inserted_length, inserted.data);
+
+    buffer_history_push(&m->history, m->history.cursor);
+    buffer_history_push_edit(&m->history, &m->text, prefix, count,
+                             inserted.data, inserted.length);
+    m->history.is_open = false;
+    buffer_apply(m, prefix, count, &inserted);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
+    free(inserted.data);
+}
+
+void buffer_reload_file(buffer_t* m, const char* path) {
+    // what is left of a mapped file changed in place can't be
+    // trusted, it is read again along with any edits made on top
+    if (piece_table_is_mapping_stale(&m->text)) {
+        buffer_read_file_async(m, path);
+        return;
+    }
+
+    // the edits would be lost, the text is kept until it is saved
+    if (buffer_is_modified(m)) return;
+    // the change is the one the last save made
+    if (buffer_save_stamp_matches(&m->saved_stamp, path)) return;
+    // a load still running has no history yet, it starts over
+    if (m->load) {
+        buffer_read_file_async(m, path);
+        return;
+    }
+
+    // the file is taken in like a load takes it, as UTF-8 decoded a
+    // page at a time and mapped if it is large, so only what changed
+    // is ever held as codepoints. a file that is no longer UTF-8
+    // text is left alone
+    piece_table_t file = piece_table_create(utf32_str_create());
+    if (buffer_load_text(&file, path, 0)) {
+        buffer_patch(m, &file);
+        m->saved_edit_count = m->edit_count;
+    }
+    piece_table_destroy(&file);
+}
+
+void buffer_update_load(buffer_t* m) {
+    buffer_load_t* load = m->load;
+    if (!load) return;
+
+    enum buffer_load_stage stage = buffer_load_get_stage(load);
+    if (load->taken < buffer_load_stage_text &&
+        stage >= buffer_load_stage_text) {
+        piece_table_destroy(&m->text);
+        m->text = load->text;
+        buffer_lines_destroy(&m->lines);
+        m->lines = load->head_lines;
+        m->version = buffer_next_version();
+        load->taken = buffer_load_stage_text;
+    }
+
+    if (load->taken < buffer_load_stage_lines &&
+        stage >= buffer_load_stage_lines) {
+        // the head lines may already hold the whole text
+        if (load->lines.length) {
+            buffer_lines_destroy(&m->lines);
+            m->lines = load->lines;
+            m->version = buffer_next_version();
+        } else {
+            buffer_lines_destroy(&load->lines);
+        }
+        load->taken = buffer_load_stage_lines;
+    }
+
+    if (stage < buffer_load_stage_syntax) return;
+
+    // edits made meanwhile were highlighted as they were made, which
+    // leaves the parse of the text as it was read stale
+    buffer_syntax_t* syntax = &m->syntax;
+    if (load->highlighter.tree && !m->is_edited_while_loading) {
+        buffer_syntax_reset(syntax);
+        hlr_tokens_destroy(&syntax->tokens);
+        syntax->highlighter = load->highlighter;
+        syntax->tokens = load->tokens;
+    } else {
+        hlr_highlighter_destroy(&load->highlighter);
+        hlr_tokens_destroy(&load->tokens);
+    }
+    load->taken = buffer_load_stage_syntax;
+    buffer_stop_load(m);
+}
+
+bool buffer_is_editable(buffer_t* m) {
+    return !m->load || m->load->taken >= buffer_load_stage_lines;
+}
+
+bool buffer_is_modified(buffer_t* m) {
+    return m->edit_count != m->saved_edit_count;
+}
+
+size_t buffer_get_size(buffer_t* m) {
+    return sizeof(buffer_t) + piece_table_get_size(&m->text) +
+           m->history.size + m->lines.capacity +
+           buffer_syntax_get_size(&m->syntax);
+}
+
+bool buffer_can_unload(buffer_t* m) {
+    return m->is_from_file && !m->is_unloaded && !m->load &&
+           !buffer_is_modified(m);
+}
+
+void buffer_unload(buffer_t* m) {
+    assert(buffer_can_unload(m));
+    piece_table_destroy(&m->text);
+    m->text = piece_table_create(utf32_str_create());
+    buffer_lines_destroy(&m->lines);
+    m->lines = buffer_lines_create();
+    buffer_lines_update(&m->lines, &m->text);
+
+    enum language language = m->syntax.highlighter.language;
+    buffer_syntax_destroy(&m->syntax);
+    m->syntax = buffer_syntax_create();
+    buffer_syntax_set_language(&m->syntax, language);
+
+    buffer_reset_history(m);
+    m->version = buffer_next_version();
+    m->is_unloaded = true;
 }
 
 void buffer_copy_utf8(buffer_t* m, const char* buffer, size_t len) {
-    utf32_str_copy_utf8(&m->str, buffer, len);
-    BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
+    utf32_str_t str = utf32_str_create();
+    utf32_str_copy_utf8(&str, buffer, len);
+    buffer_replace_text(m, str);
+    BUFFER_ON_REPLACED(m);
 }
 
 void buffer_append_utf8(buffer_t* m, const char* buffer, size_t len) {
-    utf32_str_append_utf8(&m->str, buffer, len);
+    utf32_str_t str = utf32_str_create();
+    utf32_str_copy_utf8(&str, buffer, len);
+    size_t pos = m->text.length;
+    buffer_history_push_edit(&m->history, &m->text, pos, 0, str.data,
+                             str.length);
+    hlr_edit_t edit = buffer_edit_begin(m, pos, 0);
+    piece_table_insert(&m->text, pos, str.data, str.length);
+    buffer_lines_insert(&m->lines, &m->text, pos, str.length);
+    buffer_edit_end(m, &edit, pos, str.length);
+    utf32_str_destroy(&str);
     BUFFER_ON_MODIFIED(m);
-    buffer_history_clear(&m->redo_history);
 }
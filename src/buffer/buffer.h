@@ -4,18 +4,37 @@
 #include "../highlighter/highlighter.h"
 #include "buffer_history.h"
 #include "buffer_lines.h"
+#include "buffer_load.h"
+#include "buffer_save.h"
 #include "buffer_syntax.h"
-
-#define BUFFER_NAME_CAP 0x100
+#include "piece_table.h"
 
 typedef struct {
-    char buffer_name[BUFFER_NAME_CAP];
-    utf32_str_t str;
-    buffer_history_t undo_history;
-    buffer_history_t redo_history;
+    char* buffer_name;
+    piece_table_t text;
+    buffer_history_t history;
     buffer_lines_t lines;
     buffer_syntax_t syntax;
     size_t str_last_checked_size;
+    // the file being read in the background, null once it is done
+    buffer_load_t* load;
+    // set when the text is edited while the load is still parsing
+    bool is_edited_while_loading;
+    // the text was read from the file named after the buffer
+    bool is_from_file;
+    // the text was dropped to save memory and is read again when the
+    // buffer is used
+    bool is_unloaded;
+    // edits made so far and when the text last matched the file
+    size_t edit_count;
+    size_t saved_edit_count;
+    // the file as the last save of the text left it
+    buffer_save_stamp_t saved_stamp;
+    // frame the buffer was last used in, kept by the buffer handler
+    size_t last_used;
+    // bumped whenever the text or its lines change, so views can keep
+    // what they laid out while it stays the same
+    size_t version;
 } buffer_t;
 
 void buffer_create(buffer_t* m, utf32_str_t data);
@@ -25,6 +44,7 @@ void buffer_set_name(buffer_t* m, const char* name);
 void buffer_save_undo(buffer_t* m, text_pos_t cursor);
 text_pos_t buffer_undo(buffer_t* m, text_pos_t cursor);
 text_pos_t buffer_redo(buffer_t* m, text_pos_t cursor);
+bool buffer_next_undo_branch(buffer_t* m);
 void buffer_insert_char(buffer_t* m, const size_t pos,
                         const c32_t chr);
 void buffer_insert_utf8_buf(buffer_t* m, size_t pos, char* str,
@@ -36,3 +56,23 @@ void buffer_copy(buffer_t* m, c32_t* buffer, size_t len);
 void buffer_copy_utf8(buffer_t* m, const char* buffer, size_t len);
 void buffer_append_utf8(buffer_t* m, const char* buffer, size_t len);
 void buffer_read_file(buffer_t* m, const char* path);
+// reads the file on a worker, the text, its lines and its syntax are
+// taken by buffer_update_load as they become ready
+void buffer_read_file_async(buffer_t* m, const char* path);
+void buffer_update_load(buffer_t* m);
+// brings the text in line with its file after it changed on disk by
+// replacing only what differs, which can be undone. a text edited
+// since it was read or saved is left as it is, and so is a file still
+// as the last save left it
+void buffer_reload_file(buffer_t* m, const char* path);
+// false while the text is still missing its lines
+bool buffer_is_editable(buffer_t* m);
+// whether the text was edited since it was read or last saved
+bool buffer_is_modified(buffer_t* m);
+// bytes of memory the buffer holds
+size_t buffer_get_size(buffer_t* m);
+// whether the text can be dropped and read again from its file
+bool buffer_can_unload(buffer_t* m);
+// drops the text, its lines, syntax and history, keeping the name
+// and language so the file can be read back
+void buffer_unload(buffer_t* m);
@@ -1,106 +1,166 @@
 #include "buffer_handler.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "../config.h"
 #include "../dyn_strings/utf32_string.h"
+#include "../file_watch.h"
 #include "../highlighter/highlighter.h"
 #include "buffer.h"
-#define BUFFER_MAP_SIZE 1024
 
-typedef struct buffer_map_entry {
-    buffer_t buffer;
-    struct buffer_map_entry* next;
-} buffer_map_entry_t;
+// the table grows once this many percent of its slots are taken
+#define BUFFER_MAP_MAX_LOAD 75
 
 typedef struct {
-    buffer_map_entry_t entries[BUFFER_MAP_SIZE];
+    size_t hash;
+    buffer_t* buffer;
+} buffer_map_slot_t;
+
+// open addressing table keyed by the hash of the whole name, probed
+// linearly. buffers are allocated on their own so they don't move
+// when the table grows, and are listed in `buffers` in the order
+// they were created. buffers are only ever added, so no slot is
+// emptied once taken
+typedef struct {
+    buffer_map_slot_t* slots;
+    size_t slots_length;
+    buffer_t** buffers;
     size_t length;
+    size_t capacity;
+    size_t frame;
 } buffer_map_t;
 
-static size_t cooked_hash(const char* str, size_t str_len) {
-    static const size_t max_len = 26;
-    size_t len = max_len < str_len ? max_len : str_len;
-    size_t hash = 0xcbf29ce484222325;
-    for (size_t i = 0; i < len; i += 1) {
+// FNV-1a
+static size_t buffer_map_hash(const char* str) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *str; str += 1) {
+        hash ^= (unsigned char)*str;
         hash *= 0x100000001b3;
-        hash ^= str[i];
     }
     return hash;
 }
 
-static void buffer_map_entry_destroy(buffer_map_entry_t* m) {
-    if (m->next) buffer_map_entry_destroy(m->next);
-    buffer_destroy(&m->buffer);
-    memset(&m->buffer, 0, sizeof(buffer_t));
-    if (m->next) {
-        free(m->next);
-        m->next = NULL;
+// the slot holding `name`, or the empty one it would go into
+static buffer_map_slot_t* buffer_map_find(buffer_map_t* m,
+                                          const char* name,
+                                          size_t hash) {
+    size_t mask = m->slots_length - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        buffer_map_slot_t* slot = &m->slots[i];
+        if (!slot->buffer) return slot;
+        if (slot->hash == hash &&
+            !strcmp(slot->buffer->buffer_name, name))
+            return slot;
     }
 }
 
+static void buffer_map_grow(buffer_map_t* m) {
+    buffer_map_slot_t* slots = m->slots;
+    size_t slots_length = m->slots_length;
+
+    m->slots_length *= 2;
+    m->slots = calloc(m->slots_length, sizeof(buffer_map_slot_t));
+    assert(m->slots);
+
+    size_t mask = m->slots_length - 1;
+    for (size_t i = 0; i < slots_length; i += 1) {
+        if (!slots[i].buffer) continue;
+        size_t ii = slots[i].hash & mask;
+        while (m->slots[ii].buffer) ii = (ii + 1) & mask;
+        m->slots[ii] = slots[i];
+    }
+    free(slots);
+}
+
+static buffer_map_t buffer_map_create(void) {
+    buffer_map_t result = {
+        .slots = calloc(16, sizeof(buffer_map_slot_t)),
+        .slots_length = 16,
+        .buffers = calloc(2, sizeof(buffer_t*)),
+        .length = 0,
+        .capacity = 2 * sizeof(buffer_t*),
+        .frame = 1};
+    assert(result.slots);
+    assert(result.buffers);
+    return result;
+}
+
 static void buffer_map_destroy(buffer_map_t* m) {
-    for (size_t i = 0; i < BUFFER_MAP_SIZE; i += 1) {
-        if (m->entries[i].buffer.buffer_name[0])
-            buffer_map_entry_destroy(&m->entries[i]);
+    for (size_t i = 0; i < m->length; i += 1) {
+        buffer_destroy(m->buffers[i]);
+        free(m->buffers[i]);
     }
+    free(m->slots);
+    free(m->buffers);
+    memset(m, 0, sizeof(buffer_map_t));
 }
 
 static buffer_t* buffer_map_get(buffer_map_t* m,
                                 const char* buffer_name) {
-    size_t slot = cooked_hash(buffer_name, strlen(buffer_name)) %
-                  BUFFER_MAP_SIZE;
-
-    buffer_map_entry_t* entry = &m->entries[slot];
-    while (entry) {
-        if (entry->buffer.buffer_name[0] &&
-            !strcmp(entry->buffer.buffer_name, buffer_name))
-            return &entry->buffer;
-        entry = entry->next;
-    }
-
-    return 0;
+    size_t hash = buffer_map_hash(buffer_name);
+    return buffer_map_find(m, buffer_name, hash)->buffer;
 }
 
 static void buffer_map_set(buffer_map_t* m, const char* buffer_name,
                            utf32_str_t string) {
-    size_t slot = cooked_hash(buffer_name, strlen(buffer_name)) %
-                  BUFFER_MAP_SIZE;
-
-    buffer_map_entry_t* entry = &m->entries[slot];
-
-    if (!entry->buffer.buffer_name[0]) {
-        buffer_create(&entry->buffer, string);
-        buffer_set_name(&entry->buffer, buffer_name);
-        m->length += 1;
-        return;
-    } else if (!strcmp(entry->buffer.buffer_name, buffer_name)) {
-        assert(0 &&
-               "trying to create buffer that is already present");
+    if ((m->length + 1) * 100 > m->slots_length * BUFFER_MAP_MAX_LOAD)
+        buffer_map_grow(m);
+
+    size_t hash = buffer_map_hash(buffer_name);
+    buffer_map_slot_t* slot = buffer_map_find(m, buffer_name, hash);
+    assert(!slot->buffer &&
+           "trying to create buffer that is already present");
+
+    size_t required_capacity = (m->length + 1) * sizeof(buffer_t*);
+    while (required_capacity > m->capacity) {
+        m->capacity *= 2;
+        m->buffers = realloc(m->buffers, m->capacity);
+        assert(m->buffers);
     }
 
-    while (entry->next) {
-        entry = entry->next;
+    buffer_t* buffer = malloc(sizeof(buffer_t));
+    assert(buffer);
+    buffer_create(buffer, string);
+    buffer_set_name(buffer, buffer_name);
+    buffer->last_used = m->frame;
 
-        if (entry &&
-            !strcmp(entry->buffer.buffer_name, buffer_name)) {
-            entry->buffer.str = string;
-            return;
-        }
-    }
+    *slot = (buffer_map_slot_t){.hash = hash, .buffer = buffer};
+    m->buffers[m->length++] = buffer;
+}
 
-    entry->next = calloc(sizeof(buffer_map_entry_t), 1);
-    assert(entry->next);
+// unloads the least recently used buffers until they all fit the
+// budget, buffers used this frame, modified or still loading are
+// left alone
+static void buffer_map_enforce_budget(buffer_map_t* m) {
+    size_t size = 0;
+    for (size_t i = 0; i < m->length; i += 1)
+        size += buffer_get_size(m->buffers[i]);
+
+    while (size > g_cfg.buffer_budget) {
+        buffer_t* oldest = 0;
+        for (size_t i = 0; i < m->length; i += 1) {
+            buffer_t* buffer = m->buffers[i];
+            if (buffer->last_used == m->frame ||
+                !buffer_can_unload(buffer))
+                continue;
+            if (!oldest || buffer->last_used < oldest->last_used)
+                oldest = buffer;
+        }
+        if (!oldest) return;
 
-    buffer_create(&entry->next->buffer, string);
-    buffer_set_name(&entry->next->buffer, buffer_name);
-    m->length += 1;
+        size -= buffer_get_size(oldest);
+        buffer_unload(oldest);
+        size += buffer_get_size(oldest);
+    }
 }
 
 static buffer_map_t g_buffer_map = {0};
 
 void buffer_handler_init(void) {
+    g_buffer_map = buffer_map_create();
     buffer_map_set(&g_buffer_map, "[scratch]", utf32_str_create());
     buffer_t* scratch_buffer =
         buffer_map_get(&g_buffer_map, "[scratch]");
@@ -110,7 +170,19 @@ void buffer_handler_init(void) {
 size_t buffer_count(void) { return g_buffer_map.length; }
 
 buffer_t* buffer_handler_get(const char* name) {
-    return buffer_map_get(&g_buffer_map, name);
+    buffer_t* result = buffer_map_get(&g_buffer_map, name);
+    if (!result) return 0;
+
+    if (result->is_unloaded) buffer_read_file_async(result, name);
+    buffer_handler_touch(result);
+    return result;
+}
+
+// an unloaded buffer reads the file anew once it is used
+static void buffer_handler_on_file_change(void* data) {
+    buffer_t* buffer = data;
+    if (!buffer->is_from_file || buffer->is_unloaded) return;
+    buffer_reload_file(buffer, buffer->buffer_name);
 }
 
 buffer_t* buffer_handler_create_buffer(const char* name) {
@@ -119,9 +191,19 @@ buffer_t* buffer_handler_create_buffer(const char* name) {
 
     buffer_t* result = buffer_handler_get(name);
     assert(result);
+    file_watch_add(name, buffer_handler_on_file_change, result);
     return result;
 }
 
+void buffer_handler_touch(buffer_t* buffer) {
+    buffer->last_used = g_buffer_map.frame;
+}
+
+void buffer_handler_end_frame(void) {
+    buffer_map_enforce_budget(&g_buffer_map);
+    g_buffer_map.frame += 1;
+}
+
 void buffer_handler_terminate(void) {
     buffer_map_destroy(&g_buffer_map);
 }
@@ -132,20 +214,9 @@ void buffer_handler_list_names(size_t count,
                                utf32_str_t names[count]) {
     assert(count <= g_buffer_map.length);
 
-    size_t name_idx = 0;
-    for (size_t i = 0; i < BUFFER_MAP_SIZE; i += 1) {
-        buffer_map_entry_t* entry = &g_buffer_map.entries[i];
-        if (!entry->buffer.buffer_name[0]) continue;
-
-        utf32_str_copy_utf8(&names[name_idx++],
-                            entry->buffer.buffer_name,
-                            strlen(entry->buffer.buffer_name));
-
-        while (entry->next) {
-            entry = entry->next;
-            utf32_str_copy_utf8(&names[name_idx++],
-                                entry->buffer.buffer_name,
-                                strlen(entry->buffer.buffer_name));
-        }
+    for (size_t i = 0; i < count; i += 1) {
+        buffer_t* buffer = g_buffer_map.buffers[i];
+        utf32_str_copy_utf8(&names[i], buffer->buffer_name,
+                            strlen(buffer->buffer_name));
     }
 }
@@ -8,6 +8,11 @@
 void buffer_handler_init(void);
 buffer_t* buffer_handler_get(const char* name);
 buffer_t* buffer_handler_create_buffer(const char* name);
+// marks the buffer as used this frame so it isn't unloaded
+void buffer_handler_touch(buffer_t* buffer);
+// unloads idle buffers once they go over the budget and starts the
+// next frame
+void buffer_handler_end_frame(void);
 void buffer_handler_terminate(void);
 size_t buffer_handler_count(void);
 void buffer_handler_list_names(size_t count,
@@ -2,50 +2,324 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../dyn_strings/utf32_string.h"
 #include "../highlighter/highlighter.h"
+#include "piece_table.h"
 
-buffer_history_t buffer_history_create() {
-    return (buffer_history_t){
-        .data = calloc(2, sizeof(buffer_history_item_t)),
-        .length = 0,
-        .capacity = 2 * sizeof(buffer_history_item_t)};
+static size_t edit_size(buffer_history_edit_t* edit) {
+    return sizeof(buffer_history_edit_t) + edit->removed.capacity +
+           edit->inserted.capacity;
+}
+
+static void edit_destroy(buffer_history_t* m,
+                         buffer_history_edit_t* edit) {
+    m->size -= edit_size(edit);
+    utf32_str_destroy(&edit->removed);
+    utf32_str_destroy(&edit->inserted);
+}
+
+// inserts `count` characters of `text` at `pos` into `str` at `at`
+static void str_insert_text(utf32_str_t* str, size_t at,
+                            piece_table_t* text, size_t pos,
+                            size_t count) {
+    size_t required_capacity = (str->length + count) * sizeof(c32_t);
+
+    while (required_capacity > str->capacity) {
+        str->capacity *= 2;
+        str->data = realloc(str->data, str->capacity);
+        assert(str->data);
+    }
+
+    memmove(&str->data[at + count], &str->data[at],
+            (str->length - at) * sizeof(c32_t));
+    piece_table_read(text, pos, count, &str->data[at]);
+    str->length += count;
+}
+
+buffer_history_t buffer_history_create(size_t budget) {
+    buffer_history_t result = {
+        .nodes = calloc(2, sizeof(buffer_history_node_t)),
+        .length = 1,
+        .capacity = 2 * sizeof(buffer_history_node_t),
+        .edits = calloc(2, sizeof(buffer_history_edit_t)),
+        .edits_length = 0,
+        .edits_capacity = 2 * sizeof(buffer_history_edit_t),
+        .current = 0,
+        .is_open = false,
+        .cursor = {0},
+        .size = sizeof(buffer_history_node_t),
+        .budget = budget};
+    assert(result.nodes);
+    assert(result.edits);
+
+    result.nodes[0] = (buffer_history_node_t){
+        .parent = BUFFER_HISTORY_NONE,
+        .redo_child = BUFFER_HISTORY_NONE,
+        .edits_begin = 0};
+    return result;
 }
 
 void buffer_history_destroy(buffer_history_t* m) {
-    while (m->length) buffer_history_pop(m);
-    free(m->data);
+    for (size_t i = 0; i < m->edits_length; i += 1)
+        edit_destroy(m, &m->edits[i]);
+    free(m->nodes);
+    free(m->edits);
+    memset(m, 0, sizeof(buffer_history_t));
+}
+
+size_t buffer_history_edits_end(buffer_history_t* m, size_t node) {
+    assert(node < m->length);
+    if (node == m->length - 1) return m->edits_length;
+    return m->nodes[node + 1].edits_begin;
+}
+
+// drops the nodes whose parent is marked in `remap`, then packs the
+// survivors and their edits to the front keeping creation order
+static void buffer_history_compact(buffer_history_t* m,
+                                   size_t* remap) {
+    for (size_t i = 1; i < m->length; i += 1) {
+        size_t parent = m->nodes[i].parent;
+        if (remap[i] != BUFFER_HISTORY_NONE &&
+            remap[parent] == BUFFER_HISTORY_NONE)
+            remap[i] = BUFFER_HISTORY_NONE;
+    }
+
+    size_t length = 0;
+    size_t edits_length = 0;
+    for (size_t i = 0; i < m->length; i += 1) {
+        size_t edits_begin = m->nodes[i].edits_begin;
+        size_t edits_end = buffer_history_edits_end(m, i);
+
+        if (remap[i] == BUFFER_HISTORY_NONE) {
+            for (size_t ii = edits_begin; ii < edits_end; ii += 1)
+                edit_destroy(m, &m->edits[ii]);
+            m->size -= sizeof(buffer_history_node_t);
+            continue;
+        }
+
+        memmove(&m->edits[edits_length], &m->edits[edits_begin],
+                (edits_end - edits_begin) *
+                    sizeof(buffer_history_edit_t));
+
+        remap[i] = length;
+        buffer_history_node_t node = m->nodes[i];
+        node.edits_begin = edits_length;
+        if (node.parent != BUFFER_HISTORY_NONE)
+            node.parent = remap[node.parent];
+        m->nodes[length++] = node;
+        edits_length += edits_end - edits_begin;
+    }
+
+    for (size_t i = 0; i < length; i += 1) {
+        size_t redo_child = m->nodes[i].redo_child;
+        if (redo_child != BUFFER_HISTORY_NONE)
+            m->nodes[i].redo_child = remap[redo_child];
+    }
+
+    // a fork whose redo branch was dropped falls back to its newest
+    // surviving child
+    for (size_t i = length - 1; i > 0; i -= 1) {
+        size_t parent_idx = m->nodes[i].parent;
+        buffer_history_node_t* parent = &m->nodes[parent_idx];
+        if (parent->redo_child == BUFFER_HISTORY_NONE)
+            parent->redo_child = i;
+    }
+
+    m->length = length;
+    m->edits_length = edits_length;
+    m->current = remap[m->current];
+    assert(m->current != BUFFER_HISTORY_NONE);
+}
+
+static bool buffer_history_is_ancestor(buffer_history_t* m,
+                                       size_t node, size_t of) {
+    for (size_t i = of; i != BUFFER_HISTORY_NONE;
+         i = m->nodes[i].parent)
+        if (i == node) return true;
+    return false;
+}
+
+// evicts the oldest history until it fits the budget. the oldest
+// branch is either dropped whole when the text is not in it, or its
+// first node is folded into the root so it can no longer be undone
+static void buffer_history_enforce_budget(buffer_history_t* m) {
+    while (m->size > m->budget && m->length > 1) {
+        // children follow their parent, so this one hangs off the root
+        size_t oldest = 1;
+        bool is_open_node = m->is_open && oldest == m->current;
+        if (is_open_node) return;
+
+        size_t* remap = malloc(m->length * sizeof(size_t));
+        assert(remap);
+        for (size_t i = 0; i < m->length; i += 1) remap[i] = i;
+
+        if (buffer_history_is_ancestor(m, oldest, m->current)) {
+            for (size_t i = 1; i < m->length; i += 1) {
+                if (m->nodes[i].parent != 0 || i == oldest) continue;
+                remap[i] = BUFFER_HISTORY_NONE;
+            }
+            for (size_t i = oldest + 1; i < m->length; i += 1) {
+                if (m->nodes[i].parent != oldest) continue;
+                m->nodes[i].parent = 0;
+            }
+            if (m->current == oldest) m->current = 0;
+            m->nodes[0].redo_child = m->nodes[oldest].redo_child;
+        }
+        remap[oldest] = BUFFER_HISTORY_NONE;
+
+        buffer_history_compact(m, remap);
+        free(remap);
+    }
 }
 
-void buffer_history_copy_and_push(buffer_history_t* m,
-                                  utf32_str_t* str,
-                                  text_pos_t cursor) {
+void buffer_history_push(buffer_history_t* m, text_pos_t cursor) {
+    // an undo point with no edits yet is reused
+    if (m->is_open &&
+        buffer_history_edits_end(m, m->current) ==
+            m->nodes[m->current].edits_begin) {
+        m->nodes[m->current].cursor = cursor;
+        m->nodes[m->current].redo_cursor = cursor;
+        return;
+    }
+
     size_t required_capacity =
-        (m->length + 1) * sizeof(buffer_history_item_t);
+        (m->length + 1) * sizeof(buffer_history_node_t);
 
     while (required_capacity > m->capacity) {
         m->capacity *= 2;
-        m->data = realloc(m->data, m->capacity);
-        assert(m->data);
+        m->nodes = realloc(m->nodes, m->capacity);
+        assert(m->nodes);
     }
 
-    m->data[m->length].str = utf32_str_clone(str);
-    m->data[m->length].cursor = cursor;
+    m->nodes[m->length] =
+        (buffer_history_node_t){.parent = m->current,
+                                .redo_child = BUFFER_HISTORY_NONE,
+                                .edits_begin = m->edits_length,
+                                .cursor = cursor,
+                                .redo_cursor = cursor};
+    m->nodes[m->current].redo_child = m->length;
+    m->current = m->length;
     m->length += 1;
+    m->is_open = true;
+    m->size += sizeof(buffer_history_node_t);
+
+    buffer_history_enforce_budget(m);
+}
+
+// extends the last edit of the open node when the new one continues
+// it, so a run of typing or deleting is kept as a single edit
+static bool buffer_history_coalesce(buffer_history_t* m,
+                                    piece_table_t* text, size_t pos,
+                                    size_t count,
+                                    const c32_t* inserted,
+                                    size_t inserted_length) {
+    if (m->edits_length == m->nodes[m->current].edits_begin)
+        return false;
+
+    buffer_history_edit_t* last = &m->edits[m->edits_length - 1];
+    size_t previous_size = edit_size(last);
+
+    bool is_typing = !count && !last->removed.length &&
+                     last->pos + last->inserted.length == pos;
+    bool is_backspace = !inserted_length && !last->inserted.length &&
+                        pos + count == last->pos;
+    bool is_delete = !inserted_length && !last->inserted.length &&
+                     pos == last->pos;
+
+    if (is_typing) {
+        utf32_str_insert_buf(&last->inserted, last->inserted.length,
+                             (c32_t*)inserted, inserted_length);
+    } else if (is_backspace) {
+        str_insert_text(&last->removed, 0, text, pos, count);
+        last->pos = pos;
+    } else if (is_delete) {
+        str_insert_text(&last->removed, last->removed.length, text,
+                        pos, count);
+    } else {
+        return false;
+    }
+
+    m->size = m->size - previous_size + edit_size(last);
+    return true;
+}
+
+void buffer_history_push_edit(buffer_history_t* m,
+                              piece_table_t* text, size_t pos,
+                              size_t count, const c32_t* inserted,
+                              size_t inserted_length) {
+    if (!count && !inserted_length) return;
+
+    if (!m->is_open) {
+        // with no undo point yet the root just follows the text
+        if (m->length == 1) return;
+        buffer_history_push(m, m->cursor);
+    }
+
+    if (buffer_history_coalesce(m, text, pos, count, inserted,
+                                inserted_length)) {
+        buffer_history_enforce_budget(m);
+        return;
+    }
+
+    size_t required_capacity =
+        (m->edits_length + 1) * sizeof(buffer_history_edit_t);
+
+    while (required_capacity > m->edits_capacity) {
+        m->edits_capacity *= 2;
+        m->edits = realloc(m->edits, m->edits_capacity);
+        assert(m->edits);
+    }
+
+    buffer_history_edit_t* edit = &m->edits[m->edits_length++];
+    edit->pos = pos;
+    edit->removed = utf32_str_create();
+    str_insert_text(&edit->removed, 0, text, pos, count);
+    edit->inserted = utf32_str_create();
+    utf32_str_copy(&edit->inserted, (c32_t*)inserted,
+                   inserted_length);
+    m->size += edit_size(edit);
+
+    buffer_history_enforce_budget(m);
 }
 
-void buffer_history_pop(buffer_history_t* m) {
-    assert(m->length > 0);
-    m->length -= 1;
-    utf32_str_destroy(&m->data[m->length].str);
+size_t buffer_history_undo(buffer_history_t* m, text_pos_t cursor) {
+    size_t result = m->current;
+    if (!result) return BUFFER_HISTORY_NONE;
+
+    buffer_history_node_t* node = &m->nodes[result];
+    node->redo_cursor = cursor;
+    m->nodes[node->parent].redo_child = result;
+    m->current = node->parent;
+    m->is_open = false;
+    m->cursor = node->cursor;
+    return result;
 }
 
-void buffer_history_clear(buffer_history_t* m) {
-    while (m->length > 0) buffer_history_pop(m);
+size_t buffer_history_redo(buffer_history_t* m) {
+    size_t result = m->nodes[m->current].redo_child;
+    if (result == BUFFER_HISTORY_NONE) return result;
+
+    m->current = result;
+    m->is_open = false;
+    m->cursor = m->nodes[result].redo_cursor;
+    return result;
 }
 
-buffer_history_item_t* buffer_history_top(buffer_history_t* m) {
-    assert(m->length > 0);
-    return &m->data[m->length - 1];
+bool buffer_history_next_branch(buffer_history_t* m) {
+    buffer_history_node_t* node = &m->nodes[m->current];
+    if (node->redo_child == BUFFER_HISTORY_NONE) return false;
+
+    // walks the children of the current node from the redo child
+    // towards the older ones, wrapping around to the newest
+    size_t next = node->redo_child;
+    for (size_t i = 0; i < m->length; i += 1) {
+        next = next ? next - 1 : m->length - 1;
+        if (m->nodes[next].parent == m->current) break;
+    }
+
+    bool changed = next != node->redo_child;
+    node->redo_child = next;
+    return changed;
 }
@@ -1,26 +1,60 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "../dyn_strings/utf32_string.h"
 #include "../highlighter/highlighter.h"
+#include "piece_table.h"
 
+#define BUFFER_HISTORY_NONE ((size_t)-1)
+
+// undoing an edit replaces `inserted` at `pos` with `removed`,
+// redoing it does the opposite
+typedef struct {
+    size_t pos;
+    utf32_str_t removed;
+    utf32_str_t inserted;
+} buffer_history_edit_t;
+
+// a node takes the text from its parent's state to its own through
+// the edits from `edits_begin` up to the next node's. nodes are kept
+// in creation order so a child always follows its parent and only the
+// last node can still receive edits
 typedef struct {
-    utf32_str_t str;
+    size_t parent;
+    size_t redo_child;
+    size_t edits_begin;
     text_pos_t cursor;
-} buffer_history_item_t;
+    text_pos_t redo_cursor;
+} buffer_history_node_t;
 
+// undo tree, node 0 is the oldest state still reachable. undoing and
+// then editing starts a new branch, the old one stays reachable
+// through the redo child of the fork
 typedef struct {
-    buffer_history_item_t* data;
+    buffer_history_node_t* nodes;
     size_t length;
     size_t capacity;
+    buffer_history_edit_t* edits;
+    size_t edits_length;
+    size_t edits_capacity;
+    size_t current;
+    bool is_open;
+    text_pos_t cursor;
+    size_t size;
+    size_t budget;
 } buffer_history_t;
 
-buffer_history_t buffer_history_create();
+buffer_history_t buffer_history_create(size_t budget);
 void buffer_history_destroy(buffer_history_t* m);
-void buffer_history_copy_and_push(buffer_history_t* i,
-                                  utf32_str_t* str,
-                                  text_pos_t cursor);
-void buffer_history_pop(buffer_history_t* m);
-void buffer_history_clear(buffer_history_t* m);
-buffer_history_item_t* buffer_history_top(buffer_history_t* m);
+void buffer_history_push(buffer_history_t* m, text_pos_t cursor);
+// called before the edit is applied to `text`
+void buffer_history_push_edit(buffer_history_t* m,
+                              piece_table_t* text, size_t pos,
+                              size_t count, const c32_t* inserted,
+                              size_t inserted_length);
+size_t buffer_history_edits_end(buffer_history_t* m, size_t node);
+size_t buffer_history_undo(buffer_history_t* m, text_pos_t cursor);
+size_t buffer_history_redo(buffer_history_t* m);
+bool buffer_history_next_branch(buffer_history_t* m);
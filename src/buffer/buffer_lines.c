@@ -3,57 +3,579 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+
+#include "../dyn_strings/line_scan.h"
+#include "../dyn_strings/utf32_string.h"
+#include "piece_table.h"
+
+typedef struct {
+    uint32_t* data;
+    size_t length;
+    size_t capacity;
+} line_builder_t;
+
+// per thread, lines are also built by the loader threads
+static thread_local uint32_t g_priority_seed = 0x2545f491;
+
+static uint32_t line_priority(void) {
+    g_priority_seed ^= g_priority_seed << 13;
+    g_priority_seed ^= g_priority_seed >> 17;
+    g_priority_seed ^= g_priority_seed << 5;
+    return g_priority_seed;
+}
+
+static size_t text_utf8_len(piece_table_t* text, size_t from,
+                            size_t to) {
+    piece_table_iter_t it = piece_table_iter_create(text, from, to);
+
+    size_t result = 0;
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len))
+        result += utf32_utf8_len(chunk, chunk_len);
+
+    return result;
+}
 
 size_t line_len(line_t* m) { return m->end - m->start; }
 
+static uint32_t line_node_alloc(buffer_lines_t* m, size_t span,
+                                size_t byte_span) {
+    uint32_t result = m->free_list;
+
+    if (result) {
+        m->free_list = m->nodes[result].left;
+    } else {
+        size_t required_capacity =
+            sizeof(line_node_t) * (m->nodes_length + 1);
+
+        while (required_capacity > m->capacity) {
+            m->capacity *= 2;
+            m->nodes = realloc(m->nodes, m->capacity);
+            assert(m->nodes);
+        }
+
+        assert(m->nodes_length < UINT32_MAX);
+        result = m->nodes_length++;
+    }
+
+    m->nodes[result] = (line_node_t){.priority = line_priority(),
+                                     .count = 1,
+                                     .span = span,
+                                     .subtree_span = span,
+                                     .byte_span = byte_span,
+                                     .subtree_byte_span = byte_span};
+    return result;
+}
+
+static void line_node_free(buffer_lines_t* m, uint32_t idx) {
+    if (!idx) return;
+    line_node_free(m, m->nodes[idx].left);
+    line_node_free(m, m->nodes[idx].right);
+    m->nodes[idx].left = m->free_list;
+    m->free_list = idx;
+}
+
+static void line_node_update(buffer_lines_t* m, uint32_t idx) {
+    line_node_t* n = &m->nodes[idx];
+    line_node_t* l = &m->nodes[n->left];
+    line_node_t* r = &m->nodes[n->right];
+    n->count = 1 + l->count + r->count;
+    n->subtree_span = n->span + l->subtree_span + r->subtree_span;
+    n->subtree_byte_span =
+        n->byte_span + l->subtree_byte_span + r->subtree_byte_span;
+}
+
+// splits so that `*l` holds the first `count` lines
+static void line_node_split(buffer_lines_t* m, uint32_t idx,
+                            size_t count, uint32_t* l, uint32_t* r) {
+    if (!idx) {
+        *l = 0;
+        *r = 0;
+        return;
+    }
+
+    line_node_t* n = &m->nodes[idx];
+    size_t left_count = m->nodes[n->left].count;
+
+    if (count <= left_count) {
+        uint32_t left = 0;
+        line_node_split(m, n->left, count, l, &left);
+        m->nodes[idx].left = left;
+        *r = idx;
+    } else {
+        uint32_t right = 0;
+        line_node_split(m, n->right, count - left_count - 1, &right,
+                        r);
+        m->nodes[idx].right = right;
+        *l = idx;
+    }
+
+    line_node_update(m, idx);
+}
+
+static uint32_t line_node_merge(buffer_lines_t* m, uint32_t l,
+                                uint32_t r) {
+    if (!l) return r;
+    if (!r) return l;
+
+    if (m->nodes[l].priority > m->nodes[r].priority) {
+        uint32_t right = line_node_merge(m, m->nodes[l].right, r);
+        m->nodes[l].right = right;
+        line_node_update(m, l);
+        return l;
+    }
+
+    uint32_t left = line_node_merge(m, l, m->nodes[r].left);
+    m->nodes[r].left = left;
+    line_node_update(m, r);
+    return r;
+}
+
+// appends a line to a treap built left to right in linear time, the
+// stack holds the right spine of the tree built so far
+static void line_builder_push(buffer_lines_t* m, line_builder_t* b,
+                              size_t span, size_t byte_span) {
+    uint32_t idx = line_node_alloc(m, span, byte_span);
+
+    uint32_t last = 0;
+    while (b->length &&
+           m->nodes[b->data[b->length - 1]].priority <
+               m->nodes[idx].priority) {
+        last = b->data[--b->length];
+        line_node_update(m, last);
+    }
+
+    m->nodes[idx].left = last;
+    if (b->length) m->nodes[b->data[b->length - 1]].right = idx;
+
+    size_t required_capacity = (b->length + 1) * sizeof(uint32_t);
+    while (required_capacity > b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 64;
+        b->data = realloc(b->data, b->capacity);
+        assert(b->data);
+    }
+    b->data[b->length++] = idx;
+}
+
+static uint32_t line_builder_finish(buffer_lines_t* m,
+                                    line_builder_t* b) {
+    uint32_t root = 0;
+    while (b->length) {
+        root = b->data[--b->length];
+        line_node_update(m, root);
+    }
+    free(b->data);
+    memset(b, 0, sizeof(line_builder_t));
+    return root;
+}
+
+// returns the node of `line_num` along with the codepoint and byte
+// offsets it starts at
+static uint32_t buffer_lines_node_at(buffer_lines_t* m,
+                                     size_t line_num, size_t* start,
+                                     size_t* byte_start) {
+    assert(line_num < m->length);
+
+    *start = 0;
+    *byte_start = 0;
+    uint32_t n = m->root;
+    while (n) {
+        line_node_t* node = &m->nodes[n];
+        line_node_t* left = &m->nodes[node->left];
+        if (line_num < left->count) {
+            n = node->left;
+            continue;
+        }
+
+        *start += left->subtree_span;
+        *byte_start += left->subtree_byte_span;
+        if (line_num == left->count) break;
+
+        line_num -= left->count + 1;
+        *start += node->span;
+        *byte_start += node->byte_span;
+        n = node->right;
+    }
+
+    assert(n);
+    return n;
+}
+
+// finds the line holding the character at `idx`, an index past the
+// last character belongs to the last line
+static size_t buffer_lines_find(buffer_lines_t* m, size_t idx,
+                                size_t* line_start) {
+    assert(m->root);
+    if (idx >= m->nodes[m->root].subtree_span) {
+        size_t last = m->length - 1;
+        *line_start = buffer_lines_get(m, last).start;
+        return last;
+    }
+
+    size_t line_num = 0;
+    size_t start = 0;
+    uint32_t n = m->root;
+    while (n) {
+        line_node_t* node = &m->nodes[n];
+        line_node_t* left = &m->nodes[node->left];
+
+        if (idx < left->subtree_span) {
+            n = node->left;
+            continue;
+        }
+
+        idx -= left->subtree_span;
+        start += left->subtree_span;
+        line_num += left->count;
+
+        if (idx < node->span) break;
+
+        idx -= node->span;
+        start += node->span;
+        line_num += 1;
+        n = node->right;
+    }
+
+    *line_start = start;
+    return line_num;
+}
+
+static void buffer_lines_set_span(buffer_lines_t* m, size_t line_num,
+                                  size_t span, size_t byte_span) {
+    size_t start = 0;
+    size_t byte_start = 0;
+    uint32_t old_idx =
+        buffer_lines_node_at(m, line_num, &start, &byte_start);
+    line_node_t old = m->nodes[old_idx];
+
+    uint32_t n = m->root;
+    while (n) {
+        line_node_t* node = &m->nodes[n];
+        size_t left_count = m->nodes[node->left].count;
+        node->subtree_span = node->subtree_span - old.span + span;
+        node->subtree_byte_span =
+            node->subtree_byte_span - old.byte_span + byte_span;
+        if (line_num < left_count) {
+            n = node->left;
+        } else if (line_num == left_count) {
+            node->span = span;
+            node->byte_span = byte_span;
+            break;
+        } else {
+            line_num -= left_count + 1;
+            n = node->right;
+        }
+    }
+}
+
 buffer_lines_t buffer_lines_create(void) {
-    return (buffer_lines_t){.data = calloc(sizeof(line_t), 2),
-                            .length = 0,
-                            .capacity = sizeof(line_t) * 2};
+    buffer_lines_t result = {.nodes = calloc(2, sizeof(line_node_t)),
+                             .nodes_length = 1,
+                             .capacity = sizeof(line_node_t) * 2,
+                             .free_list = 0,
+                             .root = 0,
+                             .length = 0};
+    assert(result.nodes);
+    return result;
 }
 
 void buffer_lines_destroy(buffer_lines_t* m) {
-    free(m->data);
+    free(m->nodes);
     memset(m, 0, sizeof(buffer_lines_t));
 }
 
-static void buffer_lines_push(buffer_lines_t* m, line_t line) {
-    size_t required_size = sizeof(line_t) * (m->length + 1);
+void buffer_lines_clear(buffer_lines_t* m) {
+    m->nodes_length = 1;
+    m->free_list = 0;
+    m->root = 0;
+    m->length = 0;
+}
+
+line_t buffer_lines_get(buffer_lines_t* m, size_t line_num) {
+    size_t start = 0;
+    size_t byte_start = 0;
+    uint32_t n =
+        buffer_lines_node_at(m, line_num, &start, &byte_start);
+
+    // every line but the last one spans its trailing '\n'
+    bool is_last = line_num == m->length - 1;
+    size_t end = start + m->nodes[n].span - (is_last ? 0 : 1);
+    return (line_t){.start = start, .end = end};
+}
+
+size_t buffer_lines_get_line_num_from_idx(buffer_lines_t* m,
+                                          size_t idx) {
+    size_t line_start = 0;
+    return buffer_lines_find(m, idx, &line_start);
+}
+
+size_t buffer_lines_get_byte_start(buffer_lines_t* m,
+                                   size_t line_num) {
+    size_t start = 0;
+    size_t byte_start = 0;
+    buffer_lines_node_at(m, line_num, &start, &byte_start);
+    return byte_start;
+}
+
+size_t buffer_lines_get_line_num_from_byte(buffer_lines_t* m,
+                                           size_t byte) {
+    assert(m->root);
+    if (byte >= m->nodes[m->root].subtree_byte_span)
+        return m->length - 1;
+
+    size_t line_num = 0;
+    uint32_t n = m->root;
+    while (n) {
+        line_node_t* node = &m->nodes[n];
+        line_node_t* left = &m->nodes[node->left];
+
+        if (byte < left->subtree_byte_span) {
+            n = node->left;
+            continue;
+        }
+
+        byte -= left->subtree_byte_span;
+        line_num += left->count;
+
+        if (byte < node->byte_span) break;
+
+        byte -= node->byte_span;
+        line_num += 1;
+        n = node->right;
+    }
+
+    return line_num;
+}
+
+size_t buffer_lines_byte_length(buffer_lines_t* m) {
+    return m->nodes[m->root].subtree_byte_span;
+}
+
+size_t buffer_lines_column_to_byte(buffer_lines_t* m,
+                                   piece_table_t* text,
+                                   size_t line_num, size_t column) {
+    line_t line = buffer_lines_get(m, line_num);
+    assert(column <= line_len(&line));
+    return text_utf8_len(text, line.start, line.start + column);
+}
+
+size_t buffer_lines_byte_to_column(buffer_lines_t* m,
+                                   piece_table_t* text,
+                                   size_t line_num,
+                                   size_t byte_column) {
+    line_t line = buffer_lines_get(m, line_num);
+    piece_table_iter_t it =
+        piece_table_iter_create(text, line.start, line.end);
 
-    while (required_size > m->capacity) {
-        m->capacity *= 2;
-        m->data = realloc(m->data, m->capacity);
-        assert(m->data);
+    size_t column = 0;
+    size_t bytes = 0;
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len)) {
+        for (size_t i = 0; i < chunk_len; i += 1) {
+            // a byte column inside a character maps to that character
+            bytes += utf32_char_utf8_len(chunk[i]);
+            if (bytes > byte_column) return column;
+            column += 1;
+        }
     }
 
-    m->data[m->length++] = line;
+    return column;
+}
+
+size_t buffer_lines_idx_to_byte(buffer_lines_t* m,
+                                piece_table_t* text, size_t idx) {
+    size_t line_start = 0;
+    size_t line_num = buffer_lines_find(m, idx, &line_start);
+    return buffer_lines_get_byte_start(m, line_num) +
+           text_utf8_len(text, line_start, idx);
 }
 
-void buffer_lines_clear(buffer_lines_t* m) { m->length = 0; }
+void buffer_lines_update_utf8(buffer_lines_t* m, const char* bytes,
+                              size_t size, size_t length,
+                              size_t max_lines) {
+    buffer_lines_clear(m);
+    assert(max_lines);
+
+    // every byte that isn't a continuation byte starts a codepoint
+    line_builder_t builder = {0};
+    size_t ends[LINE_SCAN_BATCH];
+    size_t codepoint_ends[LINE_SCAN_BATCH];
+    size_t ends_length = 0;
+    size_t line_begin = 0;
+    size_t codepoints = 0;
+    do {
+        ends_length = line_scan_utf8(bytes, size, line_begin, ends,
+                                     codepoint_ends, LINE_SCAN_BATCH);
+        size_t codepoint_begin = 0;
+        for (size_t i = 0; i < ends_length; i += 1) {
+            if (m->length + 1 == max_lines) break;
+            line_builder_push(m, &builder,
+                              codepoint_ends[i] - codepoint_begin,
+                              ends[i] - line_begin);
+            m->length += 1;
+            line_begin = ends[i];
+            codepoints += codepoint_ends[i] - codepoint_begin;
+            codepoint_begin = codepoint_ends[i];
+        }
+    } while (ends_length == LINE_SCAN_BATCH &&
+             m->length + 1 < max_lines);
+
+    // the rest of the text is the last line
+    assert(codepoints <= length);
+    line_builder_push(m, &builder, length - codepoints,
+                      size - line_begin);
+    m->length += 1;
+    m->root = line_builder_finish(m, &builder);
+}
 
-void buffer_lines_update(buffer_lines_t* m, const c32_t* str,
-                         const size_t str_len) {
+void buffer_lines_update(buffer_lines_t* m, piece_table_t* text) {
     buffer_lines_clear(m);
 
-    line_t line = {0};
-    for (size_t i = 0; i < str_len; i += 1) {
-        if (str[i] != U'\n') continue;
-        line.end = i;
-        buffer_lines_push(m, line);
-        line.start = i + 1;
+    size_t utf8_size = 0;
+    const char* utf8 = piece_table_utf8_bytes(text, &utf8_size);
+    if (utf8) {
+        buffer_lines_update_utf8(m, utf8, utf8_size, text->length,
+                                 (size_t)-1);
+        return;
+    }
+
+    line_builder_t builder = {0};
+    piece_table_iter_t it =
+        piece_table_iter_create(text, 0, text->length);
+
+    size_t span = 0;
+    size_t byte_span = 0;
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len)) {
+        line_scan_iter_t lines =
+            line_scan_iter_create(chunk, chunk_len);
+        size_t line_span = 0;
+        size_t line_byte_span = 0;
+        bool is_line_end = false;
+        while (line_scan_iter_next(&lines, &line_span,
+                                   &line_byte_span, &is_line_end)) {
+            span += line_span;
+            byte_span += line_byte_span;
+            if (!is_line_end) continue;
+            line_builder_push(m, &builder, span, byte_span);
+            m->length += 1;
+            span = 0;
+            byte_span = 0;
+        }
     }
 
-    line.end = str_len;
-    buffer_lines_push(m, line);
+    line_builder_push(m, &builder, span, byte_span);
+    m->length += 1;
+    m->root = line_builder_finish(m, &builder);
 }
 
-size_t buffer_lines_get_line_num_from_idx(buffer_lines_t* m,
-                                          size_t idx) {
-    for (size_t i = 0; i < m->length; i += 1) {
-        if (idx >= m->data[i].start && idx <= m->data[i].end)
-            return i;
+void buffer_lines_insert(buffer_lines_t* m, piece_table_t* text,
+                         size_t pos, size_t len) {
+    if (!len) return;
+
+    size_t line_start = 0;
+    size_t line_num = buffer_lines_find(m, pos, &line_start);
+    size_t start = 0;
+    size_t byte_start = 0;
+    line_node_t line = m->nodes[buffer_lines_node_at(
+        m, line_num, &start, &byte_start)];
+    size_t column = pos - line_start;
+
+    // the edited line is cut at the first inserted '\n', every
+    // following inserted line becomes a new node after it
+    line_builder_t builder = {0};
+    bool is_first = true;
+    size_t new_lines = 0;
+    size_t span = 0;
+    size_t byte_span = 0;
+
+    piece_table_iter_t it =
+        piece_table_iter_create(text, pos, pos + len);
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len)) {
+        line_scan_iter_t lines =
+            line_scan_iter_create(chunk, chunk_len);
+        size_t line_span = 0;
+        size_t line_byte_span = 0;
+        bool is_line_end = false;
+        while (line_scan_iter_next(&lines, &line_span,
+                                   &line_byte_span, &is_line_end)) {
+            span += line_span;
+            byte_span += line_byte_span;
+            if (!is_line_end) continue;
+
+            if (is_first) {
+                size_t column_bytes =
+                    text_utf8_len(text, line_start, pos);
+                buffer_lines_set_span(m, line_num, column + span,
+                                      column_bytes + byte_span);
+                line.span -= column;
+                line.byte_span -= column_bytes;
+                is_first = false;
+            } else {
+                line_builder_push(m, &builder, span, byte_span);
+                new_lines += 1;
+            }
+            span = 0;
+            byte_span = 0;
+        }
+    }
+
+    if (is_first) {
+        buffer_lines_set_span(m, line_num, line.span + span,
+                              line.byte_span + byte_span);
+        return;
+    }
+
+    line_builder_push(m, &builder, span + line.span,
+                      byte_span + line.byte_span);
+    new_lines += 1;
+    uint32_t inserted = line_builder_finish(m, &builder);
+
+    uint32_t l = 0;
+    uint32_t r = 0;
+    line_node_split(m, m->root, line_num + 1, &l, &r);
+    m->root = line_node_merge(m, line_node_merge(m, l, inserted), r);
+    m->length += new_lines;
+}
+
+void buffer_lines_delete(buffer_lines_t* m, piece_table_t* text,
+                         size_t pos, size_t count) {
+    if (!count || !m->nodes[m->root].subtree_span) return;
+    assert(pos + count <= text->length);
+
+    size_t first_start = 0;
+    size_t first = buffer_lines_find(m, pos, &first_start);
+    size_t last_start = 0;
+    size_t last = buffer_lines_find(m, pos + count, &last_start);
+
+    size_t start = 0;
+    size_t byte_start = 0;
+    buffer_lines_node_at(m, first, &start, &byte_start);
+    size_t last_byte_start = 0;
+    line_node_t last_line = m->nodes[buffer_lines_node_at(
+        m, last, &last_start, &last_byte_start)];
+
+    size_t span = last_start + last_line.span - start - count;
+    size_t byte_span = last_byte_start + last_line.byte_span -
+                       byte_start -
+                       text_utf8_len(text, pos, pos + count);
+
+    if (first != last) {
+        uint32_t l = 0;
+        uint32_t mid = 0;
+        uint32_t r = 0;
+        line_node_split(m, m->root, first + 1, &l, &r);
+        line_node_split(m, r, last - first, &mid, &r);
+        line_node_free(m, mid);
+        m->root = line_node_merge(m, l, r);
+        m->length -= last - first;
     }
 
-    assert(0 &&
-           "didn't find line, probably a bug outside this function");
+    buffer_lines_set_span(m, first, span, byte_span);
 }
@@ -1,23 +1,71 @@
 #pragma once
 #include <fieldfusion.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "piece_table.h"
 
 typedef struct {
     size_t start;
     size_t end;
 } line_t;
 
+// lines are kept as an implicit treap of line spans so an edit only
+// touches the lines it changes, the start of every following line is
+// derived from the subtree sums instead of being rewritten. spans are
+// kept both in codepoints and in UTF-8 bytes so text positions map to
+// the byte offsets tree-sitter works with. nodes live in a pool and
+// link by index, index 0 is the null node
 typedef struct {
-    line_t* data;
-    size_t length;
+    uint32_t left;
+    uint32_t right;
+    uint32_t priority;
+    uint32_t count;
+    size_t span;
+    size_t subtree_span;
+    size_t byte_span;
+    size_t subtree_byte_span;
+} line_node_t;
+
+typedef struct {
+    line_node_t* nodes;
+    size_t nodes_length;
     size_t capacity;
+    uint32_t free_list;
+    uint32_t root;
+    size_t length;
 } buffer_lines_t;
 
 size_t line_len(line_t* m);
 buffer_lines_t buffer_lines_create(void);
+line_t buffer_lines_get(buffer_lines_t* m, size_t line_num);
 size_t buffer_lines_get_line_num_from_idx(buffer_lines_t* m,
                                           size_t idx);
+size_t buffer_lines_get_byte_start(buffer_lines_t* m,
+                                   size_t line_num);
+size_t buffer_lines_get_line_num_from_byte(buffer_lines_t* m,
+                                           size_t byte);
+size_t buffer_lines_byte_length(buffer_lines_t* m);
+size_t buffer_lines_column_to_byte(buffer_lines_t* m,
+                                   piece_table_t* text,
+                                   size_t line_num, size_t column);
+size_t buffer_lines_byte_to_column(buffer_lines_t* m,
+                                   piece_table_t* text,
+                                   size_t line_num,
+                                   size_t byte_column);
+size_t buffer_lines_idx_to_byte(buffer_lines_t* m,
+                                piece_table_t* text, size_t idx);
 void buffer_lines_destroy(buffer_lines_t* m);
 void buffer_lines_clear(buffer_lines_t* m);
-void buffer_lines_update(buffer_lines_t* m, const c32_t* str,
-                         const size_t str_len);
+void buffer_lines_update(buffer_lines_t* m, piece_table_t* text);
+// builds the lines of `length` codepoints of valid UTF-8, past the
+// first `max_lines` - 1 lines the rest of the text is the last line
+void buffer_lines_update_utf8(buffer_lines_t* m, const char* bytes,
+                              size_t size, size_t length,
+                              size_t max_lines);
+// called once `len` characters were inserted at `pos` in `text`
+void buffer_lines_insert(buffer_lines_t* m, piece_table_t* text,
+                         size_t pos, size_t len);
+// called before `count` characters at `pos` are deleted from `text`
+void buffer_lines_delete(buffer_lines_t* m, piece_table_t* text,
+                         size_t pos, size_t count);
@@ -0,0 +1,156 @@
+#include "buffer_load.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../config.h"
+#include "../dyn_strings/utf8_string.h"
+#include "../highlighter/highlighter.h"
+#include "buffer_lines.h"
+#include "buffer_syntax.h"
+#include "piece_table.h"
+
+bool buffer_load_text(piece_table_t* text, const char* path,
+                      atomic_size_t* progress) {
+    // the file is kept as UTF-8 and decoded as it is read, large
+    // files are mapped instead of being read into memory
+    struct stat st;
+    bool is_large = !stat(path, &st) &&
+                    (size_t)st.st_size >= g_cfg.large_file_size;
+    if (is_large && piece_table_reset_mapped(text, path, progress))
+        return true;
+
+    // the text takes ownership of the bytes
+    utf8_str_t str = utf8_str_create();
+    if (utf8_str_read_file(&str, path) &&
+        piece_table_reset_utf8(text, str.data, str.length, progress))
+        return true;
+
+    utf8_str_destroy(&str);
+    piece_table_reset(text, utf32_str_create());
+    return false;
+}
+
+static bool buffer_load_is_cancelled(buffer_load_t* m) {
+    return __atomic_load_n(&m->is_cancelled, __ATOMIC_RELAXED);
+}
+
+static void buffer_load_publish(buffer_load_t* m,
+                                enum buffer_load_stage stage) {
+    atomic_store_explicit(&m->stage, stage, memory_order_release);
+}
+
+static int buffer_load_run(void* arg) {
+    buffer_load_t* m = arg;
+
+    piece_table_t text = piece_table_create(utf32_str_create());
+    buffer_load_text(&text, m->path, &m->progress);
+
+    // the snapshot keeps the bytes once the text is handed over
+    piece_table_snapshot_t snapshot =
+        piece_table_snapshot_create(&text);
+    const char* bytes = snapshot.utf8.data;
+    size_t size = snapshot.utf8.size;
+    size_t length = text.length;
+    bool is_mapped = piece_table_is_mapped(&text);
+
+    // the first lines are split out so the top of the text can be
+    // shown while the rest is indexed
+    m->head_lines = buffer_lines_create();
+    if (bytes)
+        buffer_lines_update_utf8(&m->head_lines, bytes, size, length,
+                                 BUFFER_LOAD_HEAD_LINES);
+    else
+        buffer_lines_update(&m->head_lines, &text);
+    m->text = text;
+    buffer_load_publish(m, buffer_load_stage_text);
+
+    // left empty when the head lines already hold the whole text
+    m->lines = buffer_lines_create();
+    if (buffer_load_is_cancelled(m)) goto finish;
+    if (bytes && m->head_lines.length == BUFFER_LOAD_HEAD_LINES)
+        buffer_lines_update_utf8(&m->lines, bytes, size, length,
+                                 (size_t)-1);
+    buffer_load_publish(m, buffer_load_stage_lines);
+
+    // highlighting is skipped for mapped large files like it is when
+    // they are edited
+    m->highlighter =
+        (highlighter_t){.tree = 0, .language = m->language};
+    m->tokens = hlr_tokens_create();
+    if (buffer_load_is_cancelled(m)) goto finish;
+    if (m->language != language_none_t && bytes && !is_mapped) {
+        TSParser* parser = ts_parser_new();
+        ts_parser_set_cancellation_flag(parser, &m->is_cancelled);
+        m->highlighter = hlr_highlighter_create_with_parser(
+            parser, m->language, bytes, size);
+        // the rest is queried once a view shows it
+        hlr_string_t source = {.data = bytes, .size = size};
+        hlr_rows_t rows = {.start = 0,
+                           .end = BUFFER_SYNTAX_VIEW_ROWS - 1};
+        if (m->highlighter.tree)
+            hlr_tokens_update(&m->highlighter, &m->tokens,
+                              hlr_string_input(&source), rows);
+        ts_parser_delete(parser);
+    }
+
+finish:
+    piece_table_snapshot_destroy(&snapshot);
+    buffer_load_publish(m, buffer_load_stage_syntax);
+    return 0;
+}
+
+buffer_load_t* buffer_load_start(const char* path,
+                                 enum language language) {
+    buffer_load_t* result = calloc(1, sizeof(buffer_load_t));
+    assert(result);
+    result->path = strdup(path);
+    assert(result->path);
+    result->language = language;
+    result->taken = buffer_load_stage_reading;
+    atomic_init(&result->stage, buffer_load_stage_reading);
+    atomic_init(&result->progress, 0);
+
+    struct stat st;
+    if (!stat(path, &st)) result->size = st.st_size;
+
+    if (thrd_create(&result->thread, buffer_load_run, result) ==
+        thrd_success)
+        return result;
+
+    free(result->path);
+    free(result);
+    return 0;
+}
+
+enum buffer_load_stage buffer_load_get_stage(buffer_load_t* m) {
+    return atomic_load_explicit(&m->stage, memory_order_acquire);
+}
+
+float buffer_load_get_progress(buffer_load_t* m) {
+    if (!m->size) return 1;
+    size_t progress =
+        atomic_load_explicit(&m->progress, memory_order_relaxed);
+    return (float)progress / m->size;
+}
+
+void buffer_load_destroy(buffer_load_t* m) {
+    __atomic_store_n(&m->is_cancelled, 1, __ATOMIC_RELAXED);
+    thrd_join(m->thread, 0);
+
+    if (m->taken < buffer_load_stage_text) {
+        piece_table_destroy(&m->text);
+        buffer_lines_destroy(&m->head_lines);
+    }
+    if (m->taken < buffer_load_stage_lines)
+        buffer_lines_destroy(&m->lines);
+    if (m->taken < buffer_load_stage_syntax) {
+        hlr_highlighter_destroy(&m->highlighter);
+        hlr_tokens_destroy(&m->tokens);
+    }
+
+    free(m->path);
+    free(m);
+}
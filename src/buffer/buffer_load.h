@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <threads.h>
+
+#include "../highlighter/highlighter.h"
+#include "buffer_lines.h"
+#include "piece_table.h"
+
+// lines split out of the text before it is published, the rest of it
+// stays a single line until the whole index is built
+#define BUFFER_LOAD_HEAD_LINES 0x1000
+
+// what a load has published so far, each stage also publishes the
+// results of the ones before it
+enum buffer_load_stage {
+    buffer_load_stage_reading,
+    buffer_load_stage_text,
+    buffer_load_stage_lines,
+    buffer_load_stage_syntax,
+};
+
+// a file read on a thread of its own. results are written by the
+// thread before it moves `stage` past them and are left alone after,
+// so the buffer can take them without locking. `taken` is the last
+// stage the buffer took and is only touched by the buffer
+typedef struct {
+    thrd_t thread;
+    char* path;
+    enum language language;
+    atomic_int stage;
+    enum buffer_load_stage taken;
+    atomic_size_t progress;
+    size_t size;
+    // set to cancel the load, tree-sitter polls it while parsing
+    size_t is_cancelled;
+    piece_table_t text;
+    buffer_lines_t head_lines;
+    buffer_lines_t lines;
+    highlighter_t highlighter;
+    tokens_t tokens;
+} buffer_load_t;
+
+// reads the file at `path` into `text`, large files are mapped. the
+// text is left empty if the file can't be read as UTF-8 text
+bool buffer_load_text(piece_table_t* text, const char* path,
+                      atomic_size_t* progress);
+// null if the thread couldn't be started
+buffer_load_t* buffer_load_start(const char* path,
+                                 enum language language);
+enum buffer_load_stage buffer_load_get_stage(buffer_load_t* m);
+// fraction of the file read so far
+float buffer_load_get_progress(buffer_load_t* m);
+// stops the load, waits for its thread and frees what wasn't taken
+void buffer_load_destroy(buffer_load_t* m);
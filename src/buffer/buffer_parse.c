@@ -0,0 +1,321 @@
+#include "buffer_parse.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "../dyn_strings/utf32_string.h"
+#include "../highlighter/highlighter.h"
+#include "piece_table.h"
+
+// codepoints of the text not kept as UTF-8 encoded at a time
+#define BUFFER_PARSE_PAGE_LEN 0x1000
+
+// a run of the text of a snapshot starting at `byte`, either a slice
+// of the UTF-8 original in `data` or up to a page of codepoints in
+// `text`, which is encoded once it is read
+typedef struct {
+    size_t byte;
+    size_t size;
+    const char* data;
+    const c32_t* text;
+    size_t length;
+} buffer_parse_segment_t;
+
+// reads a snapshot for tree-sitter. slices of the UTF-8 original are
+// pointed to and the rest is encoded a page at a time as it is read,
+// the last page encoded is kept in `page`
+typedef struct {
+    buffer_parse_segment_t* segments;
+    size_t segments_length;
+    size_t segments_capacity;
+    size_t size;
+    char* page;
+    const buffer_parse_segment_t* page_segment;
+} buffer_parse_input_t;
+
+typedef struct {
+    thrd_t threads[BUFFER_PARSE_WORKERS];
+    // the parse each worker is running, so it can be cancelled
+    buffer_parse_t* running[BUFFER_PARSE_WORKERS];
+    size_t threads_length;
+    mtx_t lock;
+    cnd_t is_queued;
+    buffer_parse_t* first;
+    buffer_parse_t* last;
+    bool is_stopping;
+} buffer_parse_workers_t;
+
+static buffer_parse_workers_t g_workers;
+
+__attribute__((constructor)) static void buffer_parse_setup(void) {
+    int result = mtx_init(&g_workers.lock, mtx_plain);
+    assert(result == thrd_success);
+    result = cnd_init(&g_workers.is_queued);
+    assert(result == thrd_success);
+}
+
+static void buffer_parse_input_push(buffer_parse_input_t* m,
+                                    buffer_parse_segment_t segment) {
+    size_t required_capacity =
+        (m->segments_length + 1) * sizeof(buffer_parse_segment_t);
+    while (required_capacity > m->segments_capacity) {
+        m->segments_capacity *= 2;
+        m->segments = realloc(m->segments, m->segments_capacity);
+        assert(m->segments);
+    }
+
+    segment.byte = m->size;
+    m->segments[m->segments_length++] = segment;
+    m->size += segment.size;
+}
+
+static buffer_parse_input_t buffer_parse_input_create(
+    piece_table_snapshot_t* snapshot) {
+    buffer_parse_input_t result = {
+        .segments = malloc(2 * sizeof(buffer_parse_segment_t)),
+        .segments_length = 0,
+        .segments_capacity = 2 * sizeof(buffer_parse_segment_t),
+        .size = 0,
+        .page = 0,
+        .page_segment = 0};
+    assert(result.segments);
+
+    // only the size of the pages to encode is counted here
+    for (size_t i = 0; i < snapshot->spans_length; i += 1) {
+        piece_snapshot_span_t* span = &snapshot->spans[i];
+        if (span->is_utf8) {
+            buffer_parse_input_push(
+                &result,
+                (buffer_parse_segment_t){
+                    .data = &snapshot->utf8.data[span->offset],
+                    .size = span->length});
+            continue;
+        }
+
+        const c32_t* text = span->text;
+        for (size_t pos = 0; pos < span->length;
+             pos += BUFFER_PARSE_PAGE_LEN) {
+            size_t len = span->length - pos;
+            if (len > BUFFER_PARSE_PAGE_LEN)
+                len = BUFFER_PARSE_PAGE_LEN;
+            size_t size = utf32_utf8_len(&text[pos], len);
+            buffer_parse_input_push(
+                &result, (buffer_parse_segment_t){.text = &text[pos],
+                                                  .length = len,
+                                                  .size = size});
+        }
+    }
+    return result;
+}
+
+static void buffer_parse_input_destroy(buffer_parse_input_t* m) {
+    free(m->segments);
+    free(m->page);
+}
+
+static const char* buffer_parse_read(void* payload, uint32_t byte,
+                                     TSPoint position,
+                                     uint32_t* bytes_read) {
+    (void)position;
+    buffer_parse_input_t* m = payload;
+    if (byte >= m->size) {
+        *bytes_read = 0;
+        return "";
+    }
+
+    // the last segment starting at or before `byte`
+    size_t low = 0;
+    size_t high = m->segments_length;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (m->segments[mid].byte <= byte)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    const buffer_parse_segment_t* segment = &m->segments[low];
+    size_t offset = byte - segment->byte;
+    *bytes_read = segment->size - offset;
+    if (segment->data) return &segment->data[offset];
+
+    if (m->page_segment != segment) {
+        if (!m->page) {
+            m->page = malloc(BUFFER_PARSE_PAGE_LEN * 4);
+            assert(m->page);
+        }
+        utf32_to_utf8(m->page, segment->text, segment->length);
+        m->page_segment = segment;
+    }
+    return &m->page[offset];
+}
+
+static void buffer_parse_run(buffer_parse_t* m, TSParser* parser) {
+    ts_parser_set_cancellation_flag(parser, &m->is_cancelled);
+    buffer_parse_input_t reader =
+        buffer_parse_input_create(&m->snapshot);
+    TSInput input = {.payload = &reader,
+                     .read = buffer_parse_read,
+                     .encoding = TSInputEncodingUTF8};
+
+    // without a tree to reuse every token of the view is queried
+    highlighter_t highlighter = {.tree = m->tree,
+                                 .language = m->language};
+    bool is_incremental = m->tree;
+    bool is_edited = m->rows.start <= m->rows.end;
+    bool is_parsed = true;
+    if (!is_incremental || is_edited)
+        is_parsed = hlr_highlighter_update(&highlighter, parser,
+                                           input, &m->rows);
+    if (!is_parsed)
+        ts_parser_reset(parser);
+    else if (is_incremental)
+        hlr_tokens_update_view(&highlighter, &m->tokens, input,
+                               m->rows, m->view);
+    else
+        hlr_tokens_update(&highlighter, &m->tokens, input, m->view);
+    m->tree = highlighter.tree;
+
+    ts_parser_set_cancellation_flag(parser, 0);
+    buffer_parse_input_destroy(&reader);
+}
+
+static int buffer_parse_work(void* arg) {
+    size_t worker = (size_t)arg;
+    TSParser* parser = ts_parser_new();
+
+    mtx_lock(&g_workers.lock);
+    for (;;) {
+        while (!g_workers.first && !g_workers.is_stopping)
+            cnd_wait(&g_workers.is_queued, &g_workers.lock);
+        if (g_workers.is_stopping) break;
+
+        buffer_parse_t* m = g_workers.first;
+        g_workers.first = m->next;
+        if (!g_workers.first) g_workers.last = 0;
+        m->next = 0;
+        atomic_store_explicit(&m->state, buffer_parse_state_running,
+                              memory_order_relaxed);
+        g_workers.running[worker] = m;
+        mtx_unlock(&g_workers.lock);
+
+        buffer_parse_run(m, parser);
+
+        mtx_lock(&g_workers.lock);
+        g_workers.running[worker] = 0;
+        if (m->is_abandoned)
+            buffer_parse_destroy(m);
+        else
+            atomic_store_explicit(&m->state, buffer_parse_state_done,
+                                  memory_order_release);
+    }
+    mtx_unlock(&g_workers.lock);
+
+    ts_parser_delete(parser);
+    return 0;
+}
+
+void buffer_parse_init(void) {
+    g_workers.is_stopping = false;
+    for (size_t i = 0; i < BUFFER_PARSE_WORKERS; i += 1) {
+        if (thrd_create(&g_workers.threads[g_workers.threads_length],
+                        buffer_parse_work,
+                        (void*)g_workers.threads_length) !=
+            thrd_success)
+            break;
+        g_workers.threads_length += 1;
+    }
+}
+
+void buffer_parse_terminate(void) {
+    mtx_lock(&g_workers.lock);
+    g_workers.is_stopping = true;
+    for (size_t i = 0; i < g_workers.threads_length; i += 1) {
+        buffer_parse_t* running = g_workers.running[i];
+        if (running)
+            __atomic_store_n(&running->is_cancelled, 1,
+                             __ATOMIC_RELAXED);
+    }
+    cnd_broadcast(&g_workers.is_queued);
+    mtx_unlock(&g_workers.lock);
+
+    // parses still queued stay so, they are freed when cancelled
+    for (size_t i = 0; i < g_workers.threads_length; i += 1)
+        thrd_join(g_workers.threads[i], 0);
+    g_workers.threads_length = 0;
+}
+
+buffer_parse_t* buffer_parse_start(piece_table_t* text,
+                                   enum language language,
+                                   TSTree* tree, tokens_t tokens,
+                                   hlr_rows_t rows, hlr_rows_t view) {
+    buffer_parse_t* result = calloc(1, sizeof(buffer_parse_t));
+    assert(result);
+    result->language = language;
+    result->snapshot = piece_table_snapshot_create(text);
+    result->tree = tree;
+    result->tokens = tokens;
+    result->rows = rows;
+    result->view = view;
+    atomic_init(&result->state, buffer_parse_state_queued);
+
+    mtx_lock(&g_workers.lock);
+    if (g_workers.threads_length) {
+        if (g_workers.last)
+            g_workers.last->next = result;
+        else
+            g_workers.first = result;
+        g_workers.last = result;
+        cnd_signal(&g_workers.is_queued);
+        mtx_unlock(&g_workers.lock);
+        return result;
+    }
+    mtx_unlock(&g_workers.lock);
+
+    // without workers the text is parsed before returning
+    TSParser* parser = ts_parser_new();
+    buffer_parse_run(result, parser);
+    ts_parser_delete(parser);
+    atomic_store(&result->state, buffer_parse_state_done);
+    return result;
+}
+
+bool buffer_parse_is_done(buffer_parse_t* m) {
+    return atomic_load_explicit(&m->state, memory_order_acquire) ==
+           buffer_parse_state_done;
+}
+
+void buffer_parse_destroy(buffer_parse_t* m) {
+    piece_table_snapshot_destroy(&m->snapshot);
+    ts_tree_delete(m->tree);
+    hlr_tokens_destroy(&m->tokens);
+    free(m);
+}
+
+void buffer_parse_cancel(buffer_parse_t* m) {
+    mtx_lock(&g_workers.lock);
+    enum buffer_parse_state state =
+        atomic_load_explicit(&m->state, memory_order_relaxed);
+    if (state == buffer_parse_state_running) {
+        m->is_abandoned = true;
+        __atomic_store_n(&m->is_cancelled, 1, __ATOMIC_RELAXED);
+        mtx_unlock(&g_workers.lock);
+        return;
+    }
+
+    if (state == buffer_parse_state_queued) {
+        buffer_parse_t* prev = 0;
+        for (buffer_parse_t* it = g_workers.first; it != m;
+             it = it->next)
+            prev = it;
+        if (prev)
+            prev->next = m->next;
+        else
+            g_workers.first = m->next;
+        if (g_workers.last == m) g_workers.last = prev;
+    }
+    mtx_unlock(&g_workers.lock);
+    buffer_parse_destroy(m);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "../highlighter/highlighter.h"
+#include "piece_table.h"
+
+// threads parsing in the background, each with a parser of its own
+#define BUFFER_PARSE_WORKERS 2
+
+enum buffer_parse_state {
+    buffer_parse_state_queued,
+    buffer_parse_state_running,
+    buffer_parse_state_done,
+};
+
+// a parse of a snapshot of the text, run by one of the workers. the
+// tree, edited up to the snapshot, is handed to the parse along with
+// the tokens of the text it was parsed from, and both are updated in
+// place. tokens are queried for the rows of `view` alone. results are
+// left alone once `state` is done, so they can be taken without
+// locking
+typedef struct buffer_parse {
+    struct buffer_parse* next;
+    atomic_int state;
+    // set once the parse was cancelled while running, the worker
+    // frees it when it is done
+    bool is_abandoned;
+    // set to cancel the parse, tree-sitter polls it while parsing
+    size_t is_cancelled;
+    enum language language;
+    piece_table_snapshot_t snapshot;
+    TSTree* tree;
+    tokens_t tokens;
+    // rows edited since the tree was last parsed, those the parse
+    // finds changed are added
+    hlr_rows_t rows;
+    hlr_rows_t view;
+} buffer_parse_t;
+
+void buffer_parse_init(void);
+// cancels the parses left and waits for the workers
+void buffer_parse_terminate(void);
+// takes the tree and the tokens, a parse without a tree queries every
+// token of the view. a tree without edited rows isn't parsed again,
+// only the rows the view moved to are queried. runs on the spot when
+// there are no workers
+buffer_parse_t* buffer_parse_start(piece_table_t* text,
+                                   enum language language,
+                                   TSTree* tree, tokens_t tokens,
+                                   hlr_rows_t rows, hlr_rows_t view);
+bool buffer_parse_is_done(buffer_parse_t* m);
+// frees a parse that is done, along with what wasn't taken from it
+void buffer_parse_destroy(buffer_parse_t* m);
+// stops a parse whose results are no longer wanted, it is freed once
+// its worker lets go of it
+void buffer_parse_cancel(buffer_parse_t* m);
@@ -0,0 +1,221 @@
+#include "buffer_save.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../dyn_strings/utf32_string.h"
+#include "piece_table.h"
+
+// bytes gathered before they are written
+#define BUFFER_SAVE_SCRATCH_SIZE 0x40000
+
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// the spans point into the storage the snapshot shares with the
+// text, they are gathered into a scratch so a heavily edited text
+// isn't written a few codepoints at a time. UTF-8 too large for it
+// is written as it is
+static bool buffer_save_write_text(buffer_save_t* m, int fd) {
+    piece_table_snapshot_t* snapshot = &m->snapshot;
+    char* scratch = malloc(BUFFER_SAVE_SCRATCH_SIZE);
+    assert(scratch);
+
+    size_t size = 0;
+    bool result = true;
+    for (size_t i = 0; i < snapshot->spans_length && result; i += 1) {
+        piece_snapshot_span_t* span = &snapshot->spans[i];
+        if (span->is_utf8) {
+            const char* data = &snapshot->utf8.data[span->offset];
+            if (span->length > BUFFER_SAVE_SCRATCH_SIZE - size) {
+                result = write_all(fd, scratch, size) &&
+                         write_all(fd, data, span->length);
+                size = 0;
+            } else {
+                memcpy(&scratch[size], data, span->length);
+                size += span->length;
+            }
+            continue;
+        }
+
+        for (size_t pos = 0; pos < span->length && result;) {
+            // as many codepoints as surely fit once encoded
+            size_t len = (BUFFER_SAVE_SCRATCH_SIZE - size) / 4;
+            if (len > span->length - pos) len = span->length - pos;
+            if (!len) {
+                result = write_all(fd, scratch, size);
+                size = 0;
+                continue;
+            }
+            size +=
+                utf32_to_utf8(&scratch[size], &span->text[pos], len);
+            pos += len;
+        }
+    }
+    if (result) result = write_all(fd, scratch, size);
+
+    free(scratch);
+    return result;
+}
+
+// the permissions new files get, read once before any thread starts
+// since umask can only be read by setting it
+static mode_t g_umask;
+
+__attribute__((constructor)) static void buffer_save_setup(void) {
+    g_umask = umask(0);
+    umask(g_umask);
+}
+
+// the length of the directory part of `path`, the root keeps its
+// slash
+static size_t dir_len(const char* path) {
+    const char* slash = strrchr(path, '/');
+    if (!slash) return 0;
+    return slash == path ? 1 : (size_t)(slash - path);
+}
+
+// syncs the directory holding `path` so the rename itself is durable
+static void sync_parent_dir(const char* path) {
+    size_t len = dir_len(path);
+    char dir[len + 2];
+    if (!len) {
+        strcpy(dir, ".");
+    } else {
+        memcpy(dir, path, len);
+        dir[len] = 0;
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+static bool buffer_save_write_to(buffer_save_t* m,
+                                 const char* target) {
+    // the text is written to a file of its own beside the target and
+    // then moved over it, the original text of a large file may still
+    // be mapped from the old one
+    const char* slash = strrchr(target, '/');
+    size_t prefix_len = slash ? (size_t)(slash - target) + 1 : 0;
+    size_t temp_path_size = strlen(target) + sizeof("..XXXXXX");
+    char temp_path[temp_path_size];
+    snprintf(temp_path, temp_path_size, "%.*s.%s.XXXXXX",
+             (int)prefix_len, target, &target[prefix_len]);
+
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return false;
+
+    struct stat st;
+    mode_t mode = 0666 & ~g_umask;
+    if (!stat(target, &st)) mode = st.st_mode & 07777;
+    fchmod(fd, mode);
+
+    bool result = buffer_save_write_text(m, fd) && !fsync(fd) &&
+                  !fstat(fd, &st);
+    int error = errno;
+    if (close(fd) && result) {
+        error = errno;
+        result = false;
+    }
+
+    if (result && rename(temp_path, target)) {
+        error = errno;
+        result = false;
+    }
+
+    if (!result) {
+        unlink(temp_path);
+        errno = error;
+        return false;
+    }
+
+    // renaming leaves the inode and the modification time as they are
+    m->stamp = (buffer_save_stamp_t){.dev = st.st_dev,
+                                     .ino = st.st_ino,
+                                     .size = st.st_size,
+                                     .mtime = st.st_mtim};
+    sync_parent_dir(target);
+    return true;
+}
+
+static bool buffer_save_write(buffer_save_t* m) {
+    // a link is left in place and the file it points to replaced, a
+    // path that doesn't exist yet is saved to as is
+    char* target = realpath(m->path, 0);
+    bool result = buffer_save_write_to(m, target ? target : m->path);
+    int error = errno;
+    free(target);
+    errno = error;
+    return result;
+}
+
+static int buffer_save_run(void* arg) {
+    buffer_save_t* m = arg;
+    bool is_saved = buffer_save_write(m);
+    if (!is_saved) m->error = errno;
+    atomic_store(&m->state, is_saved ? buffer_save_state_done
+                                     : buffer_save_state_failed);
+    return 0;
+}
+
+buffer_save_t* buffer_save_start(piece_table_t* text,
+                                 const char* path) {
+    buffer_save_t* result = calloc(1, sizeof(buffer_save_t));
+    assert(result);
+    result->path = strdup(path);
+    assert(result->path);
+    result->snapshot = piece_table_snapshot_create(text);
+    atomic_init(&result->state, buffer_save_state_running);
+
+    if (thrd_create(&result->thread, buffer_save_run, result) ==
+        thrd_success)
+        return result;
+
+    piece_table_snapshot_destroy(&result->snapshot);
+    free(result->path);
+    free(result);
+    return 0;
+}
+
+enum buffer_save_state buffer_save_get_state(buffer_save_t* m) {
+    return atomic_load(&m->state);
+}
+
+bool buffer_save_finish(buffer_save_t* m, int* error,
+                        buffer_save_stamp_t* stamp) {
+    thrd_join(m->thread, 0);
+    bool result = atomic_load(&m->state) == buffer_save_state_done;
+    *error = m->error;
+    *stamp = m->stamp;
+
+    piece_table_snapshot_destroy(&m->snapshot);
+    free(m->path);
+    free(m);
+    return result;
+}
+
+bool buffer_save_stamp_matches(buffer_save_stamp_t* m,
+                               const char* path) {
+    struct stat st;
+    if (!m->ino || stat(path, &st)) return false;
+    return st.st_dev == m->dev && st.st_ino == m->ino &&
+           st.st_size == m->size &&
+           st.st_mtim.tv_sec == m->mtime.tv_sec &&
+           st.st_mtim.tv_nsec == m->mtime.tv_nsec;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <threads.h>
+#include <time.h>
+
+#include "piece_table.h"
+
+enum buffer_save_state {
+    buffer_save_state_running,
+    buffer_save_state_done,
+    buffer_save_state_failed,
+};
+
+// the file as a save left it, so the change the save makes on disk
+// can be told apart from changes made by others
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} buffer_save_stamp_t;
+
+// a save running on a thread of its own. the text is snapshotted when
+// it starts, which only shares its storage, then written to a file of
+// its own beside the target, synced and then renamed over it, so the
+// target is either the old or the new text. a link is followed to the
+// file it points to
+typedef struct {
+    thrd_t thread;
+    atomic_int state;
+    piece_table_snapshot_t snapshot;
+    char* path;
+    int error;
+    buffer_save_stamp_t stamp;
+} buffer_save_t;
+
+// null if the thread couldn't be started
+buffer_save_t* buffer_save_start(piece_table_t* text,
+                                 const char* path);
+enum buffer_save_state buffer_save_get_state(buffer_save_t* m);
+// waits for the save to end and frees it, `error` is set to the errno
+// of a failed save and `stamp` to the file a successful one left
+bool buffer_save_finish(buffer_save_t* m, int* error,
+                        buffer_save_stamp_t* stamp);
+// whether the file at `path` is still as the save of `m` left it
+bool buffer_save_stamp_matches(buffer_save_stamp_t* m,
+                               const char* path);
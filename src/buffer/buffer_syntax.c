@@ -1,18 +1,39 @@
 #include "buffer_syntax.h"
 
+#include <assert.h>
 #include <fieldfusion.h>
+#include <stdlib.h>
 
 #include "../highlighter/highlighter.h"
+#include "buffer_parse.h"
+#include "piece_table.h"
 
 buffer_syntax_t buffer_syntax_create(void) {
-    return (buffer_syntax_t){
+    buffer_syntax_t result = {
+        .highlighter = {.tree = 0, .language = language_none_t},
         .tokens = hlr_tokens_create(),
-        .highlighter = hlr_highlighter_create(language_none_t, 0, 0)};
+        .back = hlr_tokens_create(),
+        .spans = hlr_spans_create(),
+        .version = 1,
+        .spans_version = 0,
+        .dirty = HLR_ROWS_EMPTY,
+        .view = {.start = 0, .end = BUFFER_SYNTAX_VIEW_ROWS - 1},
+        .parse = 0,
+        .edits = malloc(2 * sizeof(hlr_edit_t)),
+        .edits_length = 0,
+        .edits_capacity = 2 * sizeof(hlr_edit_t),
+        .is_stale = false};
+    assert(result.edits);
+    return result;
 }
 
 void buffer_syntax_destroy(buffer_syntax_t* m) {
+    if (m->parse) buffer_parse_cancel(m->parse);
     hlr_tokens_destroy(&m->tokens);
+    hlr_tokens_destroy(&m->back);
+    hlr_spans_destroy(&m->spans);
     hlr_highlighter_destroy(&m->highlighter);
+    free(m->edits);
 }
 
 void buffer_syntax_set_language(buffer_syntax_t* m,
@@ -20,18 +41,128 @@ void buffer_syntax_set_language(buffer_syntax_t* m,
     m->highlighter.language = language;
 }
 
-void buffer_syntax_update(buffer_syntax_t* m, c32_t* buffer,
-                          size_t buffer_len) {
-    assert(buffer);
+static void buffer_syntax_start(buffer_syntax_t* m,
+                                piece_table_t* text) {
+    assert(!m->parse);
+    m->is_stale = false;
+
+    // the parse keeps the tokens out of the rows it queries, a parse
+    // without a tree queries them all
+    if (m->highlighter.tree)
+        hlr_tokens_copy(&m->back, &m->tokens);
+    m->parse = buffer_parse_start(text, m->highlighter.language,
+                                  m->highlighter.tree, m->back,
+                                  m->dirty, m->view);
+    m->highlighter.tree = 0;
+    m->back = (tokens_t){0};
+    m->dirty = HLR_ROWS_EMPTY;
+}
+
+void buffer_syntax_update(buffer_syntax_t* m, piece_table_t* text) {
+    assert(text);
     if (m->highlighter.language == language_none_t) return;
+    if (hlr_language_is_missing(m->highlighter.language)) return;
+    // a mapped large file would be parsed whole on every edit
+    if (piece_table_is_mapped(text)) return;
 
-    char utf8_buffer[buffer_len + 1];
-    utf8_buffer[buffer_len] = 0;
+    m->is_stale = true;
+    if (!m->parse) buffer_syntax_start(m, text);
+}
+
+static bool buffer_syntax_is_within(hlr_rows_t rows,
+                                    hlr_rows_t within) {
+    return rows.start >= within.start && rows.end <= within.end;
+}
 
-    int conv_failed =
-        ff_utf32_to_utf8(utf8_buffer, buffer, buffer_len);
-    assert(conv_failed != (size_t)-1);
+void buffer_syntax_poll(buffer_syntax_t* m, piece_table_t* text,
+                        hlr_rows_t visible) {
+    // the rows queried reach a screen past those shown, so scrolling
+    // has a while before it runs out of them
+    if (visible.start <= visible.end &&
+        !buffer_syntax_is_within(visible, m->view)) {
+        ulong margin = visible.end - visible.start + 1;
+        m->view.start =
+            visible.start > margin ? visible.start - margin : 0;
+        m->view.end = visible.end + margin;
+    }
+
+    if (m->parse && buffer_parse_is_done(m->parse)) {
+        buffer_parse_t* parse = m->parse;
+        m->parse = 0;
+
+        // the parse saw the text as it was when it started
+        m->highlighter.tree = parse->tree;
+        parse->tree = 0;
+        for (size_t i = 0; i < m->edits_length; i += 1) {
+            hlr_highlighter_edit(&m->highlighter, &m->edits[i]);
+            hlr_tokens_edit(&parse->tokens, &m->edits[i]);
+        }
+        m->edits_length = 0;
+
+        m->back = m->tokens;
+        m->tokens = parse->tokens;
+        m->version += 1;
+        parse->tokens = (tokens_t){0};
+        buffer_parse_destroy(parse);
+    }
+
+    if (m->parse) return;
+    if (m->is_stale ||
+        (m->highlighter.tree &&
+         !buffer_syntax_is_within(m->view, m->tokens.rows)))
+        buffer_syntax_start(m, text);
+}
+
+bool buffer_syntax_is_parsed(buffer_syntax_t* m) {
+    return m->highlighter.tree || m->parse;
+}
+
+void buffer_syntax_edit(buffer_syntax_t* m, const hlr_edit_t* edit) {
+    hlr_tokens_edit(&m->tokens, edit);
+    m->version += 1;
+    hlr_rows_edit(&m->dirty, edit);
+    hlr_rows_move(&m->view, edit);
+    if (!m->parse) {
+        hlr_highlighter_edit(&m->highlighter, edit);
+        return;
+    }
+
+    size_t required_capacity =
+        (m->edits_length + 1) * sizeof(hlr_edit_t);
+    while (required_capacity > m->edits_capacity) {
+        m->edits_capacity *= 2;
+        m->edits = realloc(m->edits, m->edits_capacity);
+        assert(m->edits);
+    }
+    m->edits[m->edits_length++] = *edit;
+}
+
+void buffer_syntax_reset(buffer_syntax_t* m) {
+    if (m->parse) buffer_parse_cancel(m->parse);
+    m->parse = 0;
+    // the tokens the parse held are gone with it
+    if (!m->back.data) m->back = hlr_tokens_create();
+    hlr_highlighter_destroy(&m->highlighter);
+    m->highlighter.tree = 0;
+    m->tokens.length = 0;
+    m->tokens.rows = HLR_ROWS_EMPTY;
+    m->version += 1;
+    m->dirty = HLR_ROWS_EMPTY;
+    m->edits_length = 0;
+    m->is_stale = false;
+}
+
+const hlr_span_t* buffer_syntax_get_spans(buffer_syntax_t* m,
+                                          ulong row, ulong* length) {
+    if (m->spans_version != m->version) {
+        hlr_spans_update(&m->spans, &m->tokens);
+        m->spans_version = m->version;
+    }
+    return hlr_spans_get(&m->spans, row, length);
+}
 
-    hlr_highlighter_update(&m->highlighter, utf8_buffer, buffer_len);
-    hlr_tokens_update(&m->highlighter, &m->tokens);
+size_t buffer_syntax_get_size(buffer_syntax_t* m) {
+    return m->tokens.capacity + m->back.capacity +
+           m->spans.capacity + m->spans.first_capacity +
+           m->edits_capacity;
 }
@@ -3,15 +3,60 @@
 #include <fieldfusion.h>
 
 #include "../highlighter/highlighter.h"
+#include "buffer_parse.h"
+#include "piece_table.h"
 
+// rows queried before a view tells which ones it shows
+#define BUFFER_SYNTAX_VIEW_ROWS 0x100
+
+// the text is parsed in the background. the tree is handed to the
+// parse while it runs and the edits made meanwhile are kept to be
+// applied to what it hands back. `tokens` are shown while the parse
+// writes `back`, the two are swapped once it is done. tokens are held
+// for the rows around the ones shown alone
 typedef struct {
     highlighter_t highlighter;
     tokens_t tokens;
+    tokens_t back;
+    // bumped whenever `tokens` change, the spans are laid out again
+    // once they fall behind
+    size_t version;
+    hlr_spans_t spans;
+    size_t spans_version;
+    // rows edited since the last parse was started
+    hlr_rows_t dirty;
+    // rows the next parse queries
+    hlr_rows_t view;
+    buffer_parse_t* parse;
+    hlr_edit_t* edits;
+    size_t edits_length;
+    size_t edits_capacity;
+    // set when the text changed since the last parse was started
+    bool is_stale;
 } buffer_syntax_t;
 
 buffer_syntax_t buffer_syntax_create(void);
 void buffer_syntax_destroy(buffer_syntax_t* m);
 void buffer_syntax_set_language(buffer_syntax_t* m,
                                 enum language language);
-void buffer_syntax_update(buffer_syntax_t* m, c32_t* buffer,
-                          size_t buffer_len);
+// called once the text changed, a parse is started unless one is
+// already running
+void buffer_syntax_update(buffer_syntax_t* m, piece_table_t* text);
+// takes the results of a parse that is done and starts the next one
+// if the text changed meanwhile or `visible` went past the rows
+// queried. called every frame with the rows shown
+void buffer_syntax_poll(buffer_syntax_t* m, piece_table_t* text,
+                        hlr_rows_t visible);
+// whether a tree of the text exists or is being made, which has to be
+// told about every edit
+bool buffer_syntax_is_parsed(buffer_syntax_t* m);
+// keeps the tree and tokens in step with an edit of the text, the
+// tokens it touched are queried again on the next parse
+void buffer_syntax_edit(buffer_syntax_t* m, const hlr_edit_t* edit);
+// drops the tree and the tokens once the whole text was replaced, so
+// the next update parses it from scratch
+void buffer_syntax_reset(buffer_syntax_t* m);
+// the spans of the tokens shown on `row`
+const hlr_span_t* buffer_syntax_get_spans(buffer_syntax_t* m,
+                                          ulong row, ulong* length);
+size_t buffer_syntax_get_size(buffer_syntax_t* m);
@@ -0,0 +1,938 @@
+#include "piece_table.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "../dyn_strings/utf32_string.h"
+
+// per thread, tables are also built by the loader threads
+static thread_local unsigned g_priority_seed = 0x9e3779b9;
+
+// large files are mapped, and a mapped file another program cuts
+// short raises SIGBUS once the pages past its new end are read. the
+// mappings are kept here for the handler to tell their faults apart,
+// the handler is only installed while there are any
+#define PIECE_MAPPINGS_CAP 64
+
+struct piece_mapping {
+    _Atomic(uintptr_t) start;
+    atomic_size_t size;
+    atomic_bool is_damaged;
+    // kept open to check the file for changes
+    int fd;
+    struct timespec mtime;
+};
+
+static piece_mapping_t g_mappings[PIECE_MAPPINGS_CAP];
+static struct sigaction g_sigbus_fallback;
+static uintptr_t g_page_size;
+// guards taking and releasing slots along with the handler
+static once_flag g_mappings_once = ONCE_FLAG_INIT;
+static mtx_t g_mappings_lock;
+static size_t g_mappings_count;
+
+static void piece_mapping_on_sigbus(int sig, siginfo_t* info,
+                                    void* context) {
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    for (size_t i = 0; i < PIECE_MAPPINGS_CAP; i += 1) {
+        piece_mapping_t* mapping = &g_mappings[i];
+        uintptr_t start = atomic_load(&mapping->start);
+        size_t size = atomic_load(&mapping->size);
+        if (!start || addr < start || addr - start >= size) continue;
+
+        // what was cut off reads as zeros from here on, the read
+        // that faulted is retried once this returns. mmap isn't
+        // async-signal-safe by POSIX, on Linux it is a plain system
+        // call that takes no lock in user space and that is relied on
+        // here deliberately
+        uintptr_t page = addr & ~(g_page_size - 1);
+        void* zeros =
+            mmap((void*)page, start + size - page, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        atomic_store(&mapping->is_damaged, true);
+        if (zeros != MAP_FAILED) return;
+        break;
+    }
+
+    // any other fault is left to whoever handled it before, by
+    // default it repeats and ends the process once this returns
+    if (g_sigbus_fallback.sa_flags & SA_SIGINFO) {
+        g_sigbus_fallback.sa_sigaction(sig, info, context);
+        return;
+    }
+    if (g_sigbus_fallback.sa_handler != SIG_DFL &&
+        g_sigbus_fallback.sa_handler != SIG_IGN) {
+        g_sigbus_fallback.sa_handler(sig);
+        return;
+    }
+    signal(SIGBUS, SIG_DFL);
+}
+
+static void piece_mapping_setup(void) {
+    g_page_size = sysconf(_SC_PAGESIZE);
+    int result = mtx_init(&g_mappings_lock, mtx_plain);
+    assert(result == thrd_success);
+}
+
+// takes `fd`, null if every slot is taken. the first mapping installs
+// the handler, whatever handled SIGBUS before is kept to fall back to
+static piece_mapping_t* piece_mapping_register(const void* data,
+                                               size_t size, int fd,
+                                               struct stat* st) {
+    call_once(&g_mappings_once, piece_mapping_setup);
+    mtx_lock(&g_mappings_lock);
+
+    piece_mapping_t* result = 0;
+    for (size_t i = 0; i < PIECE_MAPPINGS_CAP && !result; i += 1) {
+        if (!atomic_load(&g_mappings[i].start))
+            result = &g_mappings[i];
+    }
+
+    if (result) {
+        atomic_store(&result->is_damaged, false);
+        result->fd = fd;
+        result->mtime = st->st_mtim;
+        atomic_store(&result->size, size);
+        atomic_store(&result->start, (uintptr_t)data);
+    }
+
+    if (result && !g_mappings_count++) {
+        struct sigaction action = {
+            .sa_sigaction = piece_mapping_on_sigbus,
+            .sa_flags = SA_SIGINFO};
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, &g_sigbus_fallback);
+    }
+
+    mtx_unlock(&g_mappings_lock);
+    return result;
+}
+
+// the last mapping puts back the handler from before, unless another
+// one replaced it since
+static void piece_mapping_unregister(piece_mapping_t* m) {
+    mtx_lock(&g_mappings_lock);
+    close(m->fd);
+    atomic_store(&m->size, 0);
+    atomic_store(&m->start, 0);
+
+    assert(g_mappings_count);
+    struct sigaction current;
+    if (!--g_mappings_count && !sigaction(SIGBUS, 0, &current) &&
+        (current.sa_flags & SA_SIGINFO) &&
+        current.sa_sigaction == piece_mapping_on_sigbus)
+        sigaction(SIGBUS, &g_sigbus_fallback, 0);
+    mtx_unlock(&g_mappings_lock);
+}
+
+static unsigned piece_priority(void) {
+    // xorshift32, treap priorities only need to be well spread
+    g_priority_seed ^= g_priority_seed << 13;
+    g_priority_seed ^= g_priority_seed >> 17;
+    g_priority_seed ^= g_priority_seed << 5;
+    return g_priority_seed;
+}
+
+static size_t piece_node_length(piece_node_t* n) {
+    return n ? n->subtree_length : 0;
+}
+
+static void piece_node_update(piece_node_t* n) {
+    n->subtree_length = piece_node_length(n->left) + n->length +
+                        piece_node_length(n->right);
+}
+
+static piece_node_t* piece_node_create(enum piece_source source,
+                                       size_t offset, size_t length) {
+    piece_node_t* result = calloc(1, sizeof(piece_node_t));
+    assert(result);
+    result->priority = piece_priority();
+    result->source = source;
+    result->offset = offset;
+    result->length = length;
+    result->subtree_length = length;
+    return result;
+}
+
+static void piece_node_destroy(piece_node_t* n) {
+    if (!n) return;
+    piece_node_destroy(n->left);
+    piece_node_destroy(n->right);
+    free(n);
+}
+
+static void piece_node_split(piece_node_t* n, size_t pos,
+                             piece_node_t** l, piece_node_t** r) {
+    if (!n) {
+        *l = 0;
+        *r = 0;
+        return;
+    }
+
+    size_t left_len = piece_node_length(n->left);
+
+    if (pos <= left_len) {
+        piece_node_split(n->left, pos, l, &n->left);
+        piece_node_update(n);
+        *r = n;
+        return;
+    }
+
+    if (pos >= left_len + n->length) {
+        piece_node_split(n->right, pos - left_len - n->length,
+                         &n->right, r);
+        piece_node_update(n);
+        *l = n;
+        return;
+    }
+
+    // the split point falls inside this piece, cut it in two. the
+    // tail keeps the priority of the head so it stays above every
+    // node of the right subtree it inherits
+    size_t cut = pos - left_len;
+    piece_node_t* tail = piece_node_create(n->source, n->offset + cut,
+                                           n->length - cut);
+    tail->priority = n->priority;
+    tail->right = n->right;
+    piece_node_update(tail);
+
+    n->length = cut;
+    n->right = 0;
+    piece_node_update(n);
+
+    *l = n;
+    *r = tail;
+}
+
+static piece_node_t* piece_node_merge(piece_node_t* l,
+                                      piece_node_t* r) {
+    if (!l) return r;
+    if (!r) return l;
+
+    if (l->priority > r->priority) {
+        l->right = piece_node_merge(l->right, r);
+        piece_node_update(l);
+        return l;
+    }
+
+    r->left = piece_node_merge(l, r->left);
+    piece_node_update(r);
+    return r;
+}
+
+// length of a UTF-8 sequence from its first byte
+static size_t utf8_lead_len(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    return lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : 2;
+}
+
+// length of the UTF-8 sequence at `str`, 0 if it is malformed
+static size_t utf8_sequence_len(const unsigned char* str,
+                                size_t size) {
+    unsigned char lead = str[0];
+    if (lead < 0x80) return 1;
+
+    size_t len = utf8_lead_len(lead);
+    if (lead < 0xc2 || lead > 0xf4 || len > size) return 0;
+    for (size_t i = 1; i < len; i += 1)
+        if ((str[i] & 0xc0) != 0x80) return 0;
+
+    // overlong, surrogate and out of range encodings
+    if (lead == 0xe0 && str[1] < 0xa0) return 0;
+    if (lead == 0xed && str[1] > 0x9f) return 0;
+    if (lead == 0xf0 && str[1] < 0x90) return 0;
+    if (lead == 0xf4 && str[1] > 0x8f) return 0;
+    return len;
+}
+
+static void piece_utf8_push_page(piece_utf8_t* m, size_t* capacity,
+                                 size_t offset) {
+    size_t required_capacity = (m->pages_length + 1) * sizeof(size_t);
+
+    while (required_capacity > *capacity) {
+        *capacity *= 2;
+        m->page_offsets = realloc(m->page_offsets, *capacity);
+        assert(m->page_offsets);
+    }
+
+    m->page_offsets[m->pages_length++] = offset;
+}
+
+// validates the bytes while sampling where every page starts, the
+// bytes are only counted here and decoded once they are read.
+// `progress` follows the bytes validated so far if it is set
+static bool piece_utf8_index(piece_utf8_t* m,
+                             atomic_size_t* progress) {
+    size_t capacity = 2 * sizeof(size_t);
+    m->page_offsets = malloc(capacity);
+    assert(m->page_offsets);
+
+    const unsigned char* data = (const unsigned char*)m->data;
+    for (size_t i = 0; i < m->size;) {
+        if (m->length % PIECE_PAGE_LEN == 0) {
+            piece_utf8_push_page(m, &capacity, i);
+            if (progress)
+                atomic_store_explicit(progress, i,
+                                      memory_order_relaxed);
+        }
+
+        size_t len = utf8_sequence_len(&data[i], m->size - i);
+        if (!len) return false;
+        i += len;
+        m->length += 1;
+    }
+
+    // the end of the last page, not counted as a page
+    piece_utf8_push_page(m, &capacity, m->size);
+    m->pages_length -= 1;
+
+    // small texts only get as many pages as they can fill
+    m->cache_length = m->pages_length < PIECE_PAGE_CACHE_LEN
+                          ? m->pages_length
+                          : PIECE_PAGE_CACHE_LEN;
+    if (!m->cache_length) return true;
+
+    size_t page_len =
+        m->length < PIECE_PAGE_LEN ? m->length : PIECE_PAGE_LEN;
+    m->cache = malloc(m->cache_length * sizeof(piece_page_t));
+    c32_t* pages = malloc(m->cache_length * page_len * sizeof(c32_t));
+    assert(m->cache);
+    assert(pages);
+    for (size_t i = 0; i < m->cache_length; i += 1)
+        m->cache[i] = (piece_page_t){.page = (size_t)-1,
+                                     .last_used = 0,
+                                     .data = &pages[i * page_len]};
+    return true;
+}
+
+// drops a reference to the bytes, the last one releases them
+static void piece_utf8_release(piece_utf8_t* m) {
+    if (!m->refs || atomic_fetch_sub(m->refs, 1) > 1) return;
+    if (m->mapping) {
+        piece_mapping_unregister(m->mapping);
+        munmap((void*)m->data, m->size);
+    } else
+        free((void*)m->data);
+    free(m->refs);
+}
+
+// takes `str` as codepoints only the table refers to for now
+static piece_utf32_t piece_utf32_create(utf32_str_t str) {
+    piece_utf32_t result = {.data = str.data,
+                            .length = str.length,
+                            .capacity = str.capacity,
+                            .refs = malloc(sizeof(atomic_uint))};
+    assert(result.refs);
+    atomic_init(result.refs, 1);
+    return result;
+}
+
+// a reference for a snapshot, it keeps the length `m` has now
+static piece_utf32_t piece_utf32_share(piece_utf32_t* m) {
+    atomic_fetch_add(m->refs, 1);
+    return (piece_utf32_t){.data = m->data,
+                           .length = m->length,
+                           .capacity = m->capacity,
+                           .refs = m->refs};
+}
+
+// drops a reference to the codepoints, the last one frees them
+static void piece_utf32_release(piece_utf32_t* m) {
+    if (!m->refs || atomic_fetch_sub(m->refs, 1) > 1) return;
+    free(m->data);
+    free(m->refs);
+}
+
+static void piece_utf8_destroy(piece_utf8_t* m) {
+    piece_utf8_release(m);
+    if (m->cache_length) free(m->cache[0].data);
+    free(m->page_offsets);
+    free(m->cache);
+    memset(m, 0, sizeof(piece_utf8_t));
+}
+
+static const c32_t* piece_utf8_page(piece_utf8_t* m, size_t page) {
+    assert(page < m->pages_length);
+
+    piece_page_t* slot = &m->cache[0];
+    for (size_t i = 0; i < m->cache_length; i += 1) {
+        if (m->cache[i].page == page) {
+            m->cache[i].last_used = ++m->clock;
+            return m->cache[i].data;
+        }
+        if (m->cache[i].last_used < slot->last_used)
+            slot = &m->cache[i];
+    }
+
+    // the bytes were validated when the text was indexed, but a
+    // mapped file can be rewritten since. the page is decoded to its
+    // length whatever they hold now, anything malformed reads as
+    // U+FFFD
+    const unsigned char* str =
+        (const unsigned char*)&m->data[m->page_offsets[page]];
+    const unsigned char* end =
+        (const unsigned char*)&m->data[m->page_offsets[page + 1]];
+    size_t page_len = m->length - page * PIECE_PAGE_LEN;
+    if (page_len > PIECE_PAGE_LEN) page_len = PIECE_PAGE_LEN;
+    c32_t* out = slot->data;
+    for (size_t i = 0; i < page_len; i += 1) {
+        size_t len =
+            str < end ? utf8_sequence_len(str, end - str) : 0;
+        if (!len) {
+            out[i] = 0xfffd;
+            str += str < end;
+            continue;
+        }
+
+        unsigned chr = *str++;
+        if (chr >= 0x80) {
+            chr &= 0x7f >> len;
+            for (size_t ii = 1; ii < len; ii += 1)
+                chr = chr << 6 | (*str++ & 0x3f);
+        }
+        out[i] = chr;
+    }
+
+    slot->page = page;
+    slot->last_used = ++m->clock;
+    return slot->data;
+}
+
+// byte offset of codepoint `pos`, found from the page it falls in.
+// kept within the page should the bytes have changed under a mapping
+static size_t piece_utf8_byte_offset(piece_utf8_t* m, size_t pos) {
+    if (pos == m->length) return m->size;
+
+    const unsigned char* data = (const unsigned char*)m->data;
+    size_t page = pos / PIECE_PAGE_LEN;
+    size_t result = m->page_offsets[page];
+    size_t end = m->page_offsets[page + 1];
+    for (size_t i = pos % PIECE_PAGE_LEN; i && result < end; i -= 1)
+        result += utf8_lead_len(data[result]);
+    return result < end ? result : end;
+}
+
+// the text of `n` from `offset` on, `available` is set to how many
+// codepoints are contiguous from there
+static const c32_t* piece_data(piece_table_t* m, piece_node_t* n,
+                               size_t offset, size_t* available) {
+    *available = n->length - offset;
+    size_t pos = n->offset + offset;
+    if (n->source == piece_source_add) return &m->add.data[pos];
+    if (!m->utf8.data) return &m->original.data[pos];
+
+    size_t in_page = pos % PIECE_PAGE_LEN;
+    if (*available > PIECE_PAGE_LEN - in_page)
+        *available = PIECE_PAGE_LEN - in_page;
+    const c32_t* page =
+        piece_utf8_page(&m->utf8, pos / PIECE_PAGE_LEN);
+    return &page[in_page];
+}
+
+static piece_node_t* piece_table_find_piece(piece_table_t* m,
+                                            size_t pos,
+                                            size_t* offset_in_piece) {
+    piece_node_t* n = m->root;
+    while (n) {
+        size_t left_len = piece_node_length(n->left);
+        if (pos < left_len) {
+            n = n->left;
+        } else if (pos < left_len + n->length) {
+            *offset_in_piece = pos - left_len;
+            return n;
+        } else {
+            pos -= left_len + n->length;
+            n = n->right;
+        }
+    }
+    return 0;
+}
+
+static void piece_table_add_append(piece_table_t* m, const c32_t* str,
+                                   size_t len) {
+    piece_utf32_t* add = &m->add;
+    size_t required_capacity = (add->length + len) * sizeof(c32_t);
+
+    size_t capacity = add->capacity;
+    while (required_capacity > capacity) capacity *= 2;
+
+    // only the table takes new references, so once it holds the last
+    // one nothing else can be reading the block
+    if (capacity != add->capacity && atomic_load(add->refs) == 1) {
+        add->data = realloc(add->data, capacity);
+        assert(add->data);
+        add->capacity = capacity;
+    } else if (capacity != add->capacity) {
+        // a snapshot still reads the block, it is left to the
+        // snapshot and the table goes on with a copy
+        c32_t* data = malloc(capacity);
+        assert(data);
+        memcpy(data, add->data, add->length * sizeof(c32_t));
+        utf32_str_t str = {.data = data,
+                           .length = add->length,
+                           .capacity = capacity};
+        piece_utf32_release(add);
+        *add = piece_utf32_create(str);
+    }
+
+    memcpy(&add->data[add->length], str, len * sizeof(c32_t));
+    add->length += len;
+}
+
+// grows the last piece of `n` by `len` if it ends at the tail of the
+// add buffer, which is what consecutive keystrokes produce
+static bool piece_node_try_extend_last(piece_table_t* m,
+                                       piece_node_t* n, size_t len) {
+    if (!n) return false;
+
+    bool extended = false;
+    if (n->right) {
+        extended = piece_node_try_extend_last(m, n->right, len);
+    } else if (n->source == piece_source_add &&
+               n->offset + n->length == m->add.length) {
+        n->length += len;
+        extended = true;
+    }
+
+    if (extended) n->subtree_length += len;
+    return extended;
+}
+
+piece_table_t piece_table_create(utf32_str_t original) {
+    piece_table_t result = {
+        .original = piece_utf32_create(original),
+        .add = piece_utf32_create(utf32_str_create()),
+        .root = 0,
+        .length = original.length};
+    if (original.length)
+        result.root = piece_node_create(piece_source_original, 0,
+                                        original.length);
+    return result;
+}
+
+void piece_table_destroy(piece_table_t* m) {
+    piece_node_destroy(m->root);
+    piece_utf8_destroy(&m->utf8);
+    piece_utf32_release(&m->original);
+    piece_utf32_release(&m->add);
+    memset(m, 0, sizeof(piece_table_t));
+}
+
+void piece_table_reset(piece_table_t* m, utf32_str_t original) {
+    piece_table_destroy(m);
+    *m = piece_table_create(original);
+}
+
+// indexes `utf8` and makes it the original text, `utf8` is left for
+// the caller to release if it isn't valid
+static bool piece_table_reset_with_utf8(piece_table_t* m,
+                                        piece_utf8_t utf8,
+                                        atomic_size_t* progress) {
+    if (!piece_utf8_index(&utf8, progress)) {
+        free(utf8.page_offsets);
+        return false;
+    }
+
+    utf8.refs = malloc(sizeof(atomic_uint));
+    assert(utf8.refs);
+    atomic_init(utf8.refs, 1);
+
+    piece_table_reset(m, utf32_str_create());
+    m->utf8 = utf8;
+    m->length = utf8.length;
+    if (utf8.length)
+        m->root = piece_node_create(piece_source_original, 0,
+                                    utf8.length);
+    return true;
+}
+
+bool piece_table_reset_utf8(piece_table_t* m, char* data,
+                            size_t size, atomic_size_t* progress) {
+    piece_utf8_t utf8 = {.data = data, .size = size};
+    return piece_table_reset_with_utf8(m, utf8, progress);
+}
+
+bool piece_table_reset_mapped(piece_table_t* m, const char* path,
+                              atomic_size_t* progress) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    piece_mapping_t* mapping =
+        piece_mapping_register(data, st.st_size, fd, &st);
+    if (!mapping) {
+        close(fd);
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    piece_utf8_t utf8 = {
+        .data = data, .size = st.st_size, .mapping = mapping};
+    if (piece_table_reset_with_utf8(m, utf8, progress)) return true;
+
+    piece_mapping_unregister(mapping);
+    munmap(data, st.st_size);
+    return false;
+}
+
+bool piece_table_is_mapped(piece_table_t* m) {
+    return m->utf8.mapping;
+}
+
+bool piece_table_is_mapping_stale(piece_table_t* m) {
+    piece_mapping_t* mapping = m->utf8.mapping;
+    if (!mapping) return false;
+    if (atomic_load(&mapping->is_damaged)) return true;
+
+    // the file itself, wherever it was moved to since
+    struct stat st;
+    if (fstat(mapping->fd, &st)) return true;
+    return (size_t)st.st_size != m->utf8.size ||
+           st.st_mtim.tv_sec != mapping->mtime.tv_sec ||
+           st.st_mtim.tv_nsec != mapping->mtime.tv_nsec;
+}
+
+size_t piece_table_get_size(piece_table_t* m) {
+    piece_utf8_t* utf8 = &m->utf8;
+    size_t result = m->original.capacity + m->add.capacity +
+                    (utf8->pages_length + 1) * sizeof(size_t);
+    if (!utf8->mapping) result += utf8->size;
+    if (utf8->cache_length) {
+        size_t page_len = utf8->length < PIECE_PAGE_LEN
+                              ? utf8->length
+                              : PIECE_PAGE_LEN;
+        result += utf8->cache_length *
+                  (sizeof(piece_page_t) + page_len * sizeof(c32_t));
+    }
+    return result;
+}
+
+const char* piece_table_utf8_bytes(piece_table_t* m, size_t* size) {
+    piece_node_t* n = m->root;
+    if (!m->utf8.data || !n) return 0;
+    if (n->left || n->right || n->source != piece_source_original ||
+        n->offset || n->length != m->utf8.length)
+        return 0;
+
+    *size = m->utf8.size;
+    return m->utf8.data;
+}
+
+void piece_table_insert(piece_table_t* m, size_t pos,
+                        const c32_t* str, size_t len) {
+    assert(pos <= m->length);
+    if (!len) return;
+
+    piece_node_t* l = 0;
+    piece_node_t* r = 0;
+    piece_node_split(m->root, pos, &l, &r);
+
+    if (!piece_node_try_extend_last(m, l, len)) {
+        piece_node_t* piece =
+            piece_node_create(piece_source_add, m->add.length, len);
+        l = piece_node_merge(l, piece);
+    }
+    piece_table_add_append(m, str, len);
+
+    m->root = piece_node_merge(l, r);
+    m->length += len;
+}
+
+void piece_table_delete(piece_table_t* m, size_t pos, size_t count) {
+    if (!count || !m->length) return;
+    assert(pos + count <= m->length);
+
+    piece_node_t* l = 0;
+    piece_node_t* mid = 0;
+    piece_node_t* r = 0;
+    piece_node_split(m->root, pos, &l, &r);
+    piece_node_split(r, count, &mid, &r);
+    piece_node_destroy(mid);
+
+    m->root = piece_node_merge(l, r);
+    m->length -= count;
+}
+
+c32_t piece_table_char_at(piece_table_t* m, size_t pos) {
+    if (pos >= m->length) return 0;
+
+    size_t offset = 0;
+    piece_node_t* n = piece_table_find_piece(m, pos, &offset);
+    assert(n);
+    size_t available = 0;
+    return *piece_data(m, n, offset, &available);
+}
+
+size_t piece_table_read(piece_table_t* m, size_t pos, size_t len,
+                        c32_t* dest) {
+    piece_table_iter_t it =
+        piece_table_iter_create(m, pos, pos + len);
+
+    size_t result = 0;
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len)) {
+        memcpy(&dest[result], chunk, chunk_len * sizeof(c32_t));
+        result += chunk_len;
+    }
+
+    return result;
+}
+
+void piece_table_copy_to_utf32(piece_table_t* m, utf32_str_t* dest) {
+    size_t required_capacity = m->length * sizeof(c32_t);
+
+    while (required_capacity > dest->capacity) {
+        dest->capacity *= 2;
+        dest->data = realloc(dest->data, dest->capacity);
+        assert(dest->data);
+    }
+
+    dest->length = piece_table_read(m, 0, m->length, dest->data);
+}
+
+size_t piece_table_find(piece_table_t* m, const c32_t* substr,
+                        size_t substr_len, size_t from) {
+    assert(substr);
+    assert(substr_len);
+    if (from >= m->length || substr_len > m->length - from)
+        return (size_t)-1;
+
+    piece_table_iter_t it =
+        piece_table_iter_create(m, from, m->length);
+
+    size_t chunk_pos = from;
+    const c32_t* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_iter_next(&it, &chunk, &chunk_len)) {
+        for (size_t i = 0; i < chunk_len; i += 1) {
+            if (chunk[i] != substr[0]) continue;
+
+            size_t match_pos = chunk_pos + i;
+            if (substr_len > m->length - match_pos) return (size_t)-1;
+
+            bool found = true;
+            if (i + substr_len <= chunk_len) {
+                found = !memcmp(&chunk[i], substr,
+                                substr_len * sizeof(c32_t));
+            } else {
+                // the candidate straddles a piece boundary
+                for (size_t ii = 1; ii < substr_len && found; ii += 1)
+                    found = piece_table_char_at(m, match_pos + ii) ==
+                            substr[ii];
+            }
+
+            if (found) return match_pos;
+        }
+        chunk_pos += chunk_len;
+    }
+
+    return (size_t)-1;
+}
+
+piece_table_iter_t piece_table_iter_create(piece_table_t* m,
+                                           size_t from, size_t to) {
+    if (to > m->length) to = m->length;
+    if (from > to) from = to;
+    return (piece_table_iter_t){.table = m, .pos = from, .end = to};
+}
+
+bool piece_table_iter_next(piece_table_iter_t* it,
+                           const c32_t** chunk, size_t* chunk_len) {
+    if (it->pos >= it->end) return false;
+
+    size_t offset = 0;
+    piece_node_t* n =
+        piece_table_find_piece(it->table, it->pos, &offset);
+    assert(n);
+
+    size_t len = 0;
+    *chunk = piece_data(it->table, n, offset, &len);
+    if (len > it->end - it->pos) len = it->end - it->pos;
+    *chunk_len = len;
+    it->pos += len;
+    return true;
+}
+
+piece_table_utf8_iter_t piece_table_utf8_iter_create(piece_table_t* m,
+                                                     size_t from,
+                                                     size_t to) {
+    piece_table_iter_t it = piece_table_iter_create(m, from, to);
+    return (piece_table_utf8_iter_t){
+        .table = m, .pos = it.pos, .end = it.end, .scratch = 0};
+}
+
+void piece_table_utf8_iter_destroy(piece_table_utf8_iter_t* it) {
+    free(it->scratch);
+    it->scratch = 0;
+}
+
+bool piece_table_utf8_iter_next(piece_table_utf8_iter_t* it,
+                                const char** chunk,
+                                size_t* chunk_len) {
+    if (it->pos >= it->end) return false;
+
+    piece_table_t* m = it->table;
+    size_t offset = 0;
+    piece_node_t* n = piece_table_find_piece(m, it->pos, &offset);
+    assert(n);
+
+    size_t len = n->length - offset;
+    if (len > it->end - it->pos) len = it->end - it->pos;
+
+    if (n->source == piece_source_original && m->utf8.data) {
+        size_t pos = n->offset + offset;
+        size_t begin = piece_utf8_byte_offset(&m->utf8, pos);
+        size_t end = piece_utf8_byte_offset(&m->utf8, pos + len);
+        *chunk = &m->utf8.data[begin];
+        *chunk_len = end - begin;
+        it->pos += len;
+        return true;
+    }
+
+    // encoded a page at a time so `scratch` has a fixed size
+    if (len > PIECE_PAGE_LEN) len = PIECE_PAGE_LEN;
+    if (!it->scratch) {
+        it->scratch = malloc(PIECE_PAGE_LEN * 4);
+        assert(it->scratch);
+    }
+
+    size_t available = 0;
+    const c32_t* data = piece_data(m, n, offset, &available);
+    *chunk = it->scratch;
+    *chunk_len = utf32_to_utf8(it->scratch, data, len);
+    it->pos += len;
+    return true;
+}
+
+char* piece_table_read_utf8(piece_table_t* m, size_t pos, size_t len,
+                            size_t* size) {
+    size_t result_size = 0;
+    size_t capacity = len + 1;
+    char* result = malloc(capacity);
+    assert(result);
+
+    piece_table_utf8_iter_t it =
+        piece_table_utf8_iter_create(m, pos, pos + len);
+    const char* chunk = 0;
+    size_t chunk_len = 0;
+    while (piece_table_utf8_iter_next(&it, &chunk, &chunk_len)) {
+        size_t required_capacity = result_size + chunk_len + 1;
+        while (required_capacity > capacity) {
+            capacity *= 2;
+            result = realloc(result, capacity);
+            assert(result);
+        }
+        memcpy(&result[result_size], chunk, chunk_len);
+        result_size += chunk_len;
+    }
+    piece_table_utf8_iter_destroy(&it);
+
+    result[result_size] = 0;
+    if (size) *size = result_size;
+    return result;
+}
+
+static void piece_snapshot_push(piece_table_snapshot_t* m,
+                                piece_snapshot_span_t span) {
+    // slices that follow each other are joined
+    if (m->spans_length) {
+        piece_snapshot_span_t* last = &m->spans[m->spans_length - 1];
+        bool is_next =
+            last->is_utf8 == span.is_utf8 &&
+            (span.is_utf8 ? last->offset + last->length == span.offset
+                          : last->text + last->length == span.text);
+        if (is_next) {
+            last->length += span.length;
+            return;
+        }
+    }
+
+    size_t required_capacity =
+        (m->spans_length + 1) * sizeof(piece_snapshot_span_t);
+
+    while (required_capacity > m->spans_capacity) {
+        m->spans_capacity *= 2;
+        m->spans = realloc(m->spans, m->spans_capacity);
+        assert(m->spans);
+    }
+
+    m->spans[m->spans_length++] = span;
+}
+
+static void piece_snapshot_add_node(piece_table_snapshot_t* result,
+                                    piece_table_t* m,
+                                    piece_node_t* n) {
+    if (!n) return;
+    piece_snapshot_add_node(result, m, n->left);
+
+    if (n->source == piece_source_original && m->utf8.data) {
+        size_t begin = piece_utf8_byte_offset(&m->utf8, n->offset);
+        size_t end =
+            piece_utf8_byte_offset(&m->utf8, n->offset + n->length);
+        piece_snapshot_push(
+            result, (piece_snapshot_span_t){.is_utf8 = true,
+                                            .offset = begin,
+                                            .length = end - begin});
+    } else {
+        const c32_t* data = n->source == piece_source_add
+                                ? &result->add.data[n->offset]
+                                : &result->original.data[n->offset];
+        piece_snapshot_push(
+            result, (piece_snapshot_span_t){.is_utf8 = false,
+                                            .text = data,
+                                            .length = n->length});
+    }
+
+    piece_snapshot_add_node(result, m, n->right);
+}
+
+piece_table_snapshot_t piece_table_snapshot_create(piece_table_t* m) {
+    piece_table_snapshot_t result = {
+        .original = piece_utf32_share(&m->original),
+        .add = piece_utf32_share(&m->add),
+        .spans = malloc(2 * sizeof(piece_snapshot_span_t)),
+        .spans_length = 0,
+        .spans_capacity = 2 * sizeof(piece_snapshot_span_t)};
+    assert(result.spans);
+
+    // only the bytes are shared, the page cache stays with the table
+    if (m->utf8.refs) {
+        atomic_fetch_add(m->utf8.refs, 1);
+        result.utf8 = (piece_utf8_t){.data = m->utf8.data,
+                                     .size = m->utf8.size,
+                                     .length = m->utf8.length,
+                                     .mapping = m->utf8.mapping,
+                                     .refs = m->utf8.refs};
+    }
+
+    piece_snapshot_add_node(&result, m, m->root);
+    return result;
+}
+
+void piece_table_snapshot_destroy(piece_table_snapshot_t* m) {
+    piece_utf8_release(&m->utf8);
+    piece_utf32_release(&m->original);
+    piece_utf32_release(&m->add);
+    free(m->spans);
+    memset(m, 0, sizeof(piece_table_snapshot_t));
+}
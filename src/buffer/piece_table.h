@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../dyn_strings/utf32_string.h"
+
+enum piece_source { piece_source_original, piece_source_add };
+
+#define PIECE_PAGE_LEN 0x1000
+#define PIECE_PAGE_CACHE_LEN 8
+
+typedef struct piece_node {
+    struct piece_node* left;
+    struct piece_node* right;
+    unsigned priority;
+    enum piece_source source;
+    size_t offset;
+    size_t length;
+    size_t subtree_length;
+} piece_node_t;
+
+typedef struct {
+    size_t page;
+    unsigned last_used;
+    c32_t* data;
+} piece_page_t;
+
+// a large file the original text is mapped from
+typedef struct piece_mapping piece_mapping_t;
+
+// original text kept as UTF-8, either read into memory or mapped
+// read-only from a large file. it is decoded into a few cached pages
+// of PIECE_PAGE_LEN codepoints when read. `page_offsets` samples the
+// byte offset of every page and ends with the size of the text,
+// `length` is the count of codepoints. the bytes are shared with
+// the snapshots taken of the text and released by whichever of them
+// is dropped last
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t length;
+    piece_mapping_t* mapping;
+    atomic_uint* refs;
+    size_t* page_offsets;
+    size_t pages_length;
+    piece_page_t* cache;
+    size_t cache_length;
+    unsigned clock;
+} piece_utf8_t;
+
+// codepoints shared with the snapshots taken of the text and released
+// by whichever of them is dropped last. the table only appends to
+// them, a block that is still shared is left as it is and the table
+// moves on to a larger copy when it has to grow
+typedef struct {
+    c32_t* data;
+    size_t length;
+    size_t capacity;
+    atomic_uint* refs;
+} piece_utf32_t;
+
+// text stored as an implicit treap of pieces, each piece is a slice
+// of either the original (immutable) text or the append-only add
+// buffer, so inserting or deleting only splits and joins O(log n)
+// nodes instead of moving the tail of the text. the original text is
+// in `utf8` when it was loaded as UTF-8, in `original` otherwise
+typedef struct {
+    piece_utf32_t original;
+    piece_utf8_t utf8;
+    piece_utf32_t add;
+    piece_node_t* root;
+    size_t length;
+} piece_table_t;
+
+// walks the text as contiguous chunks that point into the table's
+// storage, no copy is made. a chunk of UTF-8 text stays valid until
+// PIECE_PAGE_CACHE_LEN - 1 other pages were decoded
+typedef struct {
+    piece_table_t* table;
+    size_t pos;
+    size_t end;
+} piece_table_iter_t;
+
+// walks the text as UTF-8 chunks, text kept as UTF-8 is pointed to
+// directly and the rest is encoded into `scratch`
+typedef struct {
+    piece_table_t* table;
+    size_t pos;
+    size_t end;
+    char* scratch;
+} piece_table_utf8_iter_t;
+
+// a slice of a snapshot, either bytes of the UTF-8 original from
+// `offset` or codepoints at `text`
+typedef struct {
+    bool is_utf8;
+    size_t offset;
+    const c32_t* text;
+    size_t length;
+} piece_snapshot_span_t;
+
+// the text at the time it was taken, it can be read from another
+// thread while the table keeps changing. nothing is copied, the
+// snapshot holds on to the storage the pieces point to and only
+// reads what was in it when it was taken
+typedef struct {
+    piece_utf8_t utf8;
+    piece_utf32_t original;
+    piece_utf32_t add;
+    piece_snapshot_span_t* spans;
+    size_t spans_length;
+    size_t spans_capacity;
+} piece_table_snapshot_t;
+
+piece_table_t piece_table_create(utf32_str_t original);
+void piece_table_destroy(piece_table_t* m);
+void piece_table_reset(piece_table_t* m, utf32_str_t original);
+// takes `data`, allocated with malloc, as the original text. fails
+// without touching `m` or `data` if it isn't valid UTF-8. `progress`
+// is optional and follows how many bytes were validated
+bool piece_table_reset_utf8(piece_table_t* m, char* data,
+                            size_t size, atomic_size_t* progress);
+// maps the file at `path` as the original text, fails without
+// touching `m` if it can't be mapped or isn't valid UTF-8
+bool piece_table_reset_mapped(piece_table_t* m, const char* path,
+                              atomic_size_t* progress);
+bool piece_table_is_mapped(piece_table_t* m);
+// whether the file the text is mapped from was cut short or
+// rewritten in place since, what was read of it can't be trusted and
+// the file has to be read again
+bool piece_table_is_mapping_stale(piece_table_t* m);
+// bytes of memory the text holds, the pages of a mapped file are left
+// out since they can be dropped by the kernel
+size_t piece_table_get_size(piece_table_t* m);
+// the UTF-8 original while the text is still exactly it, null
+// otherwise
+const char* piece_table_utf8_bytes(piece_table_t* m, size_t* size);
+void piece_table_insert(piece_table_t* m, size_t pos,
+                        const c32_t* str, size_t len);
+void piece_table_delete(piece_table_t* m, size_t pos, size_t count);
+c32_t piece_table_char_at(piece_table_t* m, size_t pos);
+size_t piece_table_read(piece_table_t* m, size_t pos, size_t len,
+                        c32_t* dest);
+void piece_table_copy_to_utf32(piece_table_t* m, utf32_str_t* dest);
+size_t piece_table_find(piece_table_t* m, const c32_t* substr,
+                        size_t substr_len, size_t from);
+piece_table_iter_t piece_table_iter_create(piece_table_t* m,
+                                           size_t from, size_t to);
+bool piece_table_iter_next(piece_table_iter_t* it,
+                           const c32_t** chunk, size_t* chunk_len);
+piece_table_utf8_iter_t piece_table_utf8_iter_create(piece_table_t* m,
+                                                     size_t from,
+                                                     size_t to);
+void piece_table_utf8_iter_destroy(piece_table_utf8_iter_t* it);
+bool piece_table_utf8_iter_next(piece_table_utf8_iter_t* it,
+                                const char** chunk,
+                                size_t* chunk_len);
+// the text from `pos` as null terminated UTF-8 allocated with
+// malloc, `size` is optional and gets its length in bytes
+char* piece_table_read_utf8(piece_table_t* m, size_t pos, size_t len,
+                            size_t* size);
+piece_table_snapshot_t piece_table_snapshot_create(piece_table_t* m);
+void piece_table_snapshot_destroy(piece_table_snapshot_t* m);
@@ -30,6 +30,7 @@ enum editor_cmd {
     editor_cmd_previous_search_match,
     editor_cmd_undo,
     editor_cmd_redo,
+    editor_cmd_next_undo_branch,
     editor_cmd_delete_rest_of_line,
     editor_cmd_move_word_right,
     editor_cmd_move_word_left,
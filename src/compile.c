@@ -7,6 +7,7 @@
 
 #include "buffer/buffer.h"
 #include "commands.h"
+#include "dyn_strings/line_scan.h"
 #include "dyn_strings/utf32_string.h"
 #include "error_link.h"
 #include "text_view.h"
@@ -29,6 +30,11 @@ static void find_gcc_errors(error_links_t* m, const c32_t* str,
 
     error_link_t error_link = {0};
 
+    // errors come in order, so the newlines before each one are
+    // counted from where the previous one was found
+    size_t error_line = 0;
+    size_t counted_len = 0;
+
     c32_t* match_ptr = 0;
     size_t match_pos = 0;
     while ((match_ptr =
@@ -80,14 +86,12 @@ static void find_gcc_errors(error_links_t* m, const c32_t* str,
         error_link.file_link.path_len = path_len;
 
         // find link selection
-        size_t error_line = 0;
         size_t error_from_column = 0;
         size_t error_to_column = link_end - path_beg;
         size_t substr_beg_idx = match_ptr - str;
-        for (size_t i = substr_beg_idx; i-- > 0;) {
-            if (str[i] != '\n') continue;
-            error_line += 1;
-        }
+        error_line += line_scan_count_utf32(
+            &str[counted_len], substr_beg_idx - counted_len);
+        counted_len = substr_beg_idx;
         error_link.link_selection.from_line = error_line;
         error_link.link_selection.to_line = error_line;
         error_link.link_selection.from_col = error_from_column;
@@ -138,9 +142,12 @@ static void compile_update() {
             append_proccess_finished_msg(return_status);
             g_should_check_child_exit_code = 0;
 
-            find_gcc_errors(&g_error_links,
-                            g_compile_view.buffer->str.data,
-                            g_compile_view.buffer->str.length);
+            utf32_str_t output = utf32_str_create();
+            piece_table_copy_to_utf32(&g_compile_view.buffer->text,
+                                      &output);
+            find_gcc_errors(&g_error_links, output.data,
+                            output.length);
+            utf32_str_destroy(&output);
         }
         return;
     }
@@ -65,7 +65,10 @@ config_t g_cfg = {
                        [token_constant_character_t] = peach,
                        [token_constant_character_escape_t] = pink,
                        [token_label_t] = mauve}},
-    .scroll_off = 10};
+    .scroll_off = 10,
+    .undo_budget = 64 * 1024 * 1024,
+    .large_file_size = 32 * 1024 * 1024,
+    .buffer_budget = 256 * 1024 * 1024};
 
 #define KEY_SEQ(MOD, KEY) \
     (key_combination_t) { .mod_combo = MOD, .key = KEY }
@@ -93,6 +96,7 @@ static void init_editor_keybinds() {
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_backspace,             KEY_SEQ(0,                            KEY_BACKSPACE));
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_undo,                  KEY_SEQ(mod_key_ctrl,                 KEY_SLASH));
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_redo,                  KEY_SEQ(mod_key_ctrl,                 KEY_U));
+    REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_next_undo_branch,      KEY_SEQ(mod_key_alt,                  KEY_U));
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_paste,                 KEY_SEQ(mod_key_ctrl,                 KEY_Y));
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_delete_rest_of_line,   KEY_SEQ(mod_key_ctrl,                 KEY_K));
     REGISTER_KEYBIND(g_cfg.keybinds.editor.mode_normal, editor_cmd_move_word_right,       KEY_SEQ(mod_key_alt,                  KEY_F));
@@ -51,6 +51,13 @@ typedef struct {
     color_scheme_t color_scheme;
     keybind_groups_t keybinds;
     unsigned char scroll_off;
+    // bytes of undo history kept per buffer
+    size_t undo_budget;
+    // files from this size on are mapped instead of read
+    size_t large_file_size;
+    // bytes the buffers may hold together before the least recently
+    // used unmodified ones that aren't shown are unloaded
+    size_t buffer_budget;
     ff_typo_t typo;
     float scr_proj[4][4];
 } config_t;
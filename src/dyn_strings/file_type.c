@@ -0,0 +1,153 @@
+#include "file_type.h"
+
+#include <assert.h>
+#include <magic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+
+enum file_type_sniff {
+    file_type_sniff_unknown,
+    file_type_sniff_text,
+    file_type_sniff_binary,
+};
+
+typedef struct {
+    char* path;
+    struct timespec mtime;
+    off_t size;
+    bool is_text;
+} file_type_verdict_t;
+
+static file_type_verdict_t g_verdicts[FILE_TYPE_CACHE_CAP];
+static mtx_t g_verdicts_lock;
+// loading the database parses all of it, so a single cookie is kept
+// for the whole run. libmagic cookies can't be shared between
+// threads, the lock serializes the few files the sniff can't tell
+static magic_t g_magic;
+static mtx_t g_magic_lock;
+
+__attribute__((constructor)) static void file_type_init(void) {
+    int result = mtx_init(&g_verdicts_lock, mtx_plain);
+    assert(result == thrd_success);
+    result = mtx_init(&g_magic_lock, mtx_plain);
+    assert(result == thrd_success);
+}
+
+// FNV-1a
+static size_t file_type_hash(const char* path) {
+    uint64_t result = 0xcbf29ce484222325;
+    for (; *path; path += 1) {
+        result ^= (unsigned char)*path;
+        result *= 0x100000001b3;
+    }
+    return result;
+}
+
+// control characters that show up in text, anything else below ' '
+// is left for libmagic to judge
+static bool file_type_is_text_control(unsigned char chr) {
+    return chr == '\t' || chr == '\n' || chr == '\r' || chr == '\f' ||
+           chr == '\v' || chr == '\b' || chr == 0x1b;
+}
+
+// `head` is the start of the file, the whole of it if `is_whole`.
+// a NUL byte marks binary and valid UTF-8 of printable characters
+// marks text, a sequence cut by the end of the head is let through
+static enum file_type_sniff file_type_sniff(const unsigned char* head,
+                                            size_t len,
+                                            bool is_whole) {
+    // an empty file holds no bytes that aren't text
+    if (!len && is_whole) return file_type_sniff_text;
+    if (!len) return file_type_sniff_unknown;
+    if (memchr(head, 0, len)) return file_type_sniff_binary;
+
+    for (size_t i = 0; i < len;) {
+        unsigned char chr = head[i];
+        if (chr < 0x80) {
+            if ((chr < ' ' && !file_type_is_text_control(chr)) ||
+                chr == 0x7f)
+                return file_type_sniff_unknown;
+            i += 1;
+            continue;
+        }
+
+        size_t size = chr >= 0xf0 ? 4 : chr >= 0xe0 ? 3 : 2;
+        if (chr < 0xc2 || chr > 0xf4) return file_type_sniff_unknown;
+        for (size_t ii = 1; ii < size; ii += 1) {
+            if (i + ii == len)
+                return is_whole ? file_type_sniff_unknown
+                                : file_type_sniff_text;
+            if ((head[i + ii] & 0xc0) != 0x80)
+                return file_type_sniff_unknown;
+        }
+        i += size;
+    }
+    return file_type_sniff_text;
+}
+
+static bool file_type_ask_magic(const char* path) {
+    mtx_lock(&g_magic_lock);
+    if (!g_magic) {
+        g_magic = magic_open(MAGIC_MIME_TYPE);
+        if (g_magic && magic_load(g_magic, 0)) {
+            magic_close(g_magic);
+            g_magic = 0;
+        }
+    }
+
+    bool result = false;
+    const char* mime = g_magic ? magic_file(g_magic, path) : 0;
+    if (mime) result = !strncmp(mime, "text", 4);
+    mtx_unlock(&g_magic_lock);
+    return result;
+}
+
+static bool file_type_detect(const char* path, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+
+    unsigned char head[FILE_TYPE_SNIFF_SIZE];
+    size_t len = fread(head, 1, sizeof(head), file);
+    fclose(file);
+
+    enum file_type_sniff sniff =
+        file_type_sniff(head, len, len == size);
+    if (sniff != file_type_sniff_unknown)
+        return sniff == file_type_sniff_text;
+    return file_type_ask_magic(path);
+}
+
+bool file_type_is_text(const char* path) {
+    struct stat st;
+    if (stat(path, &st) || !S_ISREG(st.st_mode)) return false;
+
+    file_type_verdict_t* verdict =
+        &g_verdicts[file_type_hash(path) & (FILE_TYPE_CACHE_CAP - 1)];
+
+    mtx_lock(&g_verdicts_lock);
+    bool is_cached = verdict->path && !strcmp(verdict->path, path) &&
+                     verdict->size == st.st_size &&
+                     verdict->mtime.tv_sec == st.st_mtim.tv_sec &&
+                     verdict->mtime.tv_nsec == st.st_mtim.tv_nsec;
+    bool result = verdict->is_text;
+    mtx_unlock(&g_verdicts_lock);
+    if (is_cached) return result;
+
+    result = file_type_detect(path, st.st_size);
+
+    // a path hashing to the same slot takes it over
+    char* path_copy = strdup(path);
+    assert(path_copy);
+    mtx_lock(&g_verdicts_lock);
+    free(verdict->path);
+    *verdict = (file_type_verdict_t){.path = path_copy,
+                                     .mtime = st.st_mtim,
+                                     .size = st.st_size,
+                                     .is_text = result};
+    mtx_unlock(&g_verdicts_lock);
+    return result;
+}
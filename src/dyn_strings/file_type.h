@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+
+// bytes of the start of a file looked at to tell text from binary
+#define FILE_TYPE_SNIFF_SIZE 0x1000
+// verdicts remembered, a power of two
+#define FILE_TYPE_CACHE_CAP 0x100
+
+// whether the file at `path` holds text. obvious cases are told from
+// the start of the file and the rest are left to libmagic, verdicts
+// are kept until the file is modified. safe to call from any thread
+bool file_type_is_text(const char* path);
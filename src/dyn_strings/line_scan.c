@@ -0,0 +1,347 @@
+#include "line_scan.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCAN_X86
+#endif
+
+// the vector paths compare a block of 32 characters against '\n' at
+// once and walk the set bits of the resulting mask. the spans in the
+// other encoding come from popcounts of masks over the same block,
+// the scalar code only handles what is left past the last whole block
+
+// scans from `i` where `span` is the size of `str[from, i)` in the
+// other encoding
+static size_t line_scan_utf32_tail(const c32_t* str, size_t len,
+                                   size_t i, size_t span,
+                                   size_t* ends, size_t* byte_ends,
+                                   size_t cap) {
+    size_t result = 0;
+    for (; i < len && result < cap; i += 1) {
+        span += utf32_char_utf8_len(str[i]);
+        if (str[i] != '\n') continue;
+        ends[result] = i + 1;
+        byte_ends[result] = span;
+        result += 1;
+    }
+    return result;
+}
+
+static size_t line_scan_utf8_tail(const char* str, size_t len,
+                                  size_t i, size_t span, size_t* ends,
+                                  size_t* codepoint_ends,
+                                  size_t cap) {
+    size_t result = 0;
+    for (; i < len && result < cap; i += 1) {
+        span += ((unsigned char)str[i] & 0xc0) != 0x80;
+        if (str[i] != '\n') continue;
+        ends[result] = i + 1;
+        codepoint_ends[result] = span;
+        result += 1;
+    }
+    return result;
+}
+
+static size_t line_scan_utf32_scalar(const c32_t* str, size_t len,
+                                     size_t from, size_t* ends,
+                                     size_t* byte_ends, size_t cap) {
+    return line_scan_utf32_tail(str, len, from, 0, ends, byte_ends,
+                                cap);
+}
+
+static size_t line_scan_utf8_scalar(const char* str, size_t len,
+                                    size_t from, size_t* ends,
+                                    size_t* codepoint_ends,
+                                    size_t cap) {
+    return line_scan_utf8_tail(str, len, from, 0, ends,
+                               codepoint_ends, cap);
+}
+
+static size_t line_scan_count_utf32_scalar(const c32_t* str,
+                                           size_t len) {
+    size_t result = 0;
+    for (size_t i = 0; i < len; i += 1) result += str[i] == '\n';
+    return result;
+}
+
+static size_t line_scan_utf8_codepoints_scalar(const char* str,
+                                               size_t len) {
+    size_t result = 0;
+    for (size_t i = 0; i < len; i += 1)
+        result += ((unsigned char)str[i] & 0xc0) != 0x80;
+    return result;
+}
+
+static size_t line_scan_utf8_len_scalar(const c32_t* str,
+                                        size_t len) {
+    size_t result = 0;
+    for (size_t i = 0; i < len; i += 1)
+        result += utf32_char_utf8_len(str[i]);
+    return result;
+}
+
+#ifdef LINE_SCAN_X86
+// bit `i` is set when `str[i]` is a '\n'
+__attribute__((target("avx2"))) static uint32_t newline_mask_avx2(
+    const c32_t* str) {
+    const __m256i newline = _mm256_set1_epi32('\n');
+    uint32_t result = 0;
+    for (int i = 0; i < 4; i += 1) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&str[i * 8]);
+        __m256i eq = _mm256_cmpeq_epi32(v, newline);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        result |= mask << (i * 8);
+    }
+    return result;
+}
+
+// bit `i` of `above[l]` is set when `str[i]` takes more than `l + 1`
+// bytes as UTF-8
+__attribute__((target("avx2"))) static void utf8_len_masks_avx2(
+    const c32_t* str, uint32_t above[3]) {
+    const __m256i limits[3] = {_mm256_set1_epi32(0x7f),
+                               _mm256_set1_epi32(0x7ff),
+                               _mm256_set1_epi32(0xffff)};
+    above[0] = above[1] = above[2] = 0;
+    for (int i = 0; i < 4; i += 1) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&str[i * 8]);
+        for (int l = 0; l < 3; l += 1) {
+            __m256i gt = _mm256_cmpgt_epi32(v, limits[l]);
+            uint32_t mask =
+                _mm256_movemask_ps(_mm256_castsi256_ps(gt));
+            above[l] |= mask << (i * 8);
+        }
+    }
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+line_scan_utf32_avx2(const c32_t* str, size_t len, size_t from,
+                     size_t* ends, size_t* byte_ends, size_t cap) {
+    size_t result = 0;
+    size_t bytes = 0;
+    size_t i = from;
+    for (; i + 32 <= len; i += 32) {
+        uint32_t above[3];
+        utf8_len_masks_avx2(&str[i], above);
+        for (uint32_t mask = newline_mask_avx2(&str[i]); mask;
+             mask &= mask - 1) {
+            unsigned at = __builtin_ctz(mask);
+            uint32_t through = (uint32_t)((2ull << at) - 1);
+            size_t extra = 0;
+            for (int l = 0; l < 3; l += 1)
+                extra += __builtin_popcount(above[l] & through);
+            ends[result] = i + at + 1;
+            byte_ends[result] = bytes + at + 1 + extra;
+            if (++result < cap) continue;
+            _mm256_zeroupper();
+            return result;
+        }
+        bytes += 32 + __builtin_popcount(above[0]) +
+                 __builtin_popcount(above[1]) +
+                 __builtin_popcount(above[2]);
+    }
+
+    _mm256_zeroupper();
+    return result + line_scan_utf32_tail(str, len, i, bytes,
+                                         &ends[result],
+                                         &byte_ends[result],
+                                         cap - result);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+line_scan_utf8_avx2(const char* str, size_t len, size_t from,
+                    size_t* ends, size_t* codepoint_ends,
+                    size_t cap) {
+    // continuation bytes are the signed bytes below -64
+    const __m256i continuation_max = _mm256_set1_epi8(-65);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t result = 0;
+    size_t codepoints = 0;
+    size_t i = from;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&str[i]);
+        uint32_t leads = _mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(v, continuation_max));
+        uint32_t mask =
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        for (; mask; mask &= mask - 1) {
+            unsigned at = __builtin_ctz(mask);
+            uint32_t through = (uint32_t)((2ull << at) - 1);
+            ends[result] = i + at + 1;
+            codepoint_ends[result] =
+                codepoints + __builtin_popcount(leads & through);
+            if (++result < cap) continue;
+            _mm256_zeroupper();
+            return result;
+        }
+        codepoints += __builtin_popcount(leads);
+    }
+
+    _mm256_zeroupper();
+    return result + line_scan_utf8_tail(str, len, i, codepoints,
+                                        &ends[result],
+                                        &codepoint_ends[result],
+                                        cap - result);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+line_scan_count_utf32_avx2(const c32_t* str, size_t len) {
+    size_t result = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+        result += __builtin_popcount(newline_mask_avx2(&str[i]));
+
+    _mm256_zeroupper();
+    return result + line_scan_count_utf32_scalar(&str[i], len - i);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+line_scan_utf8_codepoints_avx2(const char* str, size_t len) {
+    // continuation bytes are the signed bytes below -64
+    const __m256i continuation_max = _mm256_set1_epi8(-65);
+    size_t result = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&str[i]);
+        __m256i is_lead = _mm256_cmpgt_epi8(v, continuation_max);
+        result += __builtin_popcount(_mm256_movemask_epi8(is_lead));
+    }
+
+    _mm256_zeroupper();
+    return result +
+           line_scan_utf8_codepoints_scalar(&str[i], len - i);
+}
+
+__attribute__((target("avx2"))) static size_t line_scan_utf8_len_avx2(
+    const c32_t* str, size_t len) {
+    // every codepoint takes a byte plus one for each of the limits it
+    // is above, the lanes count them down as compares yield -1. they
+    // are summed before they could overflow
+    const __m256i limits[3] = {_mm256_set1_epi32(0x7f),
+                               _mm256_set1_epi32(0x7ff),
+                               _mm256_set1_epi32(0xffff)};
+    size_t result = 0;
+    size_t i = 0;
+    while (i + 8 <= len) {
+        __m256i lanes = _mm256_setzero_si256();
+        size_t block_end = i + ((len - i) & ~(size_t)7);
+        if (block_end - i > (size_t)8 << 24)
+            block_end = i + ((size_t)8 << 24);
+
+        for (; i < block_end; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)&str[i]);
+            for (int ii = 0; ii < 3; ii += 1)
+                lanes = _mm256_add_epi32(
+                    lanes, _mm256_cmpgt_epi32(v, limits[ii]));
+        }
+
+        int32_t sums[8];
+        _mm256_storeu_si256((__m256i*)sums, lanes);
+        for (int ii = 0; ii < 8; ii += 1) result -= sums[ii];
+    }
+
+    _mm256_zeroupper();
+    return result + i + line_scan_utf8_len_scalar(&str[i], len - i);
+}
+#endif
+
+static size_t (*g_line_scan_utf32)(
+    const c32_t*, size_t, size_t, size_t*, size_t*,
+    size_t) = line_scan_utf32_scalar;
+static size_t (*g_line_scan_utf8)(const char*, size_t, size_t,
+                                  size_t*, size_t*,
+                                  size_t) = line_scan_utf8_scalar;
+static size_t (*g_line_scan_count_utf32)(
+    const c32_t*, size_t) = line_scan_count_utf32_scalar;
+static size_t (*g_line_scan_utf8_codepoints)(
+    const char*, size_t) = line_scan_utf8_codepoints_scalar;
+static size_t (*g_line_scan_utf8_len)(
+    const c32_t*, size_t) = line_scan_utf8_len_scalar;
+
+// picks the kernels before main runs, so they need no synchronization
+__attribute__((constructor)) static void line_scan_select(void) {
+#ifdef LINE_SCAN_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2") ||
+        !__builtin_cpu_supports("popcnt"))
+        return;
+    g_line_scan_utf32 = line_scan_utf32_avx2;
+    g_line_scan_utf8 = line_scan_utf8_avx2;
+    g_line_scan_count_utf32 = line_scan_count_utf32_avx2;
+    g_line_scan_utf8_codepoints = line_scan_utf8_codepoints_avx2;
+    g_line_scan_utf8_len = line_scan_utf8_len_avx2;
+#endif
+}
+
+size_t line_scan_utf32(const c32_t* str, size_t len, size_t from,
+                       size_t* ends, size_t* byte_ends, size_t cap) {
+    assert(cap);
+    assert(from <= len);
+    return g_line_scan_utf32(str, len, from, ends, byte_ends, cap);
+}
+
+size_t line_scan_utf8(const char* str, size_t len, size_t from,
+                      size_t* ends, size_t* codepoint_ends,
+                      size_t cap) {
+    assert(cap);
+    assert(from <= len);
+    return g_line_scan_utf8(str, len, from, ends, codepoint_ends,
+                            cap);
+}
+
+size_t line_scan_count_utf32(const c32_t* str, size_t len) {
+    return g_line_scan_count_utf32(str, len);
+}
+
+size_t line_scan_utf8_codepoints(const char* str, size_t len) {
+    return g_line_scan_utf8_codepoints(str, len);
+}
+
+size_t line_scan_utf8_len(const c32_t* str, size_t len) {
+    return g_line_scan_utf8_len(str, len);
+}
+
+line_scan_iter_t line_scan_iter_create(const c32_t* str, size_t len) {
+    // a full batch of ends left to consume makes the first call scan
+    return (line_scan_iter_t){.str = str,
+                              .length = len,
+                              .pos = 0,
+                              .byte_pos = 0,
+                              .ends_length = LINE_SCAN_BATCH,
+                              .next_end = LINE_SCAN_BATCH};
+}
+
+bool line_scan_iter_next(line_scan_iter_t* m, size_t* span,
+                         size_t* byte_span, bool* is_line_end) {
+    if (m->pos == m->length) return false;
+
+    // a batch short of full means there are no newlines past it
+    if (m->next_end == m->ends_length &&
+        m->ends_length == LINE_SCAN_BATCH) {
+        m->ends_length =
+            line_scan_utf32(m->str, m->length, m->pos, m->ends,
+                            m->byte_ends, LINE_SCAN_BATCH);
+        m->next_end = 0;
+        m->byte_pos = 0;
+    }
+
+    *is_line_end = m->next_end < m->ends_length;
+    if (*is_line_end) {
+        size_t end = m->ends[m->next_end];
+        size_t byte_end = m->byte_ends[m->next_end];
+        *span = end - m->pos;
+        *byte_span = byte_end - m->byte_pos;
+        m->pos = end;
+        m->byte_pos = byte_end;
+        m->next_end += 1;
+        return true;
+    }
+
+    *span = m->length - m->pos;
+    *byte_span = line_scan_utf8_len(&m->str[m->pos], *span);
+    m->pos = m->length;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utf32_string.h"
+
+// newlines found by one call of the scanners
+#define LINE_SCAN_BATCH 64
+
+// stores in `ends` the offset just past every '\n' of `str` from
+// `from` on, at most `cap` of them, along with the size of the text
+// from `from` up to each end in the other encoding. returns how many
+// were stored, a full batch is resumed from its last end
+size_t line_scan_utf32(const c32_t* str, size_t len, size_t from,
+                       size_t* ends, size_t* byte_ends, size_t cap);
+size_t line_scan_utf8(const char* str, size_t len, size_t from,
+                      size_t* ends, size_t* codepoint_ends,
+                      size_t cap);
+size_t line_scan_count_utf32(const c32_t* str, size_t len);
+// codepoints in valid UTF-8
+size_t line_scan_utf8_codepoints(const char* str, size_t len);
+// bytes the codepoints take once encoded as UTF-8
+size_t line_scan_utf8_len(const c32_t* str, size_t len);
+
+// walks a chunk of text a line at a time
+typedef struct {
+    const c32_t* str;
+    size_t length;
+    size_t pos;
+    size_t byte_pos;
+    size_t ends[LINE_SCAN_BATCH];
+    size_t byte_ends[LINE_SCAN_BATCH];
+    size_t ends_length;
+    size_t next_end;
+} line_scan_iter_t;
+
+line_scan_iter_t line_scan_iter_create(const c32_t* str, size_t len);
+// yields the span up to and including the next '\n', or up to the
+// end of the chunk with `is_line_end` unset. returns false once the
+// chunk is consumed
+bool line_scan_iter_next(line_scan_iter_t* m, size_t* span,
+                         size_t* byte_span, bool* is_line_end);
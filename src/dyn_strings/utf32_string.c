@@ -2,12 +2,13 @@
 
 #include <assert.h>
 #include <fieldfusion.h>
-#include <magic.h>
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 
+#include "line_scan.h"
+#include "utf8_string.h"
+
 utf32_str_t utf32_str_create(void) {
     utf32_str_t result = {.data = calloc(sizeof(c32_t), 2),
                           .length = 0,
@@ -74,33 +75,11 @@ void utf32_str_append_utf8(utf32_str_t* m, const char* buffer,
 }
 
 void utf32_str_read_file(utf32_str_t* s, const char* path) {
-    magic_t m = magic_open(MAGIC_MIME);
-    if (!m) printf("init fail\n");
-    int d = magic_load(m, 0);
-    if (d) printf("load fail \n");
-    const char* mf = magic_file(m, path);
-    size_t mf_len = strlen(mf);
-    printf("%s\n", mf);
-    if ((strncmp(mf, "text", fminl(4, mf_len)))) {
-        printf("skipping non text detected\n");
-        magic_close(m);
-        return;
-    }
-    magic_close(m);
-
-    FILE* file = fopen(path, "r");
-    assert(file);
-
-    fseek(file, 0, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
-
-    char* file_contents = calloc(1, file_size + 1);
-    fread(file_contents, 1, file_size, file);
-    fclose(file);
-
-    utf32_str_copy_utf8(s, file_contents, file_size);
-    free(file_contents);
+    utf8_str_t file_contents = utf8_str_create();
+    if (utf8_str_read_file(&file_contents, path))
+        utf32_str_copy_utf8(s, file_contents.data,
+                            file_contents.length);
+    utf8_str_destroy(&file_contents);
 }
 
 void utf32_str_destroy(utf32_str_t* s) {
@@ -182,3 +161,42 @@ c32_t* str32str32(const c32_t* substr, size_t substr_len,
 
     return 0;
 }
+
+size_t utf32_char_utf8_len(c32_t chr) {
+    if (chr < 0x80) return 1;
+    if (chr < 0x800) return 2;
+    if (chr < 0x10000) return 3;
+    return 4;
+}
+
+size_t utf32_utf8_len(const c32_t* str, size_t len) {
+    return line_scan_utf8_len(str, len);
+}
+
+size_t utf32_to_utf8(char* dest, const c32_t* src, size_t len) {
+    char* out = dest;
+    for (size_t i = 0; i < len; i += 1) {
+        unsigned chr = src[i];
+        switch (utf32_char_utf8_len(src[i])) {
+            case 1:
+                *out++ = chr;
+                break;
+            case 2:
+                *out++ = 0xc0 | (chr >> 6);
+                *out++ = 0x80 | (chr & 0x3f);
+                break;
+            case 3:
+                *out++ = 0xe0 | (chr >> 12);
+                *out++ = 0x80 | ((chr >> 6) & 0x3f);
+                *out++ = 0x80 | (chr & 0x3f);
+                break;
+            default:
+                *out++ = 0xf0 | (chr >> 18);
+                *out++ = 0x80 | ((chr >> 12) & 0x3f);
+                *out++ = 0x80 | ((chr >> 6) & 0x3f);
+                *out++ = 0x80 | (chr & 0x3f);
+                break;
+        }
+    }
+    return out - dest;
+}
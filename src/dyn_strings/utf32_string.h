@@ -27,3 +27,9 @@ void utf32_str_insert_utf8_buf(utf32_str_t* m, size_t pos,
 void utf32_str_insert_char(utf32_str_t* m, size_t pos, c32_t chr);
 c32_t* str32str32(const c32_t* substr, size_t substr_len,
                   const c32_t* str, size_t str_len);
+// number of bytes the codepoints take once encoded as UTF-8
+size_t utf32_char_utf8_len(c32_t chr);
+size_t utf32_utf8_len(const c32_t* str, size_t len);
+// `dest` must hold utf32_utf8_len(src, len) bytes, returns the bytes
+// written
+size_t utf32_to_utf8(char* dest, const c32_t* src, size_t len);
@@ -1,8 +1,12 @@
 #include "utf8_string.h"
 
+#include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "file_type.h"
+
 utf8_str_t utf8_str_create(void) {
     return (utf8_str_t){
         .data = calloc(1, 2), .capacity = 2, .length = 0};
@@ -24,4 +28,42 @@ void utf8_str_copy(utf8_str_t* this, const char* buf,
     memcpy(this->data, buf, buf_len);
 }
 
+void utf8_str_append(utf8_str_t* this, const char* buf,
+                     size_t buf_len) {
+    size_t required_cap = this->length + buf_len + 1;
+
+    while (required_cap > this->capacity) {
+        this->capacity *= 2;
+        this->data = realloc(this->data, this->capacity);
+    }
+
+    memcpy(&this->data[this->length], buf, buf_len);
+    this->length += buf_len;
+    this->data[this->length] = 0;
+}
+
 void utf8_str_clear(utf8_str_t* this) { this->length = 0; }
+
+bool utf8_str_read_file(utf8_str_t* this, const char* path) {
+    if (!file_type_is_text(path)) return false;
+
+    FILE* file = fopen(path, "r");
+    assert(file);
+
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    // the size is known, so no room is left to grow into
+    size_t required_cap = file_size + 1;
+    if (required_cap > this->capacity) {
+        this->capacity = required_cap;
+        this->data = realloc(this->data, this->capacity);
+        assert(this->data);
+    }
+
+    this->length = fread(this->data, 1, file_size, file);
+    this->data[this->length] = 0;
+    fclose(file);
+    return true;
+}
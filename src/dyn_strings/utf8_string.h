@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 typedef struct {
@@ -11,5 +12,10 @@ typedef struct {
 utf8_str_t utf8_str_create(void);
 void utf8_str_destroy(utf8_str_t* this);
 void utf8_str_copy(utf8_str_t* this, const char* buf, size_t buf_len);
+void utf8_str_append(utf8_str_t* this, const char* buf,
+                     size_t buf_len);
 utf8_str_t utf8_str_clone(utf8_str_t* str);
 void utf8_str_clear(utf8_str_t* this);
+// reads the file at `path` as it is, fails if it isn't detected as
+// text
+bool utf8_str_read_file(utf8_str_t* this, const char* path);
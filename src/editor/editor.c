@@ -1,5 +1,7 @@
 #include "editor.h"
 
+#include <stdlib.h>
+
 #include "../commands.h"
 #include "../config.h"
 #include "../focus.h"
@@ -32,12 +34,15 @@ static void editor_move_char_left(action_param_t* param);
 static void editor_move_end_of_line(action_param_t* param);
 static void editor_end_mode_selection(action_param_t* param);
 
+static line_t editor_cursor_line(editor_t* m) {
+    return buffer_lines_get(&m->text.buffer->lines, m->cursor.row);
+}
+
 void editor_save_undo(editor_t* i) {
     buffer_save_undo(i->text.buffer, i->cursor);
 }
 
 static void editor_undo(action_param_t* param) {
-    if (!param->m->text.buffer->undo_history.length) return;
     text_pos_t undo_cursor_pos =
         buffer_undo(param->m->text.buffer, param->m->cursor);
     if (undo_cursor_pos.row == (size_t)-1) return;
@@ -46,7 +51,6 @@ static void editor_undo(action_param_t* param) {
 }
 
 static void editor_redo(action_param_t* param) {
-    if (!param->m->text.buffer->redo_history.length) return;
     text_pos_t redo_cursor_pos =
         buffer_redo(param->m->text.buffer, param->m->cursor);
     if (redo_cursor_pos.row == (size_t)-1) return;
@@ -54,13 +58,18 @@ static void editor_redo(action_param_t* param) {
     param->m->editor_flags |= editor_flag_cursor_moved;
 }
 
+// picks which branch the next redo follows
+static void editor_next_undo_branch(action_param_t* param) {
+    buffer_next_undo_branch(param->m->text.buffer);
+}
+
 static void editor_ensure_cursor_idx_within_str(editor_t* m) {
     if (m->cursor.row >= m->text.buffer->lines.length) {
         m->cursor.row = m->text.buffer->lines.length - 1;
     }
 
-    line_t* cursor_line = &m->text.buffer->lines.data[m->cursor.row];
-    size_t cursor_line_len = line_len(cursor_line);
+    line_t cursor_line = editor_cursor_line(m);
+    size_t cursor_line_len = line_len(&cursor_line);
 
     if (m->cursor.column > cursor_line_len) {
         m->cursor.column = cursor_line_len;
@@ -77,23 +86,23 @@ void editor_create(editor_t* m) {
 static void editor_copy(action_param_t* param) {
     assert(param->m->editor_mode == editor_mode_selection);
 
-    size_t index_begin = param->m->text.buffer->lines
-                             .data[param->m->text.selection.from_line]
-                             .start +
-                         param->m->text.selection.from_col;
-    size_t index_end = param->m->text.buffer->lines
-                           .data[param->m->text.selection.to_line]
-                           .start +
-                       param->m->text.selection.to_col;
+    line_t line_beg =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.from_line);
+    line_t line_end =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.to_line);
+    size_t index_begin =
+        line_beg.start + param->m->text.selection.from_col;
+    size_t index_end =
+        line_end.start + param->m->text.selection.to_col;
 
     size_t count = index_end - index_begin;
-    char utf8_selection_str[count + 1];
-    utf8_selection_str[count] = 0;
-    ff_utf32_to_utf8(utf8_selection_str,
-                     &param->m->text.buffer->str.data[index_begin],
-                     count);
+    char* utf8_selection_str = piece_table_read_utf8(
+        &param->m->text.buffer->text, index_begin, count, 0);
 
     SetClipboardText(utf8_selection_str);
+    free(utf8_selection_str);
     editor_end_mode_selection(param);
 }
 
@@ -111,9 +120,7 @@ static void editor_paste(action_param_t* param) {
 
     editor_save_undo(param->m);
     size_t cursor_index =
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-            .start +
-        param->m->cursor.column;
+        editor_cursor_line(param->m).start + param->m->cursor.column;
     buffer_insert_buf(param->m->text.buffer, cursor_index,
                       clipboard_utf32, clipboard_utf8_len);
 
@@ -132,10 +139,12 @@ static void editor_delete_selection(action_param_t* param) {
     param->m->cursor.row = param->m->text.selection.from_line;
     param->m->cursor.column = param->m->text.selection.from_col;
 
-    line_t line_beg = param->m->text.buffer->lines
-                          .data[param->m->text.selection.from_line];
-    line_t line_end = param->m->text.buffer->lines
-                          .data[param->m->text.selection.to_line];
+    line_t line_beg =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.from_line);
+    line_t line_end =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.to_line);
 
     size_t beg_index =
         line_beg.start + param->m->text.selection.from_col;
@@ -162,14 +171,14 @@ void editor_destroy(editor_t* m) {
 void editor_move_cursor(editor_t* m, size_t row, size_t col) {
     assert(row < m->text.buffer->lines.length);
 
-    line_t* ln = &m->text.buffer->lines.data[m->cursor.row];
+    line_t ln = editor_cursor_line(m);
     if (row != m->cursor.row) {
         m->cursor.row = row;
-        m->cursor.column = MIN(line_len(ln), m->target_col);
+        m->cursor.column = MIN(line_len(&ln), m->target_col);
     }
 
     if (col != m->cursor.column) {
-        assert(col < line_len(ln));
+        assert(col < line_len(&ln));
         m->cursor.column = col;
         EDITOR_ON_COLUMN_CHANGED(m);
     }
@@ -184,9 +193,7 @@ static void editor_backspace(action_param_t* param) {
         editor_end_mode_selection(param);
 
     size_t cursor_position =
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-            .start +
-        param->m->cursor.column;
+        editor_cursor_line(param->m).start + param->m->cursor.column;
     if (cursor_position == 0) return;
 
     buffer_delete(param->m->text.buffer, cursor_position - 1, 1);
@@ -199,10 +206,8 @@ static void editor_delete(action_param_t* param) {
     if (param->m->text.text_flags & text_flag_has_selection)
         return editor_delete_selection(param);
     size_t cursor_position =
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-            .start +
-        param->m->cursor.column;
-    if (cursor_position >= param->m->text.buffer->str.length) return;
+        editor_cursor_line(param->m).start + param->m->cursor.column;
+    if (cursor_position >= param->m->text.buffer->text.length) return;
     buffer_delete(param->m->text.buffer, cursor_position, 1);
 }
 
@@ -213,9 +218,7 @@ static void editor_insert_char(action_param_t* param, c32_t chr) {
     }
     buffer_insert_char(
         param->m->text.buffer,
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-                .start +
-            param->m->cursor.column,
+        editor_cursor_line(param->m).start + param->m->cursor.column,
         chr);
     editor_move_char_right(param);
     param->m->editor_flags &= ~editor_flag_cursor_moved_manually;
@@ -229,17 +232,14 @@ static void editor_insert_tab(action_param_t* param,
     for (size_t i = 0; i < tab_size; i += 1) tab[i] = U' ';
     buffer_insert_buf(
         param->m->text.buffer,
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-                .start +
-            param->m->cursor.column,
+        editor_cursor_line(param->m).start + param->m->cursor.column,
         tab, tab_size);
     for (size_t i = 0; i < tab_size; i += 1)
         editor_move_char_right(param);
 }
 
 static void editor_move_char_right(action_param_t* param) {
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = editor_cursor_line(param->m);
     if (param->m->cursor.column >= line_len(&line))
         return editor_move_line_down(param);
     param->m->cursor.column += 1;
@@ -251,8 +251,7 @@ static void editor_move_line_up(action_param_t* param) {
     if (param->m->cursor.row == 0)
         return editor_move_char_left(param);
     param->m->cursor.row -= 1;
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = editor_cursor_line(param->m);
     param->m->cursor.column =
         MIN(line_len(&line), param->m->target_col);
 
@@ -277,8 +276,7 @@ static void editor_move_beg_of_line(action_param_t* param) {
 }
 
 static void editor_move_end_of_line(action_param_t* param) {
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = editor_cursor_line(param->m);
     param->m->cursor.column = line_len(&line);
     EDITOR_ON_CURSOR_MOVED(param->m);
     EDITOR_ON_COLUMN_CHANGED(param->m);
@@ -289,8 +287,7 @@ static void editor_move_line_down(action_param_t* param) {
         param->m->text.buffer->lines.length - 1)
         return;
     param->m->cursor.row += 1;
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = editor_cursor_line(param->m);
     param->m->cursor.column =
         MIN(line_len(&line), param->m->target_col);
     EDITOR_ON_CURSOR_MOVED(param->m);
@@ -356,8 +353,7 @@ static void editor_delete_rest_of_line(action_param_t* param) {
     if (param->m->text.text_flags & text_flag_has_selection)
         return editor_delete_selection(param);
 
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = editor_cursor_line(param->m);
     size_t start_index = line.start + param->m->cursor.column;
     size_t delete_len = line.end - start_index;
 
@@ -383,10 +379,10 @@ static void editor_move_cursor_on_click(action_param_t* param) {
 static size_t editor_get_cursor_idx(editor_t* m) {
     assert(m->cursor.row < m->text.buffer->lines.length);
 
-    const line_t* line = &m->text.buffer->lines.data[m->cursor.row];
-    assert(m->cursor.column <= line->start - line->end);
+    const line_t line = editor_cursor_line(m);
+    assert(m->cursor.column <= line.start - line.end);
 
-    return line->start + m->cursor.column;
+    return line.start + m->cursor.column;
 }
 
 static inline bool is_word_separator(c32_t chr) {
@@ -395,64 +391,45 @@ static inline bool is_word_separator(c32_t chr) {
 
 static void editor_move_word_right(action_param_t* param) {
     size_t idx = editor_get_cursor_idx(param->m);
+    piece_table_t* text = &param->m->text.buffer->text;
 
-    c32_t current_char = param->m->text.buffer->str.data[idx];
-    for (c32_t current_char = param->m->text.buffer->str.data[idx];
-         idx && is_word_separator(current_char); idx += 1,
-               current_char = param->m->text.buffer->str.data[idx])
-        ;
+    while (idx && is_word_separator(piece_table_char_at(text, idx)))
+        idx += 1;
 
-    for (char current_char = param->m->text.buffer->str.data[idx];
-         idx < param->m->text.buffer->str.length &&
-         !is_word_separator(current_char);
-         idx += 1,
-              current_char = param->m->text.buffer->str.data[idx])
-        ;
+    while (idx < text->length &&
+           !is_word_separator(piece_table_char_at(text, idx)))
+        idx += 1;
 
     param->m->cursor.row = buffer_lines_get_line_num_from_idx(
         &param->m->text.buffer->lines, idx);
-    assert(idx >=
-           param->m->text.buffer->lines.data[param->m->cursor.row]
-               .start);
+    assert(idx >= editor_cursor_line(param->m).start);
 
     param->m->cursor.column =
-        idx -
-        param->m->text.buffer->lines.data[param->m->cursor.row].start;
+        idx - editor_cursor_line(param->m).start;
 
     EDITOR_ON_CURSOR_MOVED(param->m);
 }
 
 static void editor_move_word_left(action_param_t* param) {
     size_t idx = editor_get_cursor_idx(param->m);
+    piece_table_t* text = &param->m->text.buffer->text;
 
     if (idx) idx -= 1;
 
-    c32_t current_char = param->m->text.buffer->str.data[idx];
-    for (c32_t current_char = param->m->text.buffer->str.data[idx];
-         idx && is_word_separator(current_char); idx -= 1,
-               current_char = param->m->text.buffer->str.data[idx])
-        ;
-
-    for (char current_char = param->m->text.buffer->str.data[idx];
-         idx < param->m->text.buffer->str.length &&
-         !is_word_separator(current_char);
-         idx -= 1,
-              current_char = param->m->text.buffer->str.data[idx])
-        ;
-
-    if (param->m->text.buffer->str.data[idx] == U' ' ||
-        param->m->text.buffer->str.data[idx] == U'\n')
-        idx += 1;
+    while (idx && is_word_separator(piece_table_char_at(text, idx)))
+        idx -= 1;
+
+    while (idx && !is_word_separator(piece_table_char_at(text, idx)))
+        idx -= 1;
+
+    if (is_word_separator(piece_table_char_at(text, idx))) idx += 1;
 
     param->m->cursor.row = buffer_lines_get_line_num_from_idx(
         &param->m->text.buffer->lines, idx);
-    assert(idx >=
-           param->m->text.buffer->lines.data[param->m->cursor.row]
-               .start);
+    assert(idx >= editor_cursor_line(param->m).start);
 
     param->m->cursor.column =
-        idx -
-        param->m->text.buffer->lines.data[param->m->cursor.row].start;
+        idx - editor_cursor_line(param->m).start;
 
     EDITOR_ON_CURSOR_MOVED(param->m);
 }
@@ -466,8 +443,8 @@ static void editor_move_buffer_begin(action_param_t* param) {
 
 static void editor_move_buffer_end(action_param_t* param) {
     param->m->cursor.row = param->m->text.buffer->lines.length - 1;
-    param->m->cursor.column = line_len(
-        &param->m->text.buffer->lines.data[param->m->cursor.row]);
+    line_t line = editor_cursor_line(param->m);
+    param->m->cursor.column = line_len(&line);
 
     EDITOR_ON_CURSOR_MOVED(param->m);
 }
@@ -494,6 +471,7 @@ static void (*g_editor_cmd_table[editor_cmd_count])(
         editor_select_previous_search_match,
     [editor_cmd_undo] = editor_undo,
     [editor_cmd_redo] = editor_redo,
+    [editor_cmd_next_undo_branch] = editor_next_undo_branch,
     [editor_cmd_delete_rest_of_line] = editor_delete_rest_of_line,
     [editor_cmd_move_word_right] = editor_move_word_right,
     [editor_cmd_move_word_left] = editor_move_word_left,
@@ -2,6 +2,7 @@
 
 #include <fieldfusion.h>
 #include <raylib.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "../buffer/buffer.h"
@@ -17,12 +18,15 @@ typedef struct {
     Rectangle bounds;
 } action_param_t;
 
+static line_t line_editor_cursor_line(line_editor_t* m) {
+    return buffer_lines_get(&m->text.buffer->lines, m->cursor.row);
+}
+
 static void line_editor_save_undo(line_editor_t* m) {
     buffer_save_undo(m->text.buffer, m->cursor);
 }
 
 static void line_editor_undo(action_param_t* param) {
-    if (!param->m->text.buffer->undo_history.length) return;
     text_pos_t undo_cursor_pos =
         buffer_undo(param->m->text.buffer, param->m->cursor);
     if (undo_cursor_pos.row == (size_t)-1) return;
@@ -31,7 +35,6 @@ static void line_editor_undo(action_param_t* param) {
 }
 
 static void line_editor_redo(action_param_t* param) {
-    if (!param->m->text.buffer->redo_history.length) return;
     text_pos_t redo_cursor_pos =
         buffer_redo(param->m->text.buffer, param->m->cursor);
     if (redo_cursor_pos.row == (size_t)-1) return;
@@ -70,7 +73,7 @@ void line_editor_destroy(line_editor_t* o) {
 static void line_editor_move_char_right(action_param_t* param) {
     assert(param->m->text.buffer);
     if (param->m->cursor.column + 1 >
-        param->m->text.buffer->str.length)
+        param->m->text.buffer->text.length)
         return;
     param->m->cursor.column += 1;
     param->m->line_editor_flags |= line_editor_flag_cursor_moved;
@@ -87,7 +90,7 @@ static void line_editor_move_beg_of_line(action_param_t* param) {
 
 static void line_editor_move_end_of_line(action_param_t* param) {
     assert(param->m->text.buffer);
-    param->m->cursor.column = param->m->text.buffer->str.length;
+    param->m->cursor.column = param->m->text.buffer->text.length;
     param->m->line_editor_flags |= line_editor_flag_cursor_moved;
     param->m->line_editor_flags |=
         line_editor_flag_cursor_moved_manually;
@@ -121,10 +124,12 @@ static void line_editor_delete_selection(action_param_t* param) {
     param->m->cursor.row = param->m->text.selection.from_line;
     param->m->cursor.column = param->m->text.selection.from_col;
 
-    line_t line_beg = param->m->text.buffer->lines
-                          .data[param->m->text.selection.from_line];
-    line_t line_end = param->m->text.buffer->lines
-                          .data[param->m->text.selection.to_line];
+    line_t line_beg =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.from_line);
+    line_t line_end =
+        buffer_lines_get(&param->m->text.buffer->lines,
+                         param->m->text.selection.to_line);
 
     size_t beg_index =
         line_beg.start + param->m->text.selection.from_col;
@@ -138,7 +143,7 @@ static void line_editor_delete_selection(action_param_t* param) {
 
 static void line_editor_delete_char_at(line_editor_t* m,
                                        size_t index) {
-    assert(index <= m->text.buffer->str.length);
+    assert(index <= m->text.buffer->text.length);
     buffer_delete(m->text.buffer, index, 1);
 }
 
@@ -151,8 +156,7 @@ static void line_editor_backspace(action_param_t* param) {
     }
 
     size_t cursor_position =
-        param->m->text.buffer->lines.data[param->m->cursor.row]
-            .start +
+        line_editor_cursor_line(param->m).start +
         param->m->cursor.column;
     if (!cursor_position) return;
 
@@ -167,8 +171,7 @@ static void line_editor_delete_rest_of_line(action_param_t* param) {
     if (param->m->text.text_flags & text_flag_has_selection)
         return line_editor_delete_selection(param);
 
-    line_t line =
-        param->m->text.buffer->lines.data[param->m->cursor.row];
+    line_t line = line_editor_cursor_line(param->m);
     size_t start_index = line.start + param->m->cursor.column;
     size_t delete_len = line.end - start_index;
 
@@ -184,7 +187,7 @@ static void line_editor_delete(action_param_t* param) {
     }
 
     if (param->m->cursor.column ||
-        param->m->cursor.column >= param->m->text.buffer->str.length)
+        param->m->cursor.column >= param->m->text.buffer->text.length)
         return;
 
     line_editor_delete_char_at(param->m, param->m->cursor.column);
@@ -196,12 +199,10 @@ static void line_editor_copy(action_param_t* param) {
     size_t index_end = param->m->text.selection.to_col;
 
     size_t count = index_end - index_begin;
-    char utf8_selection_str[count + 1];
-    utf8_selection_str[count] = 0;
-    ff_utf32_to_utf8(utf8_selection_str,
-                     &param->m->text.buffer->str.data[index_begin],
-                     count);
+    char* utf8_selection_str = piece_table_read_utf8(
+        &param->m->text.buffer->text, index_begin, count, 0);
     SetClipboardText(utf8_selection_str);
+    free(utf8_selection_str);
 }
 
 static void line_editor_paste(action_param_t* param) {
@@ -259,17 +260,13 @@ static void line_editor_insert_char(action_param_t* param,
 
 static void line_editor_move_word_right(action_param_t* param) {
     size_t idx = param->m->cursor.column;
+    piece_table_t* text = &param->m->text.buffer->text;
 
-    c32_t current_char = param->m->text.buffer->str.data[idx];
-    for (c32_t current_char = param->m->text.buffer->str.data[idx];
-         idx && current_char == U' '; idx += 1,
-               current_char = param->m->text.buffer->str.data[idx])
-        ;
+    while (idx && piece_table_char_at(text, idx) == U' ') idx += 1;
 
-    while (idx < param->m->text.buffer->str.length &&
-           param->m->text.buffer->str.data[idx] != U' ') {
+    while (idx < text->length &&
+           piece_table_char_at(text, idx) != U' ')
         idx += 1;
-    }
 
     param->m->cursor.column = idx;
 
@@ -280,20 +277,15 @@ static void line_editor_move_word_right(action_param_t* param) {
 
 static void line_editor_move_word_left(action_param_t* param) {
     size_t idx = param->m->cursor.column;
+    piece_table_t* text = &param->m->text.buffer->text;
 
     if (idx) idx -= 1;
 
-    c32_t current_char = param->m->text.buffer->str.data[idx];
-    for (c32_t current_char = param->m->text.buffer->str.data[idx];
-         idx && current_char == U' '; idx -= 1,
-               current_char = param->m->text.buffer->str.data[idx])
-        ;
+    while (idx && piece_table_char_at(text, idx) == U' ') idx -= 1;
 
-    while (idx && param->m->text.buffer->str.data[idx] != U' ') {
-        idx -= 1;
-    }
+    while (idx && piece_table_char_at(text, idx) != U' ') idx -= 1;
 
-    if (param->m->text.buffer->str.data[idx] == U' ') idx += 1;
+    if (piece_table_char_at(text, idx) == U' ') idx += 1;
 
     param->m->cursor.column = idx;
 
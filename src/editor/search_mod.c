@@ -39,41 +39,39 @@ static void search_matches_clear(search_matches_t* m) {
 void search_mod_find(search_mod_t* m, buffer_t* buffer) {
     search_matches_clear(&m->search_matches);
 
-    bool search_buffer_empty =
-        !m->search_editor.text.buffer->str.length;
-    bool buf_empty = !buffer->str.length;
+    piece_table_t* search_text = &m->search_editor.text.buffer->text;
+    bool search_buffer_empty = !search_text->length;
+    bool buf_empty = !buffer->text.length;
     if (search_buffer_empty || buf_empty) return;
 
-    c32_t* sub_str_ptr = 0;
+    size_t substr_len = search_text->length;
+    c32_t substr[substr_len];
+    piece_table_read(search_text, 0, substr_len, substr);
+
+    size_t match_pos = 0;
     size_t search_pos = 0;
-    while ((sub_str_ptr =
-                str32str32(m->search_editor.text.buffer->str.data,
-                           m->search_editor.text.buffer->str.length,
-                           &buffer->str.data[search_pos],
-                           buffer->str.length - search_pos))) {
-        size_t match_pos = sub_str_ptr - &buffer->str.data[0];
+    while ((match_pos = piece_table_find(&buffer->text, substr,
+                                         substr_len, search_pos)) !=
+           (size_t)-1) {
         size_t match_line_num = buffer_lines_get_line_num_from_idx(
             &buffer->lines, match_pos);
-        size_t match_column =
-            match_pos - buffer->lines.data[match_line_num].start;
+        line_t match_line =
+            buffer_lines_get(&buffer->lines, match_line_num);
+        size_t match_column = match_pos - match_line.start;
 
         search_matches_push(
             &m->search_matches,
-            (selection_t){
-                .from_line = match_line_num,
-                .from_col = match_column,
-                .to_line = match_line_num,
-                .to_col = match_column +
-                          m->search_editor.text.buffer->str.length});
-
-        size_t next_search_pos =
-            match_pos + m->search_editor.text.buffer->str.length;
-        if (next_search_pos > buffer->str.length) return;
+            (selection_t){.from_line = match_line_num,
+                          .from_col = match_column,
+                          .to_line = match_line_num,
+                          .to_col = match_column + substr_len});
+
+        size_t next_search_pos = match_pos + substr_len;
+        if (next_search_pos > buffer->text.length) return;
         search_pos = next_search_pos;
     }
 
-    m->prev_search_buffer_size =
-        m->search_editor.text.buffer->str.length;
+    m->prev_search_buffer_size = substr_len;
 }
 
 void search_mod_create(search_mod_t* m) {
@@ -120,7 +118,7 @@ void search_mod_clear_matches(search_mod_t* m) {
 
 bool search_mod_input_changed(search_mod_t* m) {
     return m->prev_search_buffer_size !=
-           m->search_editor.text.buffer->str.length;
+           m->search_editor.text.buffer->text.length;
 }
 
 bool search_mod_is_empty(search_mod_t* m) {
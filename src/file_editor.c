@@ -11,16 +11,19 @@
 #include "file_editor.h"
 #include "focus.h"
 #include "highlighter/highlighter.h"
-#include "rlgl.h"
 
 void file_editor_destroy(file_editor_t* m) {
+    // a save still running is let to finish so it isn't lost
+    int error = 0;
+    buffer_save_stamp_t stamp;
+    if (m->save) buffer_save_finish(m->save, &error, &stamp);
     editor_destroy(&m->editor);
     utf8_str_destroy(&m->status_line_str);
     ff_glyph_vec_destroy(&m->status_line_glyphs);
     utf8_str_destroy(&m->file_path);
 }
 
-static void file_editor_update_status_line_text(file_editor_t* m) {
+static void file_editor_update_status_line_path(file_editor_t* m) {
     if (m->file_path.length < 32) {
         utf8_str_copy(&m->status_line_str, m->file_path.data,
                       m->file_path.length);
@@ -58,6 +61,15 @@ static void file_editor_update_status_line_text(file_editor_t* m) {
     utf8_str_copy(&m->status_line_str, final_name, final_name_len);
 }
 
+static void file_editor_update_status_line_text(file_editor_t* m) {
+    file_editor_update_status_line_path(m);
+    utf8_str_append(&m->status_line_str, m->load_status,
+                    strlen(m->load_status));
+    if (m->save_status)
+        utf8_str_append(&m->status_line_str, m->save_status,
+                        strlen(m->save_status));
+}
+
 static Rectangle file_editor_get_status_line_bounds(
     file_editor_t* m, ff_typo_t typo, Rectangle bounds) {
     Rectangle result = bounds;
@@ -108,6 +120,7 @@ void file_editor_open(file_editor_t* m, const char* file_path) {
 
     buffer_t* stored_buffer = buffer_handler_get(file_path);
     utf8_str_copy(&m->file_path, file_path, strlen(file_path));
+    if (!m->save) m->save_status = 0;
     editor_reset_mode(&m->editor);
     if (stored_buffer) {
         m->editor.text.buffer = stored_buffer;
@@ -125,29 +138,65 @@ void file_editor_open(file_editor_t* m, const char* file_path) {
                                        file_language);
         }
 
-        buffer_read_file(m->editor.text.buffer, file_path);
+        buffer_read_file_async(m->editor.text.buffer, file_path);
     }
 
     file_editor_update_status_line_text(m);
     buffer_save_undo(m->editor.text.buffer, (text_pos_t){0});
 }
 
+static void file_editor_set_save_status(file_editor_t* m,
+                                        const char* status) {
+    m->save_status = status;
+    file_editor_update_status_line_text(m);
+}
+
 void file_editor_save(file_editor_t* m) {
     if (!m->file_path.length) return;
-    FILE* file = fopen(m->file_path.data, "w");
-    assert(file != NULL);
+    if (m->save) {
+        m->is_save_queued = true;
+        return;
+    }
+
+    buffer_t* buffer = m->editor.text.buffer;
+    bool is_own_file =
+        buffer->buffer_name &&
+        !strcmp(buffer->buffer_name, m->file_path.data);
+    m->save_buffer = is_own_file ? buffer : 0;
+    m->save_edit_count = buffer->edit_count;
+    m->save = buffer_save_start(&buffer->text, m->file_path.data);
+    file_editor_set_save_status(
+        m, m->save ? " [saving]" : " [save failed]");
+}
 
-    char new_contents[m->editor.text.buffer->str.length];
-    memset(new_contents, 0, m->editor.text.buffer->str.length);
-    ff_utf32_to_utf8(new_contents, m->editor.text.buffer->str.data,
-                     m->editor.text.buffer->str.length);
+// picks up the save once its thread is done, called every frame
+static void file_editor_update_save(file_editor_t* m) {
+    if (!m->save ||
+        buffer_save_get_state(m->save) == buffer_save_state_running)
+        return;
+
+    int error = 0;
+    buffer_save_stamp_t stamp;
+    bool is_saved = buffer_save_finish(m->save, &error, &stamp);
+    m->save = 0;
+    if (!is_saved) {
+        TraceLog(LOG_WARNING, "saving %s failed: %s",
+                 m->file_path.data, strerror(error));
+    } else if (m->save_buffer) {
+        m->save_buffer->saved_edit_count = m->save_edit_count;
+        m->save_buffer->saved_stamp = stamp;
+    }
+    file_editor_set_save_status(m, is_saved ? 0 : " [save failed]");
 
-    fwrite(new_contents, 1, m->editor.text.buffer->str.length, file);
-    fclose(file);
+    if (!m->is_save_queued) return;
+    m->is_save_queued = false;
+    file_editor_save(m);
 }
 
 void file_editor_set_path(file_editor_t* o, const char* path) {
     utf8_str_copy(&o->file_path, path, strlen(path));
+    // the status of a finished save belongs to the previous path
+    if (!o->save) o->save_status = 0;
     file_editor_update_status_line_text(o);
 }
 
@@ -160,21 +209,20 @@ void file_editor_draw_status_line(file_editor_t* m, ff_typo_t typo,
         file_editor_get_status_line_bounds(m, typo, bounds);
     DrawRectangleRec(bar_rec,
                      GetColor(g_cfg.color_scheme.surface0_bg));
-    rlDrawRenderBatchActive();
 
     float projection[4][4];
     ff_get_ortho_projection(0, GetScreenWidth(), GetScreenHeight(), 0,
                             -1.0f, 1.0f, projection);
-    ff_draw(typo.font, m->status_line_glyphs.data,
-            m->status_line_glyphs.len, (float*)projection);
+    ff_batch_draw(typo.font, m->status_line_glyphs.data,
+                  m->status_line_glyphs.len, (float*)projection, 0);
 }
 
-void file_editor_draw_fade(Rectangle editor_bounds) {
+void file_editor_draw_fade(Rectangle bounds) {
     float fade_out_height = 42;
     Rectangle fade_out_bounds = {
-        .x = editor_bounds.x,
-        .y = editor_bounds.y + editor_bounds.height - fade_out_height,
-        .width = editor_bounds.width,
+        .x = bounds.x,
+        .y = bounds.y + bounds.height - fade_out_height,
+        .width = bounds.width,
         .height = fade_out_height};
 
     Color bg = GetColor(g_cfg.color_scheme.bg);
@@ -192,12 +240,42 @@ void file_editor_handle_commands(file_editor_t* m, int focus_flags) {
     if (cmd != -1 && cmd == file_editor_cmd_save) file_editor_save(m);
 }
 
+// follows the load of the buffer into the status line, returns the
+// focus the editor is drawn with since it can't be used until the
+// lines of the text are indexed
+static int file_editor_update_load(file_editor_t* m,
+                                   int focus_flags) {
+    buffer_t* buffer = m->editor.text.buffer;
+    buffer_update_load(buffer);
+
+    char status[sizeof(m->load_status)] = {0};
+    buffer_load_t* load = buffer->load;
+    bool is_reading = load && buffer_load_get_stage(load) ==
+                                  buffer_load_stage_reading;
+    if (is_reading)
+        snprintf(status, sizeof(status), " [loading %d%%]",
+                 (int)(buffer_load_get_progress(load) * 100));
+    else if (load)
+        snprintf(status, sizeof(status), " [%s]",
+                 buffer_is_editable(buffer) ? "highlighting"
+                                            : "indexing");
+
+    if (strcmp(status, m->load_status)) {
+        memcpy(m->load_status, status, sizeof(status));
+        file_editor_update_status_line_text(m);
+    }
+
+    if (buffer_is_editable(buffer)) return focus_flags;
+    return focus_flags &
+           ~(focus_flag_can_interact | focus_flag_can_scroll);
+}
+
 void file_editor_draw(file_editor_t* m, ff_typo_t typo,
                       Rectangle bounds, int focus_flags) {
     file_editor_handle_commands(m, focus_flags);
-
-    if (m->file_path.length != m->status_line_str.length)
-        file_editor_update_status_line_text(m);
+    file_editor_update_save(m);
+    buffer_handler_touch(m->editor.text.buffer);
+    int editor_focus_flags = file_editor_update_load(m, focus_flags);
 
     file_editor_draw_status_line(m, typo, bounds, focus_flags);
 
@@ -206,7 +284,5 @@ void file_editor_draw(file_editor_t* m, ff_typo_t typo,
         file_editor_get_status_line_bounds(m, typo, bounds).height;
     editor_bounds.y += status_line_height;
     editor_bounds.height -= status_line_height;
-    editor_draw(&m->editor, typo, editor_bounds, focus_flags);
-
-    file_editor_draw_fade(editor_bounds);
+    editor_draw(&m->editor, typo, editor_bounds, editor_focus_flags);
 }
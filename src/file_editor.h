@@ -2,6 +2,7 @@
 #include <fieldfusion.h>
 #include <raylib.h>
 
+#include "buffer/buffer_save.h"
 #include "dyn_strings/utf8_string.h"
 #include "editor/editor.h"
 
@@ -10,12 +11,25 @@ typedef struct {
     editor_t editor;
     utf8_str_t status_line_str;
     ff_glyph_vec_t status_line_glyphs;
+    // the save in flight, a save asked for meanwhile is queued and
+    // started once it ends
+    buffer_save_t* save;
+    bool is_save_queued;
+    const char* save_status;
+    // the buffer saved to its own file and its edit count when the
+    // save started, null when saving elsewhere
+    buffer_t* save_buffer;
+    size_t save_edit_count;
+    char load_status[32];
 } file_editor_t;
 
 void file_editor_create(file_editor_t* m);
 void file_editor_destroy(file_editor_t* m);
 void file_editor_open(file_editor_t* m, const char* file_path);
 void file_editor_set_path(file_editor_t* m, const char* path);
+// the text is queued, it is drawn once the batch is flushed
 void file_editor_draw(file_editor_t* m, ff_typo_t typo,
                       Rectangle bounds, int focus_flags);
+// fades out the bottom of the pane, drawn over its text
+void file_editor_draw_fade(Rectangle bounds);
 void file_editor_save(file_editor_t* m);
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../file_watch.h"
+
 #define MAP_SIZE 0x800
 #define FILE_PREVIEW_PATH_CAP 0x100
 
@@ -22,9 +24,15 @@ typedef struct {
 
 static map_t file_preview_cache = {0};
 
+static void file_preview_on_file_change(void* data) {
+    file_preview_t* preview = data;
+    preview->is_stale = true;
+}
+
 void file_preview_create(file_preview_t* o, const char* path) {
     buffer_create(&o->buffer, utf32_str_create());
-    o->path_last_modified = GetFileModTime(path);
+    o->is_stale = false;
+    file_watch_add(path, file_preview_on_file_change, o);
     o->text = text_view_create();
     o->text.buffer = &o->buffer;
 
@@ -37,8 +45,7 @@ void file_preview_create(file_preview_t* o, const char* path) {
         buffer_syntax_set_language(&o->text.buffer->syntax,
                                    file_language);
         buffer_syntax_update(&o->text.buffer->syntax,
-                             o->text.buffer->str.data,
-                             o->text.buffer->str.length);
+                             &o->text.buffer->text);
     }
 }
 
@@ -128,20 +135,16 @@ static void map_update_entry(map_t* o, const char* path) {
         map_assign_path_to_key(entry->key, path);
         file_preview_create(&entry->file_preview, path);
     } else if (!strcmp(entry->key, path)) {
-        long file_mod_time = GetFileModTime(path);
-        if (file_mod_time > entry->file_preview.path_last_modified) {
-            entry->file_preview.path_last_modified = file_mod_time;
+        if (entry->file_preview.is_stale) {
+            entry->file_preview.is_stale = false;
             buffer_read_file(&entry->file_preview.buffer, path);
         }
     } else {
         map_entry_t* ll_entry = map_ll_find(entry, path);
 
         if (ll_entry) {
-            long file_mod_time = GetFileModTime(path);
-            if (file_mod_time >
-                ll_entry->file_preview.path_last_modified) {
-                ll_entry->file_preview.path_last_modified =
-                    file_mod_time;
+            if (ll_entry->file_preview.is_stale) {
+                ll_entry->file_preview.is_stale = false;
                 buffer_read_file(&ll_entry->file_preview.buffer,
                                  path);
             }
@@ -5,7 +5,8 @@
 typedef struct {
     buffer_t buffer;
     text_view_t text;
-    long path_last_modified;
+    // set when the file changed since it was read
+    bool is_stale;
 } file_preview_t;
 
 void preview_init(void);
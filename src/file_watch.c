@@ -0,0 +1,119 @@
+#include "file_watch.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define FILE_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+typedef struct {
+    int wd;
+    char* name;
+    file_watch_fn on_change;
+    void* data;
+    bool is_changed;
+} file_watch_t;
+
+typedef struct {
+    int fd;
+    file_watch_t* watches;
+    size_t length;
+    size_t capacity;
+} file_watches_t;
+
+static file_watches_t g_file_watches = {.fd = -1};
+
+void file_watch_init(void) {
+    g_file_watches = (file_watches_t){
+        .fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC),
+        .watches = calloc(2, sizeof(file_watch_t)),
+        .length = 0,
+        .capacity = 2 * sizeof(file_watch_t)};
+    assert(g_file_watches.watches);
+}
+
+void file_watch_terminate(void) {
+    for (size_t i = 0; i < g_file_watches.length; i += 1)
+        free(g_file_watches.watches[i].name);
+    free(g_file_watches.watches);
+    if (g_file_watches.fd != -1) close(g_file_watches.fd);
+    g_file_watches = (file_watches_t){.fd = -1};
+}
+
+bool file_watch_add(const char* path, file_watch_fn on_change,
+                    void* data) {
+    file_watches_t* m = &g_file_watches;
+    if (m->fd == -1) return false;
+
+    const char* name = strrchr(path, '/');
+    size_t dir_len = name ? (size_t)(name - path) : 1;
+    char dir[dir_len + 2];
+    memcpy(dir, name ? path : ".", dir_len);
+    // the root directory keeps its slash
+    if (!dir_len) dir[dir_len++] = '/';
+    dir[dir_len] = 0;
+    name = name ? name + 1 : path;
+
+    // watching a directory again hands back the same descriptor
+    int wd = inotify_add_watch(m->fd, dir, FILE_WATCH_MASK);
+    if (wd == -1) return false;
+
+    size_t required_capacity = (m->length + 1) * sizeof(file_watch_t);
+    while (required_capacity > m->capacity) {
+        m->capacity *= 2;
+        m->watches = realloc(m->watches, m->capacity);
+        assert(m->watches);
+    }
+
+    m->watches[m->length] = (file_watch_t){.wd = wd,
+                                           .name = strdup(name),
+                                           .on_change = on_change,
+                                           .data = data,
+                                           .is_changed = false};
+    assert(m->watches[m->length].name);
+    m->length += 1;
+    return true;
+}
+
+static void file_watch_mark(file_watches_t* m,
+                            struct inotify_event* event) {
+    // events were dropped, so anything may have changed
+    bool is_overflow = event->mask & IN_Q_OVERFLOW;
+    for (size_t i = 0; i < m->length; i += 1) {
+        file_watch_t* watch = &m->watches[i];
+        if (is_overflow ||
+            (watch->wd == event->wd && event->len &&
+             !strcmp(watch->name, event->name)))
+            watch->is_changed = true;
+    }
+}
+
+void file_watch_update(void) {
+    file_watches_t* m = &g_file_watches;
+    if (m->fd == -1) return;
+
+    char events[0x1000]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool has_changes = false;
+    for (;;) {
+        ssize_t len = read(m->fd, events, sizeof(events));
+        if (len <= 0) break;
+
+        for (ssize_t i = 0; i < len;) {
+            struct inotify_event* event = (void*)&events[i];
+            file_watch_mark(m, event);
+            has_changes = true;
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (!has_changes) return;
+
+    // a callback may add watches, which can move the array
+    for (size_t i = 0; i < m->length; i += 1) {
+        if (!m->watches[i].is_changed) continue;
+        m->watches[i].is_changed = false;
+        m->watches[i].on_change(m->watches[i].data);
+    }
+}
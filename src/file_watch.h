@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+// called on the main thread with the data the watch was added with
+typedef void (*file_watch_fn)(void* data);
+
+void file_watch_init(void);
+void file_watch_terminate(void);
+// calls `on_change` whenever the file at `path` is written or
+// replaced. the directory of the file is watched rather than the file
+// itself, so a file saved by renaming a new one over it is still
+// followed. returns false if the directory can't be watched
+bool file_watch_add(const char* path, file_watch_fn on_change,
+                    void* data);
+// reads the changes the kernel reported since the last call and
+// calls the watches they concern, once each. called every frame
+void file_watch_update(void);
@@ -300,8 +300,10 @@ void fuzzy_menu_draw_options(fuzzy_menu_t* fm, ff_typo_t typo,
         GetScreenHeight() + fm->motion.position[0],
         fm->motion.position[0], -1.0f, 1.0f, projection);
 
-    ff_draw(typo.font, fm->glyphs.data, fm->glyphs.len,
-            (float*)projection);
+    float clip[4] = {(int)dimensions.bounds_x, (int)options_rec.y,
+                     (int)options_rec.width, (int)options_rec.height};
+    ff_batch_draw(typo.font, fm->glyphs.data, fm->glyphs.len,
+                  (float*)projection, clip);
     EndScissorMode();
 }
 
@@ -329,19 +331,22 @@ const c32_t* fuzzy_menu_handle_user_input(fuzzy_menu_t* fm) {
 }
 
 bool fuzzy_menu_buffer_changed(fuzzy_menu_t* fm) {
-    return fm->editor.text.buffer->str.length !=
+    return fm->editor.text.buffer->text.length !=
            fm->previous_buffer_size;
 }
 
 void fuzzy_menu_on_buffer_change(fuzzy_menu_t* fm) {
+    piece_table_t* text = &fm->editor.text.buffer->text;
+    c32_t input[text->length + 1];
+    piece_table_read(text, 0, text->length, input);
+
     for (size_t i = 0; i < fm->options_count; i += 1) {
         fm->options[i].edit_distance = similiarity_score(
-            fm->editor.text.buffer->str.data,
-            fm->editor.text.buffer->str.length, fm->options[i].name,
+            input, text->length, fm->options[i].name,
             fm->options[i].name_len);
     }
     quick_sort_options(fm->options, 0, fm->options_count - 1);
-    fm->previous_buffer_size = fm->editor.text.buffer->str.length;
+    fm->previous_buffer_size = text->length;
     fm->selected = 0;
 }
 
@@ -1,106 +1,211 @@
 #include "highlighter.h"
 
 #include <assert.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #include "../resources/resources.h"
-#include "serialization_map.h"
 #include "tree_sitter/api.h"
 #include "tree_sitter/parser.h"
 
-typedef struct {
-    char *source;
-    ulong size;
-} query_source_t;
-
 TSLanguage *tree_sitter_json();
 TSLanguage *tree_sitter_cpp();
 TSLanguage *tree_sitter_c();
 
-static const char *g_query_file[] = {
-    [language_c_t] = "queries/c/highlights.scm",
-    [language_cpp_t] = "queries/cpp/highlights.scm",
-    [language_json_t] = "queries/json/highlights.scm",
+// a language the highlighter knows of. grammars not linked in are
+// looked up as `tree_sitter_<name>` in the plugin
+// `grammars/libtree-sitter-<name>.so` of the resources
+typedef struct {
+    const char *name;
+    TSLanguage *(*grammar)(void);
+    const char *query_file;
+} language_def_t;
+
+static const language_def_t g_language_defs[language_count_t] = {
+    [language_c_t] = {.name = "c",
+                      .grammar = tree_sitter_c,
+                      .query_file = "queries/c/highlights.scm"},
+    [language_cpp_t] = {.name = "cpp",
+                        .grammar = tree_sitter_cpp,
+                        .query_file = "queries/cpp/highlights.scm"},
+    [language_json_t] = {.name = "json",
+                         .grammar = tree_sitter_json,
+                         .query_file = "queries/json/highlights.scm"},
+};
+
+enum language_state {
+    language_state_unloaded,
+    language_state_loaded,
+    language_state_failed,
+};
+
+// a language is loaded the first time a text of it is parsed, which
+// happens on the thread loading the file or on a parse worker. the
+// rest is left alone once `state` is set
+typedef struct {
+    atomic_int state;
+    TSLanguage *grammar;
+    TSQuery *query;
+    // the kind of every capture of the query, by capture id
+    enum token_kind *capture_kinds;
+    void *plugin;
+} language_t;
+
+static language_t g_languages[language_count_t];
+static mtx_t g_languages_lock;
+
+typedef struct {
+    const char *name;
+    enum token_kind kind;
+} capture_kind_t;
+
+typedef struct {
+    const char *dot_ext;
+    enum language language;
+} extension_t;
+
+// clang-format off
+static const capture_kind_t g_capture_names[] = {
+    {"keyword", token_kind_keyword_t},
+    {"function", token_kind_function_t},
+    {"string", token_kind_string_t},
+    {"number", token_kind_number_t},
+    {"operator", token_kind_operator_t},
+    {"type", token_kind_type_t},
+    {"constant", token_kind_constant_t},
+    {"constant.numeric", token_kind_constant_numeric_t},
+    {"variable", token_kind_variable_t},
+    {"variable.parameter", token_kind_variable_parameter_t},
+    {"variable.other.member", token_kind_variable_other_member_t},
+    {"delimiter", token_kind_delimiter_t},
+    {"property", token_kind_property_t},
+    {"comment", token_kind_comment_t},
+    {"keyword.directive", token_kind_keyword_directive_t},
+    {"keyword.control.return", token_keyword_control_return_t},
+    {"keyword.control.conditional", token_keyword_control_conditional_t},
+    {"keyword.control.repeat", token_keyword_control_repeat_t},
+    {"keyword.storage.type", token_keyword_storage_type_t},
+    {"keyword.storage.modifier", token_keyword_storage_modifier_t},
+    {"keyword.control", token_keyword_control_t},
+    {"type.builtin", token_type_builtin_t},
+    {"punctuation", token_punctuation_t},
+    {"punctuation.delimiter", token_punctuation_delimiter_t},
+    {"punctuation.bracket", token_punctuation_bracket_t},
+    {"constant.builtin.boolean", token_constant_builtin_boolean_t},
+    {"type.enum.variant", token_type_enum_variant_t},
+    {"constant.character", token_constant_character_t},
+    {"constant.character.escape", token_constant_character_escape_t},
+    {"label", token_label_t},
 };
-static TSLanguage *g_languages[language_count_t] = {0};
-static query_source_t g_querie_sources[language_count_t] = {0};
-static TSQuery *g_queries[language_count_t] = {0};
-static TSParser *g_parser = {0};
-static serialization_map_t g_token_map = {0};
-static serialization_map_t g_extension_map = {0};
-
-static void load_query(enum language lang) {
+
+static const extension_t g_extensions[] = {
+    {".c", language_c_t},
+    {".h", language_c_t},
+    {".cpp", language_cpp_t},
+    {".json", language_json_t},
+};
+// clang-format on
+
+static enum token_kind capture_kind(const char *name, size_t len) {
+    ulong names_length =
+        sizeof(g_capture_names) / sizeof(*g_capture_names);
+    for (ulong i = 0; i < names_length; i += 1) {
+        const char *capture_name = g_capture_names[i].name;
+        if (strlen(capture_name) == len &&
+            !memcmp(capture_name, name, len))
+            return g_capture_names[i].kind;
+    }
+    return token_kind_unknown_t;
+}
+
+__attribute__((constructor)) static void hlr_setup(void) {
+    int result = mtx_init(&g_languages_lock, mtx_plain);
+    assert(result == thrd_success);
+}
+
+static TSLanguage *load_plugin(language_t *m,
+                               const language_def_t *def) {
+    char name[128] = {0};
+    char path[RESOURCE_PATH_SIZE] = {0};
+    snprintf(name, sizeof(name), "grammars/libtree-sitter-%s.so",
+             def->name);
+    resource_file_path(name, path);
+    m->plugin = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!m->plugin) return 0;
+
+    snprintf(name, sizeof(name), "tree_sitter_%s", def->name);
+    TSLanguage *(*grammar)(void) = 0;
+    *(void **)&grammar = dlsym(m->plugin, name);
+    return grammar ? grammar() : 0;
+}
+
+// fails if the query doesn't fit the grammar, as with a plugin built
+// from another version of it
+static bool load_query(language_t *m, const language_def_t *def) {
+    char *source = resource_file_load(def->query_file);
+    uint32_t error_offset = 0;
     TSQueryError error;
-    g_queries[lang] =
-        ts_query_new(g_languages[lang], g_querie_sources[lang].source,
-                     g_querie_sources[lang].size, 0, &error);
-    assert(error == TSQueryErrorNone);
+    m->query = ts_query_new(m->grammar, source, strlen(source),
+                            &error_offset, &error);
+    resource_file_free(source);
+    if (!m->query) return false;
+
+    // captures are told apart by id while querying, their names are
+    // looked up once here
+    uint32_t captures_length = ts_query_capture_count(m->query);
+    m->capture_kinds =
+        malloc(captures_length * sizeof(enum token_kind) + 1);
+    assert(m->capture_kinds);
+    for (uint32_t i = 0; i < captures_length; i += 1) {
+        uint32_t name_length = 0;
+        const char *name =
+            ts_query_capture_name_for_id(m->query, i, &name_length);
+        m->capture_kinds[i] = capture_kind(name, name_length);
+    }
+    return true;
 }
 
-void hlr_init() {
-    g_languages[language_c_t] = tree_sitter_c();
-    g_languages[language_cpp_t] = tree_sitter_cpp();
-    g_languages[language_json_t] = tree_sitter_json();
+bool hlr_language_load(enum language lang) {
+    assert(lang > language_none_t && lang < language_count_t);
+    language_t *m = &g_languages[lang];
+    int state = atomic_load_explicit(&m->state, memory_order_acquire);
+    if (state != language_state_unloaded)
+        return state == language_state_loaded;
 
-    for (ulong i = 0; i < language_count_t; i += 1) {
-        g_querie_sources[i].source =
-            resource_file_load(g_query_file[i]);
-        g_querie_sources[i].size = strlen(g_querie_sources[i].source);
-        load_query(i);
-        resource_file_free(g_querie_sources[i].source);
-    }
-
-    g_parser = ts_parser_new();
-    g_token_map = serialization_map_create();
-
-    // clang-format off
-    serialization_map_set(&g_token_map, "keyword", token_kind_keyword_t);
-    serialization_map_set(&g_token_map, "function", token_kind_function_t);
-    serialization_map_set(&g_token_map, "string", token_kind_string_t);
-    serialization_map_set(&g_token_map, "number", token_kind_number_t);
-    serialization_map_set(&g_token_map, "operator", token_kind_operator_t);
-    serialization_map_set(&g_token_map, "type", token_kind_type_t);
-    serialization_map_set(&g_token_map, "constant", token_kind_constant_t);
-    serialization_map_set(&g_token_map, "constant.numeric", token_kind_constant_numeric_t);
-    serialization_map_set(&g_token_map, "variable", token_kind_variable_t);
-    serialization_map_set(&g_token_map, "variable.parameter", token_kind_variable_parameter_t);
-    serialization_map_set(&g_token_map, "variable.other.member", token_kind_variable_other_member_t);
-    serialization_map_set(&g_token_map, "delimiter", token_kind_delimiter_t);
-    serialization_map_set(&g_token_map, "property", token_kind_property_t);
-    serialization_map_set(&g_token_map, "comment", token_kind_comment_t);
-    serialization_map_set(&g_token_map, "keyword.directive", token_kind_keyword_directive_t);
-    serialization_map_set(&g_token_map, "keyword.control.return", token_keyword_control_return_t);
-    serialization_map_set(&g_token_map, "keyword.control.conditional", token_keyword_control_conditional_t);
-    serialization_map_set(&g_token_map, "keyword.control.repeat", token_keyword_control_repeat_t);
-    serialization_map_set(&g_token_map, "keyword.storage.type", token_keyword_storage_type_t);
-    serialization_map_set(&g_token_map, "keyword.storage.modifier", token_keyword_storage_modifier_t);
-    serialization_map_set(&g_token_map, "keyword.control", token_keyword_control_t);
-    serialization_map_set(&g_token_map, "type.builtin", token_type_builtin_t);
-    serialization_map_set(&g_token_map, "punctuation", token_punctuation_t);
-    serialization_map_set(&g_token_map, "punctuation.delimiter", token_punctuation_delimiter_t);
-    serialization_map_set(&g_token_map, "punctuation.bracket", token_punctuation_bracket_t);
-    serialization_map_set(&g_token_map, "constant.builtin.boolean", token_constant_builtin_boolean_t);
-    serialization_map_set(&g_token_map, "type.enum.variant", token_type_enum_variant_t);
-    serialization_map_set(&g_token_map, "constant.character", token_constant_character_t);
-    serialization_map_set(&g_token_map, "constant.character.escape", token_constant_character_escape_t);
-    serialization_map_set(&g_token_map, "label", token_label_t);
-
-    g_extension_map = serialization_map_create();
-    serialization_map_set(&g_extension_map, ".c", language_c_t);
-    serialization_map_set(&g_extension_map, ".h", language_c_t);
-    serialization_map_set(&g_extension_map, ".cpp", language_cpp_t);
-    serialization_map_set(&g_extension_map, ".json", language_json_t);
-    // clang-format on
+    mtx_lock(&g_languages_lock);
+    state = atomic_load_explicit(&m->state, memory_order_relaxed);
+    if (state == language_state_unloaded) {
+        const language_def_t *def = &g_language_defs[lang];
+        m->grammar =
+            def->grammar ? def->grammar() : load_plugin(m, def);
+        state = m->grammar && load_query(m, def)
+                    ? language_state_loaded
+                    : language_state_failed;
+        atomic_store_explicit(&m->state, state, memory_order_release);
+    }
+    mtx_unlock(&g_languages_lock);
+    return state == language_state_loaded;
+}
+
+bool hlr_language_is_missing(enum language lang) {
+    assert(lang > language_none_t && lang < language_count_t);
+    return atomic_load_explicit(&g_languages[lang].state,
+                                memory_order_relaxed) ==
+           language_state_failed;
 }
 
 void hlr_terminate() {
     for (ulong i = 0; i < language_count_t; i += 1) {
-        ts_query_delete(g_queries[i]);
+        language_t *m = &g_languages[i];
+        if (m->query) ts_query_delete(m->query);
+        free(m->capture_kinds);
+        if (m->plugin) dlclose(m->plugin);
+        *m = (language_t){0};
     }
-    ts_parser_delete(g_parser);
-    serialization_map_destroy(&g_token_map);
-    serialization_map_destroy(&g_extension_map);
 }
 
 tokens_t hlr_tokens_create() {
@@ -108,11 +213,22 @@ tokens_t hlr_tokens_create() {
         .data = (token_t *)calloc(2, sizeof(token_t)),
         .length = 0,
         .capacity = sizeof(token_t) * 2,
+        .rows = HLR_ROWS_EMPTY,
     };
     return tokens;
 }
 
-static void hlr_tokens_reset(tokens_t *tokens) { tokens->length = 0; }
+void hlr_tokens_copy(tokens_t *dest, const tokens_t *src) {
+    ulong required_capacity = src->length * sizeof(token_t);
+    while (required_capacity > dest->capacity) {
+        dest->capacity *= 2;
+        dest->data = realloc(dest->data, dest->capacity);
+        assert(dest->data != NULL);
+    }
+    memcpy(dest->data, src->data, required_capacity);
+    dest->length = src->length;
+    dest->rows = src->rows;
+}
 
 static void tokens_push(tokens_t *o, token_t token) {
     ulong new_size = sizeof(token_t) * (o->length + 1);
@@ -126,14 +242,15 @@ static void tokens_push(tokens_t *o, token_t token) {
     o->data[o->length++] = token;
 };
 
-highlighter_t hlr_highlighter_create(enum language lang,
-                                     const char *buffer,
-                                     size_t buffer_size) {
-    if (buffer_size == 0)
+highlighter_t hlr_highlighter_create_with_parser(TSParser *parser,
+                                                 enum language lang,
+                                                 const char *buffer,
+                                                 size_t buffer_size) {
+    if (buffer_size == 0 || !hlr_language_load(lang))
         return (highlighter_t){.tree = 0, .language = lang};
-    ts_parser_set_language(g_parser, g_languages[lang]);
+    ts_parser_set_language(parser, g_languages[lang].grammar);
     return (highlighter_t){.tree = ts_parser_parse_string(
-                               g_parser, NULL, buffer, buffer_size),
+                               parser, NULL, buffer, buffer_size),
                            .language = lang};
 }
 
@@ -141,54 +258,422 @@ void hlr_highlighter_destroy(highlighter_t *m) {
     ts_tree_delete(m->tree);
 }
 
-void hlr_highlighter_update(highlighter_t *m, const char *buffer,
-                            size_t buffer_size) {
-    ts_parser_set_language(g_parser, g_languages[m->language]);
+static void hlr_rows_add(hlr_rows_t *m, ulong start, ulong end) {
+    if (start < m->start) m->start = start;
+    if (end > m->end) m->end = end;
+}
+
+// adds the rows of the error nodes under `node`. error recovery may
+// read what an edit left around them differently without the changed
+// ranges telling, so they are always queried again
+static void hlr_rows_add_errors(hlr_rows_t *m, TSNode node) {
+    if (!ts_node_has_error(node)) return;
+    if (ts_node_is_error(node) || ts_node_is_missing(node)) {
+        hlr_rows_add(m, ts_node_start_point(node).row,
+                     ts_node_end_point(node).row);
+        return;
+    }
+    TSTreeCursor cursor = ts_tree_cursor_new(node);
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+        do {
+            hlr_rows_add_errors(m,
+                                ts_tree_cursor_current_node(&cursor));
+        } while (ts_tree_cursor_goto_next_sibling(&cursor));
+    }
+    ts_tree_cursor_delete(&cursor);
+}
+
+bool hlr_highlighter_update(highlighter_t *m, TSParser *parser,
+                            TSInput input, hlr_rows_t *changed) {
+    if (!hlr_language_load(m->language)) return false;
+    ts_parser_set_language(parser, g_languages[m->language].grammar);
+    // the old tree was edited along with the text, so the parser only
+    // revisits the nodes the edits touched
+    TSTree *tmp = ts_parser_parse(parser, m->tree, input);
+    if (!tmp) return false;
     if (!m->tree) {
-        m->tree = ts_parser_parse_string(g_parser, NULL, buffer,
-                                         buffer_size);
-    } else {
-        TSTree *tmp = ts_parser_parse_string(g_parser, NULL, buffer,
-                                             buffer_size);
-        ts_tree_delete(m->tree);
         m->tree = tmp;
+        return true;
     }
+
+    uint32_t ranges_length = 0;
+    TSRange *ranges =
+        ts_tree_get_changed_ranges(m->tree, tmp, &ranges_length);
+    for (uint32_t i = 0; i < ranges_length; i += 1)
+        hlr_rows_add(changed, ranges[i].start_point.row,
+                     ranges[i].end_point.row);
+    free(ranges);
+    hlr_rows_add_errors(changed, ts_tree_root_node(tmp));
+
+    ts_tree_delete(m->tree);
+    m->tree = tmp;
+    return true;
 }
 
-void hlr_tokens_update(highlighter_t *m, tokens_t *ts) {
-    assert(m->language != language_none_t);
-    assert(m->tree != NULL);
-    hlr_tokens_reset(ts);
-    TSNode root = ts_tree_root_node(m->tree);
-    assert(!ts_node_is_null(root));
+void hlr_highlighter_edit(highlighter_t *m, const hlr_edit_t *edit) {
+    if (m->tree) ts_tree_edit(m->tree, &edit->input);
+}
 
-    TSQueryCursor *cursor = ts_query_cursor_new();
-    ts_query_cursor_exec(cursor, g_queries[m->language], root);
+void hlr_rows_move(hlr_rows_t *m, const hlr_edit_t *edit) {
+    ulong start = edit->start.row;
+    ulong old_end = edit->old_end.row;
+    ulong new_end = edit->new_end.row;
+    if (m->start > m->end) return;
+    if (m->start > old_end)
+        m->start = m->start - old_end + new_end;
+    else if (m->start > start)
+        m->start = start;
+    if (m->end > old_end)
+        m->end = m->end - old_end + new_end;
+    else if (m->end >= start)
+        m->end = new_end;
+}
+
+void hlr_rows_edit(hlr_rows_t *m, const hlr_edit_t *edit) {
+    hlr_rows_move(m, edit);
+    hlr_rows_add(m, edit->start.row, edit->new_end.row);
+}
+
+static bool text_pos_less(text_pos_t a, text_pos_t b) {
+    return a.row < b.row || (a.row == b.row && a.column < b.column);
+}
+
+static text_pos_t hlr_edit_pos(text_pos_t pos,
+                               const hlr_edit_t *edit) {
+    if (text_pos_less(pos, edit->start)) return pos;
+    if (text_pos_less(pos, edit->old_end)) return edit->start;
+    if (pos.row != edit->old_end.row)
+        return (text_pos_t){
+            .row = pos.row - edit->old_end.row + edit->new_end.row,
+            .column = pos.column};
+    return (text_pos_t){.row = edit->new_end.row,
+                        .column = pos.column - edit->old_end.column +
+                                  edit->new_end.column};
+}
+
+void hlr_tokens_edit(tokens_t *m, const hlr_edit_t *edit) {
+    for (ulong i = 0; i < m->length; i += 1) {
+        token_pos_t *position = &m->data[i].position;
+        position->start = hlr_edit_pos(position->start, edit);
+        position->end = hlr_edit_pos(position->end, edit);
+    }
+    hlr_rows_move(&m->rows, edit);
+}
+
+static const char *hlr_string_read(void *payload, uint32_t byte,
+                                   TSPoint position,
+                                   uint32_t *bytes_read) {
+    (void)position;
+    hlr_string_t *m = payload;
+    if (byte >= m->size) {
+        *bytes_read = 0;
+        return "";
+    }
+    *bytes_read = m->size - byte;
+    return &m->data[byte];
+}
+
+TSInput hlr_string_input(hlr_string_t *m) {
+    return (TSInput){.payload = m,
+                     .read = hlr_string_read,
+                     .encoding = TSInputEncodingUTF8};
+}
+
+// the start of the row whose columns are being converted, read
+// through the input only as far as the columns asked for. tokens come
+// in order, so the codepoints of a row are counted once
+typedef struct {
+    TSInput input;
+    ulong row;
+    uint32_t byte;
+    char *data;
+    ulong length;
+    ulong capacity;
+    ulong byte_column;
+    ulong column;
+} hlr_line_t;
+
+static hlr_line_t hlr_line_create(TSInput input) {
+    hlr_line_t result = {.input = input,
+                         .row = (ulong)-1,
+                         .data = malloc(0x100),
+                         .capacity = 0x100};
+    assert(result.data);
+    return result;
+}
+
+static void hlr_line_destroy(hlr_line_t *m) { free(m->data); }
+
+// tree-sitter points hold byte columns, the text view indexes glyphs
+// by codepoint
+static ulong hlr_line_column(hlr_line_t *m, uint32_t byte,
+                             TSPoint point) {
+    if (point.row != m->row) {
+        m->row = point.row;
+        m->byte = byte - point.column;
+        m->length = 0;
+        m->byte_column = 0;
+        m->column = 0;
+    }
+
+    while (m->length < point.column) {
+        uint32_t read = 0;
+        const char *chunk = m->input.read(
+            m->input.payload, m->byte + m->length,
+            (TSPoint){.row = point.row, .column = m->length}, &read);
+        if (!read) break;
+        if (read > point.column - m->length)
+            read = point.column - m->length;
+
+        ulong required_capacity = m->length + read;
+        while (required_capacity > m->capacity) {
+            m->capacity *= 2;
+            m->data = realloc(m->data, m->capacity);
+            assert(m->data);
+        }
+        memcpy(&m->data[m->length], chunk, read);
+        m->length += read;
+    }
+
+    if (point.column < m->byte_column) {
+        m->byte_column = 0;
+        m->column = 0;
+    }
+    ulong byte_column =
+        point.column < m->length ? point.column : m->length;
+    for (; m->byte_column < byte_column; m->byte_column += 1)
+        m->column += (m->data[m->byte_column] & 0xc0) != 0x80;
+    return m->column;
+}
 
+// whether the token starts in the rows or runs into them from
+// before. tokens an edit emptied sit at its start, on a row it wrote
+static bool hlr_token_is_in_rows(token_t *token, hlr_rows_t rows) {
+    text_pos_t start = token->position.start;
+    text_pos_t end = token->position.end;
+    bool is_past_start =
+        end.row > rows.start || (end.row == rows.start && end.column);
+    return start.row <= rows.end &&
+           (start.row >= rows.start || is_past_start);
+}
+
+// pushes the first capture of every match of `cursor`, skipping those
+// outside of `rows`
+static void hlr_tokens_push_matches(highlighter_t *m, tokens_t *ts,
+                                    TSInput input,
+                                    TSQueryCursor *cursor,
+                                    hlr_rows_t rows) {
+    hlr_line_t line = hlr_line_create(input);
     TSQueryMatch match = {0};
     while (ts_query_cursor_next_match(cursor, &match)) {
-        TSPoint start = ts_node_start_point(match.captures->node);
-        TSPoint end = ts_node_end_point(match.captures->node);
-        unsigned name_length = 0;
-        const char *name = ts_query_capture_name_for_id(
-            g_queries[m->language], match.captures->index,
-            &name_length);
-
+        TSNode node = match.captures->node;
+        TSPoint start = ts_node_start_point(node);
+        TSPoint end = ts_node_end_point(node);
+        start.column =
+            hlr_line_column(&line, ts_node_start_byte(node), start);
+        end.column =
+            hlr_line_column(&line, ts_node_end_byte(node), end);
+        enum token_kind *kinds =
+            g_languages[m->language].capture_kinds;
         token_t token = {
-            .kind = serialization_map_get(&g_token_map, name,
-                                          name_length),
+            .kind = kinds[match.captures->index],
             .position = {
                 .start = {.row = start.row, .column = start.column},
                 .end = {.row = end.row, .column = end.column}}};
+        if (!hlr_token_is_in_rows(&token, rows)) continue;
         tokens_push(ts, token);
     }
+    hlr_line_destroy(&line);
+}
+
+// queries the tokens of `rows` again and keeps the rest
+static void hlr_tokens_query_rows(highlighter_t *m, tokens_t *ts,
+                                  TSInput input, hlr_rows_t rows) {
+    if (rows.start > rows.end) return;
+
+    // tokens before the rows stay in place, those after them are set
+    // aside until the rows are queried so the tokens stay in order
+    ulong kept = 0;
+    ulong after_length = 0;
+    token_t *after = malloc(ts->length * sizeof(token_t) + 1);
+    assert(after);
+    for (ulong i = 0; i < ts->length; i += 1) {
+        token_t *token = &ts->data[i];
+        if (hlr_token_is_in_rows(token, rows)) continue;
+        if (token->position.start.row < rows.start)
+            ts->data[kept++] = *token;
+        else
+            after[after_length++] = *token;
+    }
+    ts->length = kept;
 
+    TSNode root = ts_tree_root_node(m->tree);
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    // tree-sitter leaves out the nodes ending where the range starts,
+    // starting it at the end of the row before keeps the empty ones
+    TSPoint range_start = {.row = rows.start, .column = 0};
+    if (rows.start)
+        range_start = (TSPoint){.row = rows.start - 1,
+                                .column = UINT32_MAX};
+    ts_query_cursor_set_point_range(
+        cursor, range_start,
+        (TSPoint){.row = rows.end + 1, .column = 0});
+    TSQuery *query = g_languages[m->language].query;
+    ts_query_cursor_exec(cursor, query, root);
+    hlr_tokens_push_matches(m, ts, input, cursor, rows);
     ts_query_cursor_delete(cursor);
+
+    for (ulong i = 0; i < after_length; i += 1)
+        tokens_push(ts, after[i]);
+    free(after);
+}
+
+void hlr_tokens_update(highlighter_t *m, tokens_t *ts, TSInput input,
+                       hlr_rows_t rows) {
+    ts->length = 0;
+    ts->rows = HLR_ROWS_EMPTY;
+    hlr_tokens_update_view(m, ts, input, HLR_ROWS_EMPTY, rows);
+}
+
+void hlr_tokens_update_view(highlighter_t *m, tokens_t *ts,
+                            TSInput input, hlr_rows_t changed,
+                            hlr_rows_t view) {
+    assert(m->language != language_none_t);
+    assert(m->tree != NULL);
+
+    hlr_rows_t held = ts->rows;
+    hlr_rows_t rows = HLR_ROWS_EMPTY;
+    if (held.start > held.end || held.start > view.end ||
+        held.end < view.start) {
+        ts->length = 0;
+        rows = view;
+    } else {
+        ulong kept = 0;
+        for (ulong i = 0; i < ts->length; i += 1)
+            if (hlr_token_is_in_rows(&ts->data[i], view))
+                ts->data[kept++] = ts->data[i];
+        ts->length = kept;
+
+        if (view.start < held.start)
+            hlr_rows_add(&rows, view.start, held.start - 1);
+        if (view.end > held.end)
+            hlr_rows_add(&rows, held.end + 1, view.end);
+        ulong start =
+            changed.start > view.start ? changed.start : view.start;
+        ulong end = changed.end < view.end ? changed.end : view.end;
+        if (start <= end) hlr_rows_add(&rows, start, end);
+    }
+
+    ts->rows = view;
+    hlr_tokens_query_rows(m, ts, input, rows);
+}
+
+hlr_spans_t hlr_spans_create() {
+    hlr_spans_t result = {
+        .data = malloc(sizeof(hlr_span_t) * 2),
+        .length = 0,
+        .capacity = sizeof(hlr_span_t) * 2,
+        .first = calloc(2, sizeof(ulong)),
+        .first_capacity = sizeof(ulong) * 2,
+        .rows = HLR_ROWS_EMPTY,
+    };
+    assert(result.data != NULL);
+    assert(result.first != NULL);
+    return result;
+}
+
+void hlr_spans_destroy(hlr_spans_t *m) {
+    free(m->data);
+    free(m->first);
+}
+
+static bool hlr_spans_is_shown(const token_t *token,
+                               hlr_rows_t rows) {
+    return token->kind != token_kind_unknown_t &&
+           token->position.start.row == token->position.end.row &&
+           token->position.start.row >= rows.start &&
+           token->position.start.row <= rows.end;
+}
+
+void hlr_spans_update(hlr_spans_t *m, const tokens_t *ts) {
+    m->length = 0;
+    m->rows = ts->rows;
+    if (m->rows.start > m->rows.end) return;
+    ulong rows_length = m->rows.end - m->rows.start + 1;
+
+    ulong required_capacity = (rows_length + 1) * sizeof(ulong);
+    while (required_capacity > m->first_capacity) {
+        m->first_capacity *= 2;
+        m->first = realloc(m->first, m->first_capacity);
+        assert(m->first != NULL);
+    }
+    required_capacity = (ts->length + 1) * sizeof(hlr_span_t);
+    while (required_capacity > m->capacity) {
+        m->capacity *= 2;
+        m->data = realloc(m->data, m->capacity);
+        assert(m->data != NULL);
+    }
+
+    // the tokens are counted by row so they can be placed in one pass
+    // whatever order they were captured in
+    memset(m->first, 0, (rows_length + 1) * sizeof(ulong));
+    for (ulong i = 0; i < ts->length; i += 1) {
+        const token_t *token = &ts->data[i];
+        if (!hlr_spans_is_shown(token, m->rows)) continue;
+        m->first[token->position.start.row - m->rows.start + 1] += 1;
+    }
+    for (ulong i = 1; i <= rows_length; i += 1)
+        m->first[i] += m->first[i - 1];
+
+    // each row's start is moved to its end while it is filled
+    for (ulong i = 0; i < ts->length; i += 1) {
+        const token_t *token = &ts->data[i];
+        if (!hlr_spans_is_shown(token, m->rows)) continue;
+        ulong row = token->position.start.row - m->rows.start;
+        m->data[m->first[row]++] =
+            (hlr_span_t){.start = token->position.start.column,
+                         .end = token->position.end.column,
+                         .kind = token->kind};
+    }
+    for (ulong i = rows_length; i > 0; i -= 1)
+        m->first[i] = m->first[i - 1];
+    m->first[0] = 0;
+
+    // a node captured by several patterns shows up once for each
+    ulong begin = 0;
+    for (ulong i = 0; i < rows_length; i += 1) {
+        ulong end = m->first[i + 1];
+        m->first[i] = m->length;
+        for (ulong ii = begin; ii < end; ii += 1) {
+            if (m->length > m->first[i] &&
+                m->data[m->length - 1].start == m->data[ii].start)
+                continue;
+            m->data[m->length++] = m->data[ii];
+        }
+        begin = end;
+    }
+    m->first[rows_length] = m->length;
+}
+
+const hlr_span_t *hlr_spans_get(const hlr_spans_t *m, ulong row,
+                                ulong *length) {
+    if (m->rows.start > m->rows.end || row < m->rows.start ||
+        row > m->rows.end) {
+        *length = 0;
+        return m->data;
+    }
+    row -= m->rows.start;
+    *length = m->first[row + 1] - m->first[row];
+    return &m->data[m->first[row]];
 }
 
 enum language hlr_get_extension_language(const char *dot_ext) {
-    return serialization_map_get(&g_extension_map, dot_ext,
-                                 strlen(dot_ext));
+    ulong extensions_length =
+        sizeof(g_extensions) / sizeof(*g_extensions);
+    for (ulong i = 0; i < extensions_length; i += 1)
+        if (!strcmp(g_extensions[i].dot_ext, dot_ext))
+            return g_extensions[i].language;
+    return language_none_t;
 }
 
 void hlr_tokens_destroy(tokens_t *m) {
@@ -196,4 +681,5 @@ void hlr_tokens_destroy(tokens_t *m) {
     m->data = 0;
     m->length = 0;
     m->capacity = 0;
+    m->rows = HLR_ROWS_EMPTY;
 }
@@ -54,12 +54,41 @@ typedef struct {
     token_pos_t position;
 } token_t;
 
+// inclusive range of rows, empty while `start` > `end`
+typedef struct {
+    ulong start;
+    ulong end;
+} hlr_rows_t;
+
+#define HLR_ROWS_EMPTY ((hlr_rows_t){.start = (ulong)-1, .end = 0})
+
 typedef struct {
     token_t* data;
     ulong length;
     ulong capacity;
+    // the rows queried, tokens are held for these alone
+    hlr_rows_t rows;
 } tokens_t;
 
+// a run of codepoint columns of a row in the color of `kind`
+typedef struct {
+    ulong start;
+    ulong end;
+    enum token_kind kind;
+} hlr_span_t;
+
+// the single row tokens laid out by row, so the ones of a row are
+// found without walking the tokens before it
+typedef struct {
+    hlr_span_t* data;
+    ulong length;
+    ulong capacity;
+    // the first span of each row of `rows` and one past the last
+    ulong* first;
+    ulong first_capacity;
+    hlr_rows_t rows;
+} hlr_spans_t;
+
 enum language {
     language_none_t = -1,
     language_c_t = 0,
@@ -73,15 +102,71 @@ typedef struct {
     enum language language;
 } highlighter_t;
 
-void hlr_init();
+// an edit of the text. tree-sitter takes it in bytes and byte
+// columns, tokens are moved by its codepoint positions
+typedef struct {
+    TSInputEdit input;
+    text_pos_t start;
+    text_pos_t old_end;
+    text_pos_t new_end;
+} hlr_edit_t;
+
+// UTF-8 text held in a single string
+typedef struct {
+    const char* data;
+    size_t size;
+} hlr_string_t;
+
+// compiles the grammar and query of the language the first time it
+// is asked for. false if its grammar can't be found
+bool hlr_language_load(enum language lang);
+// whether loading the language was tried and failed
+bool hlr_language_is_missing(enum language lang);
 void hlr_terminate();
-highlighter_t hlr_highlighter_create(enum language lang,
-                                     const char* buffer,
-                                     size_t buffer_size);
+// the tree is null if the parse was cancelled or the language can't
+// be loaded
+highlighter_t hlr_highlighter_create_with_parser(TSParser* parser,
+                                                 enum language lang,
+                                                 const char* buffer,
+                                                 size_t buffer_size);
 void hlr_highlighter_destroy(highlighter_t* m);
-void hlr_highlighter_update(highlighter_t* m, const char* buffer,
-                            size_t buffer_size);
+// reparses the text reusing what the edits left of the previous
+// tree, the rows where the syntax changed are added to `changed`.
+// `input` reads the text as UTF-8. false if the parse was cancelled,
+// which leaves the tree as it was and `parser` to be reset, or if the
+// language can't be loaded
+bool hlr_highlighter_update(highlighter_t* m, TSParser* parser,
+                            TSInput input, hlr_rows_t* changed);
+// called for every edit of the text before it is parsed again
+void hlr_highlighter_edit(highlighter_t* m, const hlr_edit_t* edit);
+// moves the rows along with the edit
+void hlr_rows_move(hlr_rows_t* m, const hlr_edit_t* edit);
+// moves the rows along with the edit and adds the rows it wrote
+void hlr_rows_edit(hlr_rows_t* m, const hlr_edit_t* edit);
 enum language hlr_get_extension_language(const char* dot_ext);
 tokens_t hlr_tokens_create();
 void hlr_tokens_destroy(tokens_t* m);
-void hlr_tokens_update(highlighter_t* m, tokens_t* ts);
+void hlr_tokens_copy(tokens_t* dest, const tokens_t* src);
+// an input reading `m`, which has to outlive it
+TSInput hlr_string_input(hlr_string_t* m);
+// queries the tokens of `rows` alone. `input` reads the text the tree
+// was parsed from, token columns are converted from its byte columns
+// to codepoint columns
+void hlr_tokens_update(highlighter_t* m, tokens_t* ts, TSInput input,
+                       hlr_rows_t rows);
+// moves the rows queried to `view`. the rows new to it and those of
+// `changed` in it are queried, the tokens left out of it are dropped
+void hlr_tokens_update_view(highlighter_t* m, tokens_t* ts,
+                            TSInput input, hlr_rows_t changed,
+                            hlr_rows_t view);
+hlr_spans_t hlr_spans_create();
+void hlr_spans_destroy(hlr_spans_t* m);
+// lays out the tokens again, the kind of a node captured by several
+// patterns is the one of the first
+void hlr_spans_update(hlr_spans_t* m, const tokens_t* ts);
+// the spans of `row`, in the order their tokens were captured
+const hlr_span_t* hlr_spans_get(const hlr_spans_t* m, ulong row,
+                                ulong* length);
+// moves the tokens and their rows after the edit, those it overwrote
+// are left at its start until their rows are queried again
+void hlr_tokens_edit(tokens_t* m, const hlr_edit_t* edit);
@@ -1,7 +1,9 @@
 #include <assert.h>
 #include <raylib.h>
+#include <rlgl.h>
 
 #include "buffer/buffer_handler.h"
+#include "buffer/buffer_parse.h"
 #include "buffer/buffer_picker.h"
 #include "commands.h"
 #include "compile.h"
@@ -11,6 +13,7 @@
 #include "fieldfusion.h"
 #include "file_picker/file_picker.h"
 #include "file_picker/file_preview.h"
+#include "file_watch.h"
 #include "focus.h"
 #include "highlighter/highlighter.h"
 #include "key_seq/key_seq.h"
@@ -139,8 +142,9 @@ static void main_init(void) {
 
     ff_initialize("430");
     resources_init();
-    hlr_init();
+    buffer_parse_init();
     cursor_initialize();
+    file_watch_init();
     preview_init();
     buffer_handler_init();
     buffer_picker_init();
@@ -160,9 +164,13 @@ static void main_terminate(void) {
     pane_controller_terminate();
     cursor_terminate();
     ff_terminate();
-    hlr_terminate();
+    buffer_parse_terminate();
     preview_terminate();
     buffer_handler_terminate();
+    // the parse workers and the threads loading the buffers above
+    // query with the highlighter's languages, and may still load them
+    hlr_terminate();
+    file_watch_terminate();
     buffer_picker_terminate();
     key_seq_handler_terminate();
     CloseWindow();
@@ -172,9 +180,18 @@ static void main_begin_frame(void) {
     BeginDrawing();
     ClearBackground((Color){0x1e, 0x1e, 0x2e, 0xff});
     key_seq_handler_begin_frame();
+    file_watch_update();
+}
+
+// draws the text queued over whatever raylib drew before it
+static void main_flush_text(void) {
+    rlDrawRenderBatchActive();
+    ff_batch_flush();
 }
 
 static void main_end_frame(void) {
+    main_flush_text();
+    buffer_handler_end_frame();
     kb_end_frame();
     key_seq_handler_end_frame();
     EndDrawing();
@@ -233,6 +250,8 @@ int main(void) {
             compile_draw(
                 g_cfg.typo, g_partitions.compile,
                 focus_flag_can_scroll | focus_flag_can_interact);
+        // the pickers and prompts are drawn over the panes
+        main_flush_text();
 
         if (g_focus[e_file_picker] & focus_flag_can_interact)
             handle_file_picker();
@@ -1,6 +1,7 @@
 #include "pane_controller.h"
 
 #include <fieldfusion.h>
+#include <rlgl.h>
 #include <string.h>
 
 #include "buffer/buffer_handler.h"
@@ -158,6 +159,13 @@ void pane_controler_draw(ff_typo_t typo, int focus_flags) {
 
         file_editor_draw(&g_file_editors[i], typo, rects[i], flags);
     }
+
+    // the text of every pane is drawn at once, before the fades that
+    // go over it
+    rlDrawRenderBatchActive();
+    ff_batch_flush();
+    for (size_t i = 0; i < rects_count; i += 1)
+        file_editor_draw_fade(rects[i]);
 }
 
 void pane_controller_open_in_focused(const char* file_name) {
@@ -1,7 +1,6 @@
 #include "prompt.h"
 
 #include <math.h>
-#include <rlgl.h>
 
 #include "buffer/buffer.h"
 #include "config.h"
@@ -38,13 +37,12 @@ prompt_result_t prompt_render(prompt_t* m) {
     float label_bg_x = GetScreenWidth() * .5f - w * .5f;
     float label_bg_y = GetScreenHeight() * .5f - h * .5f;
     DrawRectangle(label_bg_x, label_bg_y, w, h, GRAY);
-    rlDrawRenderBatchActive();
     float label_fg_x = label_bg_x + g_cfg.layout.padding;
     float label_fg_y = label_bg_y + g_cfg.layout.padding;
     ff_set_glyphs_pos(m->glyphs.data, m->glyphs.len, label_fg_x,
                       label_fg_y, g_cfg.typo.font, 0);
-    ff_draw(g_cfg.typo.font, m->glyphs.data, m->glyphs.len,
-            (float*)g_cfg.scr_proj);
+    ff_batch_draw(g_cfg.typo.font, m->glyphs.data, m->glyphs.len,
+                  (float*)g_cfg.scr_proj, 0);
 
     // float y = GetScreenHeight() * .5f - h * .5f;
     // float x = GetScreenWidth() * .5f - w * .5f;
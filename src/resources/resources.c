@@ -48,13 +48,19 @@ void resources_init(void) {
     }
 }
 
-char* resource_file_load(const char* name) {
+void resource_file_path(const char* name, char* dest) {
     assert(g_resources_dir_path_len != 0);
-    char file_path[256] = {0};
-    memcpy(file_path, g_resources_dir_path, g_resources_dir_path_len);
-    memcpy(&file_path[g_resources_dir_path_len], "/", 1);
-    memcpy(&file_path[g_resources_dir_path_len + 1], name,
-           strlen(name));
+    assert(g_resources_dir_path_len + 1 + strlen(name) <
+           RESOURCE_PATH_SIZE);
+    memset(dest, 0, RESOURCE_PATH_SIZE);
+    memcpy(dest, g_resources_dir_path, g_resources_dir_path_len);
+    memcpy(&dest[g_resources_dir_path_len], "/", 1);
+    memcpy(&dest[g_resources_dir_path_len + 1], name, strlen(name));
+}
+
+char* resource_file_load(const char* name) {
+    char file_path[RESOURCE_PATH_SIZE] = {0};
+    resource_file_path(name, file_path);
 
     assert(FileExists(file_path));
 
@@ -2,6 +2,8 @@
 #include <raylib.h>
 #include <stddef.h>
 
+#define RESOURCE_PATH_SIZE 256
+
 enum icon {
     icon_none_t = -1,
     icon_folder_t,
@@ -11,6 +13,9 @@ enum icon {
 };
 
 void resources_init(void);
+// writes the path of the resource `name` to `dest`, which holds
+// RESOURCE_PATH_SIZE bytes
+void resource_file_path(const char* name, char* dest);
 char* resource_file_load(const char* name);
 void resource_file_free(char* file);
 Texture get_icon(enum icon icon);
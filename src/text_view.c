@@ -21,24 +21,74 @@ inline static float font_space(float font_size) {
     return font_size + g_cfg.layout.text_spacing;
 }
 
+static text_view_lines_t text_view_lines_create(void) {
+    text_view_lines_t result = {
+        .glyphs = ff_glyph_vec_create(),
+        .text = malloc(0x100 * sizeof(c32_t)),
+        .text_capacity = 0x100 * sizeof(c32_t),
+        .runs = calloc(2, sizeof(ulong)),
+        .runs_capacity = sizeof(ulong) * 2,
+    };
+    assert(result.text);
+    assert(result.runs);
+    return result;
+}
+
+static void text_view_lines_destroy(text_view_lines_t* m) {
+    ff_glyph_vec_destroy(&m->glyphs);
+    free(m->text);
+    free(m->runs);
+}
+
+// appends the codepoints of the glyphs just added to `m->glyphs`
+static void text_view_lines_push_text(text_view_lines_t* m,
+                                      const c32_t* text, ulong len) {
+    ulong start = m->glyphs.len - len;
+    ulong required_capacity = m->glyphs.len * sizeof(c32_t);
+    while (required_capacity > m->text_capacity) {
+        m->text_capacity *= 2;
+        m->text = realloc(m->text, m->text_capacity);
+        assert(m->text);
+    }
+    memcpy(&m->text[start], text, len * sizeof(c32_t));
+}
+
 text_view_t text_view_create() {
     text_view_t result = {0};
     result.scroll_motion = motion_new();
     result.scroll_motion.f = 2.0f;
     result.scroll_motion.z = 1.0f;
     result.scroll_motion.r = -1.f;
-    result.glyphs = ff_glyph_vec_create();
+    result.lines = text_view_lines_create();
+    result.next_lines = text_view_lines_create();
+    result.line_capacity = 0x100 * sizeof(c32_t);
+    result.line = malloc(result.line_capacity);
+    assert(result.line);
     result.buffer = NULL;
     result.cursor = cursor_new();
     return result;
 }
 
 void text_view_destroy(text_view_t* m) {
-    ff_glyph_vec_destroy(&m->glyphs);
+    text_view_lines_destroy(&m->lines);
+    text_view_lines_destroy(&m->next_lines);
+    free(m->line);
+}
+
+static void text_view_read(text_view_t* m, c32_t* dest, ulong pos,
+                           ulong len) {
+    piece_table_read(&m->buffer->text, pos, len, dest);
 }
 
-static void utf32_substr(c32_t* dest, c32_t* src, ulong len) {
-    memcpy(dest, src, sizeof(c32_t) * len);
+// reads the line into `m->line`
+static void text_view_read_line(text_view_t* m, line_t line) {
+    ulong required_capacity = line_len(&line) * sizeof(c32_t);
+    while (required_capacity > m->line_capacity) {
+        m->line_capacity *= 2;
+        m->line = realloc(m->line, m->line_capacity);
+        assert(m->line);
+    }
+    text_view_read(m, m->line, line.start, line_len(&line));
 }
 
 static int get_token_color(enum token_kind kind) {
@@ -46,71 +96,219 @@ static int get_token_color(enum token_kind kind) {
     return g_cfg.color_scheme.syntax[kind];
 }
 
-static void highlight_glyph_line(text_view_t* m, size_t* token_index,
+static void highlight_glyph_line(text_view_t* m, ff_glyph_t* glyphs,
                                  size_t len, size_t line_n) {
-    static size_t last_row = -1;
-    static size_t last_col = -1;
-    for (; *token_index < m->buffer->syntax.tokens.length;
-         *token_index += 1) {
-        token_t token = m->buffer->syntax.tokens.data[*token_index];
-        if (token.position.start.row < line_n ||
-            (token.position.start.row == last_row &&
-             token.position.start.column == last_col) ||
-            token.kind == token_kind_unknown_t)
-            continue;
-        if (token.position.start.row > line_n) break;
-        bool is_multiline =
-            token.position.start.row != token.position.end.row;
-        if (is_multiline) continue;
-
-        size_t highlight_col_beg = token.position.start.column;
-        size_t highlight_col_end = token.position.end.column > len
-                                       ? len
-                                       : token.position.end.column;
-        int color = get_token_color(token.kind);
+    // spaces are left out as empty glyphs, which keep no color
+    for (size_t i = 0; i < len; i += 1)
+        if (glyphs[i].size) glyphs[i].color = m->layout.typo.color;
+    if (m->buffer->syntax.highlighter.language == language_none_t)
+        return;
+
+    ulong spans_length = 0;
+    const hlr_span_t* spans = buffer_syntax_get_spans(
+        &m->buffer->syntax, line_n, &spans_length);
+    for (ulong i = 0; i < spans_length; i += 1) {
+        size_t highlight_col_beg = spans[i].start;
+        size_t highlight_col_end =
+            spans[i].end > len ? len : spans[i].end;
+        int color = get_token_color(spans[i].kind);
         for (size_t iii = highlight_col_beg; iii < highlight_col_end;
-             iii += 1) {
-            size_t index = m->glyphs.len - len + iii;
-            m->glyphs.data[index].color = color;
+             iii += 1)
+            if (glyphs[iii].size) glyphs[iii].color = color;
+    }
+}
+
+// the row whose glyphs span the height `y` of the text, or the one
+// before it. rows are all as tall, so it takes a division. were rows
+// to wrap, an index of their heights would be searched here instead
+static ulong text_view_row_near(float font_size, float y) {
+    float row = y / font_space(font_size);
+    return row > 0 ? (ulong)row : 0;
+}
+
+static hlr_rows_t text_view_visible_rows(text_view_t* m,
+                                         ff_typo_t typo,
+                                         Rectangle bounds) {
+    ulong lines_length = m->buffer->lines.length;
+    // the rows found are off by one at most, they are stepped to the
+    // ones the tests tell
+    ulong start = text_view_row_near(typo.size,
+                                     m->scroll_motion.position[1]);
+    start = start > lines_length ? lines_length : start;
+    while (start > 0 &&
+           !text_view_is_line_above_view(m, typo, start - 1))
+        start -= 1;
+    while (start < lines_length &&
+           text_view_is_line_above_view(m, typo, start))
+        start += 1;
+    if (start == lines_length ||
+        text_view_is_line_below_view(m, typo, bounds, start))
+        return HLR_ROWS_EMPTY;
+
+    float bottom = bounds.height + m->scroll_motion.position[1];
+    ulong end = text_view_row_near(typo.size, bottom) + 1;
+    end = end < start ? start : end;
+    end = end >= lines_length ? lines_length - 1 : end;
+    while (end > start &&
+           text_view_is_line_below_view(m, typo, bounds, end))
+        end -= 1;
+    while (end + 1 < lines_length &&
+           !text_view_is_line_below_view(m, typo, bounds, end + 1))
+        end += 1;
+    return (hlr_rows_t){.start = start, .end = end};
+}
+
+static bool text_view_layout_equals(const text_view_layout_t* a,
+                                    const text_view_layout_t* b) {
+    return a->buffer == b->buffer && a->version == b->version &&
+           a->syntax_version == b->syntax_version &&
+           a->typo.font == b->typo.font &&
+           a->typo.size == b->typo.size &&
+           a->typo.color == b->typo.color && a->x == b->x &&
+           a->y == b->y && a->lines_length == b->lines_length &&
+           a->rows.start == b->rows.start &&
+           a->rows.end == b->rows.end;
+}
+
+// copies the glyphs `row` was laid out as last time to `dest`, false
+// if the row wasn't shown or, when the text changed, if `line` isn't
+// what it holds
+static bool text_view_reuse_line(text_view_t* m,
+                                 text_view_lines_t* dest,
+                                 const text_view_layout_t* layout,
+                                 ulong row, ulong to_row,
+                                 const c32_t* line, ulong len) {
+    text_view_layout_t* last = &m->layout;
+    if (row < last->rows.start || row > last->rows.end) return false;
+    ulong start = m->lines.runs[row - last->rows.start];
+    ulong end = m->lines.runs[row - last->rows.start + 1];
+    if (end - start != len) return false;
+    const c32_t* text = &m->lines.text[start];
+    if (line && memcmp(text, line, len * sizeof(c32_t))) return false;
+
+    ff_glyph_t* glyphs = &m->lines.glyphs.data[start];
+    float space = font_space(layout->typo.size);
+    float dx = layout->x - last->x;
+    float dy = layout->y - last->y +
+               ((float)to_row - (float)row) * space;
+    for (ulong i = 0; i < len; i += 1) {
+        ff_glyph_t glyph = glyphs[i];
+        if (glyph.size) {
+            glyph.position.x += dx;
+            glyph.position.y += dy;
         }
-        last_row = token.position.start.row;
-        last_col = token.position.start.column;
+        ff_glyph_vec_push(&dest->glyphs, glyph);
+    }
+    text_view_lines_push_text(dest, text, len);
+    return true;
+}
+
+// lays out the rows of `layout`, lines shown last time are moved
+// instead of being laid out again unless their text changed
+static void text_view_lay_out(text_view_t* m,
+                              const text_view_layout_t* layout) {
+    text_view_lines_t* next = &m->next_lines;
+    text_view_layout_t* last = &m->layout;
+    bool is_same_typo = last->buffer == layout->buffer &&
+                        last->typo.font == layout->typo.font &&
+                        last->typo.size == layout->typo.size;
+    bool is_same_text =
+        is_same_typo && last->version == layout->version;
+    // lines added or removed above move the rows below them
+    ulong shift = layout->lines_length - last->lines_length;
+
+    ulong rows_length = layout->rows.end - layout->rows.start + 1;
+    ulong required_capacity = (rows_length + 1) * sizeof(ulong);
+    while (required_capacity > next->runs_capacity) {
+        next->runs_capacity *= 2;
+        next->runs = realloc(next->runs, next->runs_capacity);
+        assert(next->runs);
+    }
+    ff_glyph_vec_clear(&next->glyphs);
+
+    float space = font_space(layout->typo.size);
+    for (ulong i = 0; i < rows_length; i += 1) {
+        ulong row = layout->rows.start + i;
+        line_t line = buffer_lines_get(&m->buffer->lines, row);
+        ulong len = line_len(&line);
+        ulong start = next->glyphs.len;
+        next->runs[i] = start;
+
+        // an unchanged text holds the same lines where they were,
+        // otherwise the line is looked for where it was before
+        bool is_reused = false;
+        const c32_t* text = 0;
+        if (!is_same_text) {
+            text_view_read_line(m, line);
+            text = m->line;
+        }
+        if (is_same_typo)
+            is_reused = text_view_reuse_line(m, next, layout, row,
+                                             row, text, len);
+        if (is_same_typo && !is_same_text && !is_reused && shift)
+            is_reused = text_view_reuse_line(m, next, layout,
+                                             row - shift, row, text,
+                                             len);
+        if (!is_reused) {
+            if (!text) text_view_read_line(m, line);
+            ff_print_utf32_vec(&next->glyphs, m->line, len,
+                               layout->typo, layout->x,
+                               layout->y + row * space,
+                               ff_flag_default, 0);
+            text_view_lines_push_text(next, m->line, len);
+        }
+        assert(next->glyphs.len - start == len);
+    }
+    next->runs[rows_length] = next->glyphs.len;
+
+    text_view_lines_t lines = m->lines;
+    m->lines = *next;
+    *next = lines;
+    m->layout = *layout;
+    for (ulong i = 0; i < rows_length; i += 1) {
+        ulong start = m->lines.runs[i];
+        highlight_glyph_line(m, &m->lines.glyphs.data[start],
+                             m->lines.runs[i + 1] - start,
+                             layout->rows.start + i);
     }
 }
 
 void text_view_update_glyphs(text_view_t* m, ff_typo_t typo,
                              Rectangle bounds) {
-    if (!m->buffer || m->buffer->str.length == 0) {
-        m->glyphs.len = 0;
+    if (!m->buffer) {
+        m->lines.glyphs.len = 0;
+        m->layout = (text_view_layout_t){0};
+        return;
+    }
+    if (m->buffer->text.length == 0) {
+        buffer_syntax_poll(&m->buffer->syntax, &m->buffer->text,
+                           HLR_ROWS_EMPTY);
+        m->lines.glyphs.len = 0;
+        m->layout = (text_view_layout_t){0};
         return;
     }
-    ff_glyph_vec_clear(&m->glyphs);
-    float line_pos_x = bounds.x;
-    float line_pos_y = bounds.y;
-
-    size_t token_index = 0;
-    for (ulong i = 0; i < m->buffer->lines.length; i += 1) {
-        if (text_view_is_line_above_view(m, typo, i)) {
-            line_pos_y += font_space(typo.size);
-            continue;
-        }
-        if (text_view_is_line_below_view(m, typo, bounds, i)) break;
-
-        line_t line = m->buffer->lines.data[i];
-        ulong line_length = line_len(&line);
-        c32_t* line_str = malloc(line_length * sizeof(c32_t));
-        memset(line_str, 0, sizeof(c32_t) * line_length);
-        utf32_substr(line_str, &m->buffer->str.data[line.start],
-                     line_length);
-        ff_print_utf32_vec(&m->glyphs, line_str, line_length, typo,
-                           line_pos_x, line_pos_y, ff_flag_default,
-                           0);
 
-        if (m->buffer->syntax.highlighter.language != language_none_t)
-            highlight_glyph_line(m, &token_index, line_length, i);
-        line_pos_y += font_space(typo.size);
-        free(line_str);
+    hlr_rows_t visible = text_view_visible_rows(m, typo, bounds);
+    text_view_layout_t layout = {
+        .buffer = m->buffer,
+        .version = m->buffer->version,
+        .syntax_version = m->buffer->syntax.version,
+        .typo = typo,
+        .x = bounds.x,
+        .y = bounds.y,
+        .lines_length = m->buffer->lines.length,
+        .rows = visible};
+    if (visible.start > visible.end) {
+        m->lines.glyphs.len = 0;
+        m->layout = (text_view_layout_t){0};
+    } else if (!text_view_layout_equals(&layout, &m->layout)) {
+        text_view_lay_out(m, &layout);
     }
+
+    // the tokens are queried for the rows shown, those of a parse
+    // that is done are laid out on the next frame
+    buffer_syntax_poll(&m->buffer->syntax, &m->buffer->text,
+                       visible);
 }
 
 bool text_view_is_line_below_view(text_view_t* m, ff_typo_t typo,
@@ -147,11 +345,11 @@ int text_view_selection_is_invalid(text_view_t* m) {
     if (m->selection.to_line >= m->buffer->lines.length) return -1;
 
     line_t from_buffer_line =
-        m->buffer->lines.data[m->selection.from_line];
+        buffer_lines_get(&m->buffer->lines, m->selection.from_line);
     if (m->selection.from_col > from_buffer_line.end) return -1;
 
     line_t to_buffer_line =
-        m->buffer->lines.data[m->selection.to_line];
+        buffer_lines_get(&m->buffer->lines, m->selection.to_line);
     if (m->selection.to_col > to_buffer_line.end) return -1;
 
     return 0;
@@ -177,8 +375,9 @@ void text_view_select(text_view_t* m, selection_t sel) {
     assert(m->selection.to_line < m->buffer->lines.length);
 
     ulong from_line_index =
-        m->buffer->lines.data[sel.from_line].start;
-    ulong to_line_index = m->buffer->lines.data[sel.to_line].start;
+        buffer_lines_get(&m->buffer->lines, sel.from_line).start;
+    ulong to_line_index =
+        buffer_lines_get(&m->buffer->lines, sel.to_line).start;
     ulong from = from_line_index + sel.from_col;
     ulong to = to_line_index + sel.to_col;
     ulong selection_char_count = to - from;
@@ -189,18 +388,30 @@ void text_view_select(text_view_t* m, selection_t sel) {
         m->text_flags &= ~text_flag_has_selection;
 }
 
+static bool text_view_is_line_above_mouse(float font_size,
+                                          Vector2 mouse,
+                                          float y_offset,
+                                          ulong line) {
+    float line_y = line * font_size + y_offset + font_size +
+                   line * g_cfg.layout.text_spacing;
+    return line_y <= mouse.y;
+}
+
 ulong text_view_get_mouse_hover_line(text_view_t* m, float font_size,
                                      Vector2 mouse, float y_offset) {
-    ulong result = 0;
+    ulong lines_length = m->buffer->lines.length;
     mouse.y += m->scroll_motion.position[1];
-    for (size_t i = 0; i < m->buffer->lines.length; i += 1) {
-        float line_y = i * font_size + y_offset + font_size +
-                       i * g_cfg.layout.text_spacing;
-        bool mouse_is_in_this_line = line_y > mouse.y;
-        if (!mouse_is_in_this_line) continue;
-        result = i;
-        break;
-    }
+    ulong result = text_view_row_near(font_size, mouse.y - y_offset);
+    result = result > lines_length ? lines_length : result;
+    while (result > 0 && !text_view_is_line_above_mouse(
+                             font_size, mouse, y_offset, result - 1))
+        result -= 1;
+    while (result < lines_length &&
+           text_view_is_line_above_mouse(font_size, mouse, y_offset,
+                                         result))
+        result += 1;
+    // past the last line
+    if (result == lines_length) return 0;
     return result;
 }
 
@@ -209,15 +420,15 @@ ulong text_view_get_mouse_hover_col(text_view_t* m, ff_typo_t typo,
                                     ulong hovering_line) {
     assert(m->buffer);
     assert(hovering_line < m->buffer->lines.length);
-    line_t matching_line = m->buffer->lines.data[hovering_line];
+    line_t matching_line =
+        buffer_lines_get(&m->buffer->lines, hovering_line);
     ulong matching_line_len = line_len(&matching_line);
     if (matching_line_len == 0) return 0;
 
     c32_t matching_line_str[matching_line_len + 1];
     matching_line_str[matching_line_len] = 0;
-    utf32_substr(matching_line_str,
-                 &m->buffer->str.data[matching_line.start],
-                 matching_line_len);
+    text_view_read(m, matching_line_str, matching_line.start,
+                   matching_line_len);
 
     ulong result = 0;
     float character_x = 0;
@@ -320,14 +531,13 @@ void text_scroll_with_cursor_horizontally(text_view_t* m,
                                           Rectangle bounds,
                                           text_pos_t curs_pos) {
     assert(m->buffer);
-    line_t line = m->buffer->lines.data[curs_pos.row];
+    line_t line = buffer_lines_get(&m->buffer->lines, curs_pos.row);
     size_t line_length = line_len(&line);
     {  // right horizontal scroll
         size_t column = min(curs_pos.column + 5, line_length);
         c32_t line_str[column + 1];
         line_str[column] = 0;
-        utf32_substr(line_str, &m->buffer->str.data[line.start],
-                     column);
+        text_view_read(m, line_str, line.start, column);
         ff_dimensions_t measurement = ff_measure_utf32(
             line_str, column, typo.font, typo.size, true);
         bool cursor_is_out_of_view =
@@ -342,8 +552,7 @@ void text_scroll_with_cursor_horizontally(text_view_t* m,
                                              : curs_pos.column - 5;
         c32_t line_str[column + 1];
         line_str[column] = 0;
-        utf32_substr(line_str, &m->buffer->str.data[line.start],
-                     column);
+        text_view_read(m, line_str, line.start, column);
         ff_dimensions_t measurement = ff_measure_utf32(
             line_str, column, typo.font, typo.size, true);
         bool cursor_is_out_of_view =
@@ -382,12 +591,11 @@ static float text_get_cursor_x(text_view_t* m, ff_typo_t typo,
                                Rectangle bounds, text_pos_t pos) {
     if (pos.column == 0) return bounds.x;
 
-    line_t cursor_line = m->buffer->lines.data[pos.row];
+    line_t cursor_line = buffer_lines_get(&m->buffer->lines, pos.row);
 
     c32_t cursor_line_str[pos.column + 1];
     cursor_line_str[pos.column] = 0;
-    utf32_substr(cursor_line_str,
-                 &m->buffer->str.data[cursor_line.start], pos.column);
+    text_view_read(m, cursor_line_str, cursor_line.start, pos.column);
 
     float result = ff_measure_utf32(cursor_line_str, pos.column,
                                     typo.font, typo.size, true)
@@ -450,13 +658,12 @@ static Rectangle get_text_dimensions(text_view_t* m, ff_typo_t typo,
                         .width = 0,
                         .height = font_space(typo.size)};
 
-    line_t line = m->buffer->lines.data[row];
+    line_t line = buffer_lines_get(&m->buffer->lines, row);
     assert(line_len(&line) + col + length);
 
     if (col != 0) {
         c32_t offset_str[col];
-        utf32_substr(offset_str, &m->buffer->str.data[line.start],
-                     col);
+        text_view_read(m, offset_str, line.start, col);
         result.x += ff_measure_utf32(offset_str, col, typo.font,
                                      typo.size, true)
                         .width;
@@ -465,8 +672,7 @@ static Rectangle get_text_dimensions(text_view_t* m, ff_typo_t typo,
     ulong start_idx = line.start + col;
     c32_t selected_str[length + 1];
     selected_str[length] = 0;
-    utf32_substr(selected_str, &m->buffer->str.data[start_idx],
-                 length);
+    text_view_read(m, selected_str, start_idx, length);
     result.width = ff_measure_utf32(selected_str, length, typo.font,
                                     typo.size, true)
                        .width;
@@ -526,7 +732,7 @@ static void get_selection_dimensions(text_view_t* m, ff_typo_t typo,
     }
 
     for (size_t i = start_line; i <= end_line; i += 1) {
-        line_t line = m->buffer->lines.data[i];
+        line_t line = buffer_lines_get(&m->buffer->lines, i);
         ulong line_length = line_len(&line);
 
         if (i == start_line) {
@@ -641,8 +847,11 @@ void text_view_draw(text_view_t* m, ff_typo_t typo, Rectangle bounds,
         GetScreenWidth() + m->scroll_motion.position[0],
         GetScreenHeight() + m->scroll_motion.position[1],
         m->scroll_motion.position[1], -1.0f, 1.0f, projection);
-    ff_draw(typo.font, m->glyphs.data, m->glyphs.len,
-            (float*)projection);
+    // clipped like the scissor clips, to the whole pixels it covers
+    float clip[4] = {(int)bounds.x, (int)bounds.y, (int)bounds.width,
+                     (int)bounds.height};
+    ff_batch_draw(typo.font, m->lines.glyphs.data,
+                  m->lines.glyphs.len, (float*)projection, clip);
     EndScissorMode();
 }
 
@@ -705,8 +914,11 @@ void text_view_draw_with_cursor(text_view_t* m, ff_typo_t typo,
         GetScreenWidth() + m->scroll_motion.position[0],
         GetScreenHeight() + m->scroll_motion.position[1],
         m->scroll_motion.position[1], -1.0f, 1.0f, projection);
-    ff_draw(typo.font, m->glyphs.data, m->glyphs.len,
-            (float*)projection);
+    // clipped like the scissor clips, to the whole pixels it covers
+    float clip[4] = {(int)bounds.x, (int)bounds.y, (int)bounds.width,
+                     (int)bounds.height};
+    ff_batch_draw(typo.font, m->lines.glyphs.data,
+                  m->lines.glyphs.len, (float*)projection, clip);
     EndScissorMode();
 }
 
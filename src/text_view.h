@@ -31,8 +31,40 @@ enum text_flags {
     text_flag_mouse_was_pressed = 0x2
 };
 
+// lines laid out as glyphs, the glyphs of the i-th line run from
+// `runs[i]` up to `runs[i + 1]`. `text` holds the codepoint of each
+// glyph
 typedef struct {
     ff_glyph_vec_t glyphs;
+    c32_t* text;
+    ulong text_capacity;
+    ulong* runs;
+    ulong runs_capacity;
+} text_view_lines_t;
+
+// what the lines were laid out from, they are kept while it stays the
+// same
+typedef struct {
+    buffer_t* buffer;
+    size_t version;
+    size_t syntax_version;
+    ff_typo_t typo;
+    float x;
+    float y;
+    ulong lines_length;
+    hlr_rows_t rows;
+} text_view_layout_t;
+
+typedef struct {
+    // the visible lines, in the coordinates of the whole text so
+    // scrolling leaves them be
+    text_view_lines_t lines;
+    text_view_layout_t layout;
+    // the next layout is made here, taking the lines that didn't
+    // change from `lines`
+    text_view_lines_t next_lines;
+    c32_t* line;
+    ulong line_capacity;
     scroll_t scroll;
     motion_t scroll_motion;
     ulong mouse_press_start_line;